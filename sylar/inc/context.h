@@ -0,0 +1,71 @@
+/**
+ * @file context.h
+ * @brief 协程上下文切换
+ * @details x86-64/aarch64 默认使用手写汇编，只保存callee-saved寄存器，
+ *          不做信号掩码相关的系统调用；编译时定义SYLAR_FIBER_UCONTEXT，
+ *          或者其他平台，回退到glibc的ucontext
+ */
+#ifndef __SYLAR_CONTEXT_H_
+#define __SYLAR_CONTEXT_H_
+
+#include <stddef.h>
+
+#if !defined(SYLAR_FIBER_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#   define SYLAR_FIBER_UCONTEXT
+#endif
+
+#ifdef SYLAR_FIBER_UCONTEXT
+#include <ucontext.h>
+#endif
+
+#ifndef SYLAR_FIBER_UCONTEXT
+extern "C" {
+    /**
+     * @brief 汇编实现的上下文切换
+     * @param[out] from 保存当前上下文的栈顶
+     * @param[in] to 要切换到的上下文的栈顶
+     */
+    void sylar_swap_context(void** from, void* to);
+}
+#endif
+
+namespace sylar{
+#ifdef SYLAR_FIBER_UCONTEXT
+    typedef ucontext_t Context;
+#else
+    /// 保存的栈顶指针，callee-saved寄存器都压在该栈上
+    typedef void* Context;
+#endif
+
+    /**
+     * @brief 初始化线程主协程的上下文
+     */
+    void InitContext(Context& ctx);
+
+    /**
+     * @brief 在给定的栈上创建上下文，切入后从fn开始执行
+     * @param[out] ctx 上下文
+     * @param[in] stack 栈的最低地址
+     * @param[in] size 栈大小
+     * @param[in] fn 入口函数，不允许返回
+     */
+    void MakeContext(Context& ctx, void* stack, size_t size, void (*fn)());
+
+    /**
+     * @brief 保存当前上下文到from，切换到to
+     */
+    inline void SwapContext(Context& from, Context& to) {
+#ifdef SYLAR_FIBER_UCONTEXT
+        swapcontext(&from, &to);
+#else
+        sylar_swap_context(&from, to);
+#endif
+    }
+
+    /**
+     * @brief 返回编译时选用的上下文切换实现的名称
+     */
+    const char* ContextBackend();
+}
+
+#endif
@@ -2,31 +2,40 @@
 #define __SYLAR_FD_MANAGER_
 
 
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <vector>
 #include "thread.h"
+#include "fiber.h"
 #include "singleton.h"
+#include "fd_table.h"
 
 namespace sylar{
+    class Scheduler;
+    class IOManager;
+
     /**
      * @brief 文件句柄上下文类
-     * @details 管理文件句柄类型（是否socket）、是否阻塞、是否关闭、读写超时等
+     * @details 管理文件句柄类型（是否socket）、是否阻塞、是否关闭、读写超时等，
+     *          同时保存IOManager在该句柄上的事件等待状态；两者在同一个按缓存行对齐的对象里，
+     *          hook的IO一次查找就能取到。对象由FdManager的分段表持有，分配后不会释放，不需要引用计数
     */
-    class FdCtx : public std::enable_shared_from_this<FdCtx>
+    class alignas(64) FdCtx : public NonCopyAble
     {
     public:
-        typedef std::shared_ptr<FdCtx> ptr;
-        /// @brief 构造函数
+        typedef Mutex MutexType;
+        /// @brief 构造函数，不检查句柄，FdManager::get(fd, true)时才初始化socket属性
         /// @param fd 文件句柄
         FdCtx(int fd);
         /// @brief 析构
         ~FdCtx();
         /// @brief 判断文件管理器是否初始化
-        bool isInit() const { return m_isSocket; };
+        bool isInit() const { return m_isInit; };
         /// @brief 判断是否管理的是socket文件句柄
         bool isSocket() const { return m_isSocket; };
-        /// @brief 判断文件是否关闭
-        bool isClose() const { return m_isClosed; };
+        /// @brief 判断文件是否关闭(或者还没有被FdManager初始化)
+        bool isClose() const { return m_isClosed.load(std::memory_order_acquire); };
         /// @brief 设置用户主动非阻塞
         void setUserNonBlock(bool v) { m_userNonblock = v; };
         bool getUserNonBlock() const { return m_userNonblock; };
@@ -38,9 +47,72 @@ namespace sylar{
         /// @param v 超时时间毫秒
         void setTimeOut(int type, uint64_t v);
         uint64_t getTimeOut(int type) const;
-    
+        int getFd() const { return fd; }
+
+        /// @brief 按缓存行对齐分配
+        static void* operator new(size_t size);
+        static void operator delete(void* ptr);
+
     private:
+        friend class FdManager;
+        /// @brief 读取句柄属性，socket设置为非阻塞；fd号复用时重新初始化
         bool init();
+        /// @brief 标记关闭，之后FdManager::get(fd)返回nullptr
+        void close() { m_isClosed.store(true, std::memory_order_release); }
+        /// @brief fd关闭时内核已经把它移出所有epoll，清除持久注册的状态，需要持有mutex；
+        ///        没有等待中的事件和读写请求时同时放开IOManager的归属，fd号复用后任何IOManager都重新注册
+        void resetRegistration();
+
+    public:
+        /**
+         * @brief 事件上下文类
+        */
+        struct EventContext
+        {
+            Scheduler *scd = nullptr;
+            Fiber::ptr fiber = nullptr;
+            std::function<void()> cb = nullptr;
+            /// 回调的调度优先级，取注册事件的协程的优先级；等待的协程按自己的优先级调度
+            Fiber::Priority priority = Fiber::PRIORITY_NORMAL;
+            /// io_uring后端：poll请求的序号，区分已经删除的请求迟到的完成事件，重置时保留
+            uint16_t seq = 0;
+        };
+        /**
+         * @brief 获取对应的事件上下文类
+         * @param[in] event 事件类型(IOManager::Event)
+        */
+        EventContext& getContext(int event);
+        /**
+         * @brief 重置事件上下文
+         * @param[in, out] ctx 待重置的上下文
+        */
+        void resetContext(EventContext &ctx);
+        /**
+         * @brief 触发事件
+         * @param[in] event 事件类型(IOManager::Event)
+        */
+        void triggerEvent(int event);
+
+        // 以下是IOManager的事件等待状态，持有mutex时读写
+        MutexType mutex;
+        // 与事件关联的句柄
+        int fd = 0;
+        /// 等待中的事件(IOManager::Event)
+        int events = 0;
+        /// 持久注册模式：已经注册到epoll的方向
+        int registered = 0;
+        /// 持久注册模式：没有等待者时到达的就绪事件
+        int ready = 0;
+        /// 注册所在的epoll句柄，多reactor模式下是注册线程自己的epoll，没有注册时为-1
+        int efd = -1;
+        /// 最近一次注册事件或提交读写请求的IOManager，没有等待中的事件、读写请求和持久注册时其他IOManager可以接管
+        IOManager* iom = nullptr;
+        /// io_uring后端：hook提交到内核还没完成的读写请求数
+        int ringOps = 0;
+        // 读事件
+        EventContext read;
+        // 写事件
+        EventContext write;
 
     private:
         /// 是否初始化
@@ -51,10 +123,8 @@ namespace sylar{
         bool m_sysNonblock: 1;
         /// 是否用户主动设置非阻塞
         bool m_userNonblock: 1;
-        /// 是否关闭
-        bool m_isClosed: 1;
-        /// 文件句柄
-        int m_fd;
+        /// 是否关闭，get读取时不加锁
+        std::atomic<bool> m_isClosed;
         /// 读超时时间毫秒
         uint64_t m_recvTimeout;
         /// 写超时时间毫秒
@@ -63,7 +133,6 @@ namespace sylar{
 
     class FdManager {
     public:
-        typedef RWMutex RWMutexType;
         /**
          * @brief 无参构造函数
          */
@@ -73,24 +142,45 @@ namespace sylar{
          * @brief 获取/创建文件句柄类FdCtx
          * @param[in] fd 文件句柄
          * @param[in] auto_create 是否自动创建
-         * @return 返回对应文件句柄类FdCtx::ptr
+         * @return 返回对应文件句柄类FdCtx，没有或者已经删除且不自动创建时返回nullptr；
+         *         对象不会释放，指针一直有效
          */
-        FdCtx::ptr get(int fd, bool auto_create = false);
+        FdCtx* get(int fd, bool auto_create = false);
 
         /**
          * @brief 删除文件句柄类
          * @param[in] fd 文件句柄
+         * @details 标记关闭并清除过时的持久注册状态；等待中的事件由IOManager::cancelAll清理
          */
         void del(int fd);
+
+        /**
+         * @brief 取fd的记录，不检查、不初始化socket属性，IOManager用它保存事件等待状态
+         * @param[in] create 没有时是否分配，超出容量时仍然返回nullptr
+         */
+        FdCtx* getRecord(int fd, bool create) {
+            return create ? m_datas.getOrCreate(fd) : m_datas.get(fd);
+        }
+
+        /**
+         * @brief 访问所有已经分配的记录
+         */
+        template<class F>
+        void foreach(F cb) const {
+            m_datas.foreach(cb);
+        }
+
+        /**
+         * @brief 可以容纳的最大fd加1
+         */
+        static size_t Capacity() { return FdTable<FdCtx>::Capacity(); }
     private:
-        /// 读写锁
-        RWMutexType m_mutex;
-        /// 文件句柄集合
-        std::vector<FdCtx::ptr> m_datas;
+        /// 文件句柄集合：按fd下标的无锁分段表，最多4M个fd
+        FdTable<FdCtx> m_datas;
     };
 
     /// 文件句柄单例
     typedef Singleton<FdManager> FdMgr;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,128 @@
+/**
+ * @file fd_table.h
+ * @brief 按fd下标的无锁两级分段表
+ * @details 第一级是固定长度的段指针数组，第二级是按需分配的段，段里的每个元素也按需分配。
+ *          段和元素分配后不会移动、不会释放(直到表析构)，读取只需要两次原子读，不需要加锁
+ */
+#ifndef __SYLAR_FD_TABLE_H_
+#define __SYLAR_FD_TABLE_H_
+
+#include <atomic>
+#include <stddef.h>
+
+namespace sylar{
+    /**
+     * @brief fd下标的分段表
+     * @param T 元素类型，用T(int fd)构造
+     * @param SegmentBits 每段元素数的位数
+     * @param Segments 段的数量，容量是Segments << SegmentBits
+     */
+    template<class T, size_t SegmentBits = 10, size_t Segments = 4096>
+    class FdTable {
+    public:
+        FdTable()
+            :m_segments(new std::atomic<Segment*>[Segments]) {
+            for(size_t i = 0; i < Segments; ++i) {
+                m_segments[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+        ~FdTable() {
+            for(size_t i = 0; i < Segments; ++i) {
+                Segment* seg = m_segments[i].load(std::memory_order_relaxed);
+                if(!seg) {
+                    continue;
+                }
+                for(size_t j = 0; j < SEGMENT_SIZE; ++j) {
+                    delete seg->slots[j].load(std::memory_order_relaxed);
+                }
+                delete seg;
+            }
+            delete[] m_segments;
+        }
+        FdTable(const FdTable&) = delete;
+        FdTable& operator=(const FdTable&) = delete;
+
+        /**
+         * @brief 可以容纳的最大fd加1
+         */
+        static size_t Capacity() { return Segments * SEGMENT_SIZE; }
+
+        /**
+         * @brief 取fd对应的元素，还没有分配或者超出容量时返回nullptr
+         */
+        T* get(int fd) const {
+            if(fd < 0 || (size_t)fd >= Capacity()) {
+                return nullptr;
+            }
+            Segment* seg = m_segments[fd >> SegmentBits].load(std::memory_order_acquire);
+            if(!seg) {
+                return nullptr;
+            }
+            return seg->slots[fd & (SEGMENT_SIZE - 1)].load(std::memory_order_acquire);
+        }
+
+        /**
+         * @brief 取fd对应的元素，还没有分配时分配，超出容量时返回nullptr
+         * @details 多个线程同时分配时只有一个成功，其他线程释放自己分配的对象后使用成功的那个
+         */
+        T* getOrCreate(int fd) {
+            T* v = get(fd);
+            if(v || fd < 0 || (size_t)fd >= Capacity()) {
+                return v;
+            }
+            std::atomic<Segment*>& slot_seg = m_segments[fd >> SegmentBits];
+            Segment* seg = slot_seg.load(std::memory_order_acquire);
+            if(!seg) {
+                Segment* fresh = new Segment();
+                if(slot_seg.compare_exchange_strong(seg, fresh, std::memory_order_acq_rel)) {
+                    seg = fresh;
+                } else {
+                    delete fresh;
+                }
+            }
+            std::atomic<T*>& slot = seg->slots[fd & (SEGMENT_SIZE - 1)];
+            v = slot.load(std::memory_order_acquire);
+            if(!v) {
+                T* fresh = new T(fd);
+                if(slot.compare_exchange_strong(v, fresh, std::memory_order_acq_rel)) {
+                    v = fresh;
+                } else {
+                    delete fresh;
+                }
+            }
+            return v;
+        }
+
+        /**
+         * @brief 按fd顺序访问所有已经分配的元素
+         * @param[in] cb 对每个元素调用cb(T*)
+         */
+        template<class F>
+        void foreach(F cb) const {
+            for(size_t i = 0; i < Segments; ++i) {
+                Segment* seg = m_segments[i].load(std::memory_order_acquire);
+                if(!seg) {
+                    continue;
+                }
+                for(size_t j = 0; j < SEGMENT_SIZE; ++j) {
+                    T* v = seg->slots[j].load(std::memory_order_acquire);
+                    if(v) {
+                        cb(v);
+                    }
+                }
+            }
+        }
+    private:
+        static const size_t SEGMENT_SIZE = (size_t)1 << SegmentBits;
+        /**
+         * @brief 一段元素指针，值初始化时全部为空
+         */
+        struct Segment {
+            std::atomic<T*> slots[SEGMENT_SIZE];
+        };
+        /// 段指针数组，构造时分配，之后不会改变
+        std::atomic<Segment*>* m_segments;
+    };
+}
+
+#endif
@@ -1,21 +1,30 @@
 #ifndef __SYLAR_FIBER_H_
 #define __SYLAR_FIBER_H_
 
+#include <atomic>
 #include <memory>
-#include <ucontext.h>
+#include <typeinfo>
+#include "context.h"
+#include "intrusive_ptr.h"
 #include "thread.h"
 
 namespace sylar{
     class Scheduler;
+    struct SharedStack;
     /**
      * @brief 协程类
+     * @details 使用侵入式引用计数，从当前协程的裸指针取回Fiber::ptr不需要shared_from_this
      */
-    class Fiber : public std::enable_shared_from_this<Fiber>
+    class Fiber : public RefCounted<Fiber>
     {
         friend Scheduler;
 
     public:
-        typedef std::shared_ptr<Fiber> ptr;
+        typedef IntrusivePtr<Fiber> ptr;
+        /// 协程局部变量的槽位数
+        static const size_t LOCAL_SLOTS = 16;
+        /// 协程局部变量的析构函数
+        typedef void (*LocalDestructor)(void*);
         /**
          * @brief 协程状态
         */
@@ -28,6 +37,29 @@ namespace sylar{
             READY,
             EXCEPT
         };
+        /**
+         * @brief 亲和提示：被唤醒(以任意线程调度)时优先在哪个线程恢复，大于等于0时是线程id
+        */
+        enum Affinity
+        {
+            /// 上次运行的线程，默认值，栈和工作集还在该核的缓存里
+            AFFINITY_LAST = -1,
+            /// 没有偏好，交给任意线程
+            AFFINITY_ANY = -2
+        };
+        /**
+         * @brief 调度优先级，数值越小越优先
+        */
+        enum Priority
+        {
+            /// 延迟敏感的前台任务，总是先于其他任务执行
+            PRIORITY_HIGH = 0,
+            /// 默认
+            PRIORITY_NORMAL = 1,
+            /// 后台任务，按scheduler.low_priority_interval加权或者只在空闲时执行
+            PRIORITY_LOW = 2,
+            PRIORITY_COUNT = 3
+        };
     private:
         /**
          * @brief 无参构造，每个线程的第一个协程
@@ -39,8 +71,15 @@ namespace sylar{
          * @param[in] cb 协程执行的函数
          * @param[in] stacksize 协程栈大小
          * @param[in] use_caller 是否在MainFiber上调度
+         * @param[in] shared_stack 是否运行在线程的共享栈上
+         * @details 共享栈模式下协程没有独立的栈，切出后由下一个占用共享栈的协程把它用到的部分拷贝出去，
+         *          适合大量空闲的长连接协程；协程第一次运行后就绑定在该线程上，之后只能在该线程上恢复
+         * @attention 共享栈协程挂起期间，指向它栈上对象的指针都会悬空：地址上是别的协程的栈内容。
+         *            其他协程不能访问这样的对象，例如栈上的WaitGroup/TaskGroup、Future的共享状态，
+         *            以及交给内核异步读写的缓冲区；这些对象要放在堆上。
+         *            WaitGroup::wait、TaskGroup::wait和Future::get在对象位于当前共享栈上时断言失败
         */
-        Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false);
+        Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false, bool shared_stack = false);
 
         /**
          * @brief 析构函数
@@ -51,8 +90,9 @@ namespace sylar{
          * @brief 重置协程执行函数，并设置状态
          * @pre getState() 为 TERM EXCEPT INIT
          * @post getState() = INIT
+         * @param[in] entry 入口类型，cb是包装函数时由调用方传入真正的入口，用于栈统计
         */
-        void reset(std::function<void()> cb);
+        void reset(std::function<void()> cb, const std::type_info* entry = nullptr);
 
         /**
          * @brief 将协程切换到运行状态
@@ -83,7 +123,53 @@ namespace sylar{
         /**
          * @brief 返回协程状态
         */
-        State getState() const { return m_state; }
+        State getState() const { return m_state.load(std::memory_order_acquire); }
+        /**
+         * @brief 是否运行在共享栈上
+        */
+        bool isSharedStack() const { return m_shared; }
+        /**
+         * @brief 返回绑定的线程id，没有绑定返回-1
+         * @details 共享栈协程的栈内容只能恢复到同一个线程的共享栈上
+        */
+        int getBindThread() const { return m_bindThread; }
+        /**
+         * @brief 设置亲和提示
+         * @param[in] affinity 优先恢复的线程id，或者AFFINITY_LAST、AFFINITY_ANY
+         * @details 只是提示：首选线程忙时其他线程仍然可以窃取，需要严格指定线程时用schedule的thread参数
+        */
+        void setAffinity(int affinity) { m_affinity = affinity; }
+        int getAffinity() const { return m_affinity; }
+        /**
+         * @brief 上次运行该协程的线程id，还没有运行过返回-1
+        */
+        int getLastThread() const { return m_lastThread; }
+        /**
+         * @brief 按亲和提示得到的首选线程id，没有偏好返回-1
+        */
+        int getPreferredThread() const {
+            return m_affinity >= 0 ? m_affinity
+                    : (m_affinity == AFFINITY_LAST ? m_lastThread : -1);
+        }
+        /**
+         * @brief 设置调度优先级
+         * @details 协程被IO事件、定时器唤醒或者主动让出后，按这个优先级重新排队；
+         *          执行回调的协程继承回调调度时的优先级
+        */
+        void setPriority(Priority priority) { m_priority = priority; }
+        Priority getPriority() const { return m_priority; }
+        /**
+         * @brief 返回切出时保存的栈内容大小
+        */
+        size_t getSavedStackSize() const { return m_saveSize; }
+        /**
+         * @brief 返回协程栈大小
+        */
+        uint32_t getStackSize() const { return m_stacksize; }
+        /**
+         * @brief 返回协程入口函数的类型，栈用量按入口统计
+        */
+        const std::type_info& getEntry() const { return *m_entry; }
 
 
     public:
@@ -96,13 +182,18 @@ namespace sylar{
          * @brief 返回当前所在的协程
         */
         static Fiber::ptr GetThis();
+        /**
+         * @brief 返回当前所在协程的裸指针，不增加引用计数
+         * @details 只在当前协程内使用，不能保存到协程切出之后
+        */
+        static Fiber* GetThisRaw();
         /**
          * @brief 当前协程切换到后台，并设置为Ready状态
          * @post getThis() = READY
         */
         static void YieldToReady();
         /**
-         * @brief 当前协程切换到后台，并设置为hold状态
+         * @brief 当前协程切换到后台，切出后由调度协程设置为hold状态
          * @post getThis() = HOLD
         */
         static void YieldToHold();
@@ -124,14 +215,174 @@ namespace sylar{
          * @brief 获取当前协程的id
         */
         static uint64_t GetFiberID();
+        /**
+         * @brief 当前线程上已经开始运行、还没有结束的共享栈协程数量
+         * @details 这些协程只能在本线程上恢复，线程退出前要等它们结束
+        */
+        static size_t GetSharedStackBound();
+        /**
+         * @brief 当前协程运行在共享栈上，且p指向该共享栈
+         * @details 这样的对象在协程挂起期间不能被其他协程访问
+        */
+        static bool OnSharedStack(const void* p);
+        /**
+         * @brief 创建执行cb的协程，优先复用线程本地协程池中已结束的协程
+         * @param[in] cb 协程执行的函数
+         * @param[in] entry 入口类型，决定栈大小档位，默认取cb的类型
+        */
+        static Fiber::ptr Create(std::function<void()> cb, const std::type_info* entry = nullptr);
+        /**
+         * @brief 把已结束的协程放回线程本地的协程池
+         * @details 只回收默认栈大小、私有栈、且没有其他引用的协程，池满时直接释放
+         * @return 是否放入了协程池
+        */
+        static bool Recycle(Fiber::ptr fiber);
+        /**
+         * @brief 返回协程池命中次数
+        */
+        static uint64_t PoolHits();
+        /**
+         * @brief 返回协程池未命中(新建协程)次数
+        */
+        static uint64_t PoolMisses();
+        /**
+         * @brief 返回入口函数类型的可读名称
+        */
+        static std::string GetEntryName(const std::type_info& entry);
+        /**
+         * @brief 返回入口函数对应的栈大小
+         * @details 在fiber.stack_classes中配置了该入口时返回配置值，否则返回fiber.stack_size
+        */
+        static uint32_t GetStackClass(const std::type_info& entry);
+        /**
+         * @brief 输出按入口统计的栈峰值直方图(YAML)
+         * @details 需要打开fiber.stack_profile，输出中的stack_classes可以直接作为fiber.stack_classes配置
+        */
+        static std::string DumpStackProfile();
+        /**
+         * @brief 清空栈峰值统计
+        */
+        static void ResetStackProfile();
+        /**
+         * @brief 分配一个协程局部变量槽位，槽位不回收
+         * @param[in] dtor 协程结束时对非空的值调用的析构函数
+         * @return 槽位下标
+        */
+        static size_t AllocLocalSlot(LocalDestructor dtor);
+        /**
+         * @brief 读取当前协程slot槽位的值
+        */
+        static void* GetLocal(size_t slot);
+        /**
+         * @brief 设置当前协程slot槽位的值，旧值由调用方负责释放
+        */
+        static void SetLocal(size_t slot, void* value);
+
+    private:
+        /**
+         * @brief 切入前准备共享栈：换出当前占用者，恢复自己的栈内容
+        */
+        void loadSharedStack();
+        /**
+         * @brief 把自己在共享栈上用到的部分拷贝到保存区
+        */
+        void saveSharedStack();
+        /**
+         * @brief 用金丝雀值填充协程栈
+        */
+        void paintStack();
+        /**
+         * @brief 统计栈的峰值用量
+        */
+        void recordStackUsage();
+        /**
+         * @brief 对所有非空的局部变量调用析构函数
+        */
+        void destroyLocals();
 
     private:
         uint64_t m_id = 0;
         uint32_t m_stacksize = 0;
-        State m_state = INIT;
-        ucontext_t m_ctx;
+        /// 协程状态：切出的线程release写入，唤醒者和调度器acquire读取
+        std::atomic<State> m_state{INIT};
+        Context m_ctx;
         void *m_stack = nullptr;
         std::function<void()> m_cb;
+        /// 是否共享栈模式
+        bool m_shared = false;
+        /// 绑定的线程id
+        int m_bindThread = -1;
+        /// 亲和提示
+        int m_affinity = AFFINITY_LAST;
+        /// 上次运行的线程id，由调度器在切入前记录
+        int m_lastThread = -1;
+        /// 调度优先级
+        Priority m_priority = PRIORITY_NORMAL;
+        /// 使用的共享栈
+        SharedStack *m_sharedStack = nullptr;
+        /// 切出时保存的栈内容
+        char *m_saveBuffer = nullptr;
+        /// 保存的栈内容大小
+        size_t m_saveSize = 0;
+        /// 保存区容量
+        size_t m_saveCapacity = 0;
+        /// 入口函数类型
+        const std::type_info *m_entry = &typeid(void);
+        /// 栈是否已填充金丝雀值
+        bool m_painted = false;
+        /// 协程局部变量
+        void *m_locals[LOCAL_SLOTS] = {nullptr};
+    };
+
+    /**
+     * @brief 协程局部变量
+     * @details 每个FiberLocal对象静态占用协程内的一个槽位，读写只是对当前协程槽位数组的一次下标访问，
+     *          不需要加锁和查表；协程结束(MainFunc返回前)或析构时delete其中的值。
+     *          应定义为全局或静态变量，槽位数量有限(Fiber::LOCAL_SLOTS)
+     */
+    template<class T>
+    class FiberLocal {
+    public:
+        FiberLocal()
+            :m_slot(Fiber::AllocLocalSlot(&FiberLocal::Destroy)) {
+        }
+        FiberLocal(const FiberLocal&) = delete;
+        FiberLocal& operator=(const FiberLocal&) = delete;
+
+        /**
+         * @brief 返回当前协程中的值，没有设置过返回nullptr
+         */
+        T* get() const {
+            return static_cast<T*>(Fiber::GetLocal(m_slot));
+        }
+        /**
+         * @brief 设置当前协程中的值，接管p的所有权
+         */
+        void reset(T* p = nullptr) {
+            T* old = get();
+            Fiber::SetLocal(m_slot, p);
+            delete old;
+        }
+        /**
+         * @brief 返回当前协程中的值，没有设置过时默认构造一个
+         */
+        T& operator*() {
+            T* v = get();
+            if(!v) {
+                v = new T();
+                Fiber::SetLocal(m_slot, v);
+            }
+            return *v;
+        }
+        T* operator->() {
+            return &**this;
+        }
+    private:
+        static void Destroy(void* p) {
+            delete static_cast<T*>(p);
+        }
+    private:
+        size_t m_slot;
     };
 }
 
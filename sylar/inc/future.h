@@ -0,0 +1,248 @@
+/**
+ * @file future.h
+ * @brief Future/Promise
+ * @details 在协程里等待未完成的Future时挂起当前协程，结果设置后把协程重新放回原来的调度器；
+ *          在普通线程里等待时阻塞线程。超时依赖调度器同时是TimerManager(IOManager)
+ */
+#ifndef __SYLAR_FUTURE_H_
+#define __SYLAR_FUTURE_H_
+
+#include <exception>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <stdexcept>
+#include <type_traits>
+#include "mutex.h"
+
+namespace sylar{
+    /**
+     * @brief Future/Promise共享状态中与结果类型无关的部分：完成标记、异常、等待者
+     */
+    class FutureStateBase {
+    public:
+        typedef std::shared_ptr<FutureStateBase> ptr;
+        typedef Mutex MutexType;
+
+        virtual ~FutureStateBase() {}
+
+        /**
+         * @brief 是否已经完成(设置了结果或异常)
+         */
+        bool isReady();
+        /**
+         * @brief 等待完成
+         * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示一直等待
+         * @return 完成返回true，超时返回false
+         * @details 在调度器的协程中调用时挂起协程，否则阻塞当前线程
+         */
+        bool wait(uint64_t timeout_ms = ~0ull);
+        /**
+         * @brief 完成时执行cb，已完成时立即在当前上下文执行
+         * @details cb在设置结果的上下文中执行，不能阻塞
+         */
+        void onReady(std::function<void()> cb);
+        /**
+         * @brief 设置异常
+         * @return 已经完成过返回false
+         */
+        bool setException(std::exception_ptr ex);
+        /**
+         * @brief 有异常时重新抛出
+         * @pre isReady() == true
+         */
+        void rethrow();
+    protected:
+        /**
+         * @brief 在锁内执行store保存结果，再唤醒所有等待者
+         * @return 已经完成过返回false，store不会被执行
+         */
+        bool complete(const std::function<void()>& store);
+    protected:
+        MutexType m_mutex;
+        bool m_ready = false;
+        std::exception_ptr m_exception;
+        /// 完成时执行的回调，协程/线程等待者也以回调的形式挂在这里
+        std::vector<std::function<void()> > m_callbacks;
+    };
+
+    /**
+     * @brief 共享状态
+     */
+    template<class T>
+    class FutureState : public FutureStateBase {
+    public:
+        typedef std::shared_ptr<FutureState> ptr;
+
+        bool setValue(T v) {
+            return complete([this, &v](){
+                m_value = std::move(v);
+            });
+        }
+        T& value() {
+            rethrow();
+            return m_value;
+        }
+    private:
+        T m_value;
+    };
+
+    template<>
+    class FutureState<void> : public FutureStateBase {
+    public:
+        typedef std::shared_ptr<FutureState> ptr;
+
+        bool setValue() {
+            return complete([](){});
+        }
+        void value() {
+            rethrow();
+        }
+    };
+
+    /**
+     * @brief 异步结果
+     */
+    template<class T>
+    class Future {
+    public:
+        typedef typename FutureState<T>::ptr StatePtr;
+
+        Future() {}
+        explicit Future(StatePtr state)
+            :m_state(state) {
+        }
+
+        /**
+         * @brief 是否关联了Promise
+         */
+        bool valid() const { return (bool)m_state; }
+        /**
+         * @brief 是否已经完成
+         */
+        bool isReady() const { return m_state->isReady(); }
+        /**
+         * @brief 等待完成
+         * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示一直等待
+         * @return 完成返回true，超时返回false
+         */
+        bool wait(uint64_t timeout_ms = ~0ull) const {
+            return m_state->wait(timeout_ms);
+        }
+        /**
+         * @brief 等待并返回结果，设置了异常时抛出该异常
+         */
+        typename std::add_lvalue_reference<T>::type get() const {
+            m_state->wait();
+            return m_state->value();
+        }
+        /**
+         * @brief 完成时执行cb
+         */
+        void onReady(std::function<void()> cb) const {
+            m_state->onReady(std::move(cb));
+        }
+    private:
+        StatePtr m_state;
+    };
+
+    /**
+     * @brief 设置结果的一方
+     */
+    template<class T>
+    class Promise {
+    public:
+        Promise()
+            :m_state(std::make_shared<FutureState<T> >()) {
+        }
+
+        Future<T> getFuture() const {
+            return Future<T>(m_state);
+        }
+        /**
+         * @brief 设置结果，唤醒所有等待者
+         * @return 已经完成过返回false
+         */
+        template<class... Args>
+        bool setValue(Args&&... args) {
+            return m_state->setValue(std::forward<Args>(args)...);
+        }
+        /**
+         * @brief 设置异常，get()时抛出
+         */
+        bool setException(std::exception_ptr ex) {
+            return m_state->setException(ex);
+        }
+    private:
+        typename FutureState<T>::ptr m_state;
+    };
+
+    /**
+     * @brief 所有Future完成后返回它们的结果
+     * @details 等所有Future都完成后再检查异常：有异常时以下标最小的那个Future的异常完成，
+     *          不一定是最先发生的异常；futures为空时立即以空数组完成
+     */
+    template<class T>
+    Future<std::vector<T> > whenAll(const std::vector<Future<T> >& futures) {
+        struct Context {
+            Context(const std::vector<Future<T> >& f)
+                :futures(f), left(f.size()) {}
+            std::vector<Future<T> > futures;
+            Promise<std::vector<T> > promise;
+            Mutex mutex;
+            size_t left;
+        };
+        auto ctx = std::make_shared<Context>(futures);
+        if(futures.empty()) {
+            ctx->promise.setValue(std::vector<T>());
+        }
+        for(auto& i : futures) {
+            i.onReady([ctx](){
+                {
+                    Mutex::Lock lock(ctx->mutex);
+                    if(--ctx->left) {
+                        return;
+                    }
+                }
+                std::vector<T> values;
+                values.reserve(ctx->futures.size());
+                try {
+                    for(auto& f : ctx->futures) {
+                        values.push_back(f.get());
+                    }
+                } catch (...) {
+                    ctx->promise.setException(std::current_exception());
+                    return;
+                }
+                ctx->promise.setValue(std::move(values));
+            });
+        }
+        return ctx->promise.getFuture();
+    }
+
+    /**
+     * @brief 所有Future完成后完成
+     * @details 同whenAll：有异常时以下标最小的那个Future的异常完成；futures为空时立即完成
+     */
+    Future<void> whenAll(const std::vector<Future<void> >& futures);
+
+    /**
+     * @brief 任意一个Future完成后，返回它在futures中的下标
+     * @details futures为空时没有可以等的结果，立即以std::invalid_argument异常完成，等待者不会一直挂起
+     */
+    template<class T>
+    Future<size_t> whenAny(const std::vector<Future<T> >& futures) {
+        auto promise = std::make_shared<Promise<size_t> >();
+        if(futures.empty()) {
+            promise->setException(std::make_exception_ptr(std::invalid_argument("whenAny of no futures")));
+        }
+        for(size_t i = 0; i < futures.size(); ++i) {
+            futures[i].onReady([promise, i](){
+                promise->setValue(i);
+            });
+        }
+        return promise->getFuture();
+    }
+}
+
+#endif
@@ -0,0 +1,125 @@
+/**
+ * @file histogram.h
+ * @brief 耗时直方图
+ * @details 按2的幂(微秒)分桶，记录只是几次无竞争的原子读写，适合放在调度热路径上
+ */
+#ifndef __SYLAR_HISTOGRAM_H_
+#define __SYLAR_HISTOGRAM_H_
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+namespace sylar{
+    /**
+     * @brief 直方图快照，可以合并多个线程的数据
+     */
+    struct HistogramSnapshot {
+        /// 桶的数量，第i个桶记录[2^(i-1), 2^i)微秒，第0个桶记录0微秒，最后一个桶不设上限
+        static const int BUCKETS = 32;
+
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+        uint64_t buckets[BUCKETS] = {0};
+
+        void merge(const HistogramSnapshot& o) {
+            count += o.count;
+            sum += o.sum;
+            max = o.max > max ? o.max : max;
+            for(int i = 0; i < BUCKETS; ++i) {
+                buckets[i] += o.buckets[i];
+            }
+        }
+        /**
+         * @brief 平均值(us)
+         */
+        uint64_t avg() const { return count ? sum / count : 0; }
+        /**
+         * @brief 百分位数(us)，返回所在桶的上界，不超过max
+         * @param[in] p 0到1之间
+         */
+        uint64_t percentile(double p) const {
+            if(!count) {
+                return 0;
+            }
+            uint64_t target = (uint64_t)(p * count);
+            if(target >= count) {
+                target = count - 1;
+            }
+            uint64_t seen = 0;
+            for(int i = 0; i < BUCKETS; ++i) {
+                seen += buckets[i];
+                if(seen > target) {
+                    uint64_t upper = i == BUCKETS - 1 ? max : (1ull << i);
+                    return upper < max ? upper : max;
+                }
+            }
+            return max;
+        }
+        /**
+         * @brief 桶的名称
+         */
+        static std::string BucketName(int i) {
+            if(i == 0) {
+                return "<1us";
+            }
+            if(i == BUCKETS - 1) {
+                return ">=" + std::to_string(1ull << (i - 1)) + "us";
+            }
+            return "<" + std::to_string(1ull << i) + "us";
+        }
+    };
+
+    /**
+     * @brief 单写多读的直方图
+     * @details 只允许一个线程调用record，其他线程可以随时snapshot，读到的是近似一致的数据
+     */
+    class Histogram {
+    public:
+        /**
+         * @brief 记录一个耗时(us)
+         */
+        void record(uint64_t us) {
+            Add(m_buckets[BucketOf(us)], 1);
+            Add(m_count, 1);
+            Add(m_sum, us);
+            if(us > m_max.load(std::memory_order_relaxed)) {
+                m_max.store(us, std::memory_order_relaxed);
+            }
+        }
+        /**
+         * @brief 把当前数据合并到snapshot里
+         */
+        void snapshot(HistogramSnapshot& snap) const {
+            HistogramSnapshot s;
+            s.count = m_count.load(std::memory_order_relaxed);
+            s.sum = m_sum.load(std::memory_order_relaxed);
+            s.max = m_max.load(std::memory_order_relaxed);
+            for(int i = 0; i < HistogramSnapshot::BUCKETS; ++i) {
+                s.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+            }
+            snap.merge(s);
+        }
+
+        static int BucketOf(uint64_t us) {
+            if(!us) {
+                return 0;
+            }
+            int b = 64 - __builtin_clzll(us);
+            return b < HistogramSnapshot::BUCKETS ? b : HistogramSnapshot::BUCKETS - 1;
+        }
+    private:
+        /// 只有一个写线程，不需要原子的加法指令
+        static void Add(std::atomic<uint64_t>& v, uint64_t n) {
+            v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+    private:
+        std::atomic<uint64_t> m_count = {0};
+        std::atomic<uint64_t> m_sum = {0};
+        std::atomic<uint64_t> m_max = {0};
+        std::atomic<uint64_t> m_buckets[HistogramSnapshot::BUCKETS] = {};
+    };
+}
+
+#endif
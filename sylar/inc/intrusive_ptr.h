@@ -0,0 +1,148 @@
+/**
+ * @file intrusive_ptr.h
+ * @brief 侵入式引用计数智能指针
+ * @details 引用计数放在对象内部，拷贝指针只有一次原子加减，
+ *          也不需要shared_from_this的weak_ptr加锁，可以随时从裸指针重新构造
+ */
+#ifndef __SYLAR_INTRUSIVE_PTR_H_
+#define __SYLAR_INTRUSIVE_PTR_H_
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+namespace sylar{
+    /**
+     * @brief 侵入式引用计数基类
+     * @details T需要继承RefCounted<T>，计数归零时delete
+     */
+    template<class T>
+    class RefCounted {
+    public:
+        RefCounted() = default;
+        /**
+         * @brief 拷贝对象时不拷贝引用计数
+         */
+        RefCounted(const RefCounted&) {}
+        RefCounted& operator=(const RefCounted&) { return *this; }
+
+        /**
+         * @brief 增加引用计数
+         */
+        void addRef() const {
+            m_refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        /**
+         * @brief 减少引用计数，归零时释放对象
+         */
+        void release() const {
+            if(m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete static_cast<const T*>(this);
+            }
+        }
+        /**
+         * @brief 返回当前的引用计数
+         */
+        long getRefCount() const {
+            return m_refs.load(std::memory_order_relaxed);
+        }
+    protected:
+        ~RefCounted() = default;
+    private:
+        mutable std::atomic<long> m_refs{0};
+    };
+
+    /**
+     * @brief 侵入式智能指针，接口与std::shared_ptr保持一致
+     */
+    template<class T>
+    class IntrusivePtr {
+    public:
+        typedef T element_type;
+
+        IntrusivePtr() : m_ptr(nullptr) {}
+        IntrusivePtr(std::nullptr_t) : m_ptr(nullptr) {}
+        /**
+         * @brief 从裸指针构造，增加引用计数
+         */
+        explicit IntrusivePtr(T* p) : m_ptr(p) {
+            if(m_ptr) {
+                m_ptr->addRef();
+            }
+        }
+        IntrusivePtr(const IntrusivePtr& rhs) : m_ptr(rhs.m_ptr) {
+            if(m_ptr) {
+                m_ptr->addRef();
+            }
+        }
+        IntrusivePtr(IntrusivePtr&& rhs) noexcept : m_ptr(rhs.m_ptr) {
+            rhs.m_ptr = nullptr;
+        }
+        ~IntrusivePtr() {
+            if(m_ptr) {
+                m_ptr->release();
+            }
+        }
+
+        IntrusivePtr& operator=(const IntrusivePtr& rhs) {
+            IntrusivePtr(rhs).swap(*this);
+            return *this;
+        }
+        IntrusivePtr& operator=(IntrusivePtr&& rhs) noexcept {
+            IntrusivePtr(std::move(rhs)).swap(*this);
+            return *this;
+        }
+        IntrusivePtr& operator=(std::nullptr_t) {
+            reset();
+            return *this;
+        }
+
+        void reset() {
+            IntrusivePtr().swap(*this);
+        }
+        void reset(T* p) {
+            IntrusivePtr(p).swap(*this);
+        }
+        void swap(IntrusivePtr& rhs) noexcept {
+            std::swap(m_ptr, rhs.m_ptr);
+        }
+
+        T* get() const { return m_ptr; }
+        T& operator*() const { return *m_ptr; }
+        T* operator->() const { return m_ptr; }
+        explicit operator bool() const { return m_ptr != nullptr; }
+        /**
+         * @brief 返回引用计数
+         */
+        long use_count() const { return m_ptr ? m_ptr->getRefCount() : 0; }
+    private:
+        T* m_ptr;
+    };
+
+    template<class T, class U>
+    inline bool operator==(const IntrusivePtr<T>& a, const IntrusivePtr<U>& b) { return a.get() == b.get(); }
+    template<class T, class U>
+    inline bool operator!=(const IntrusivePtr<T>& a, const IntrusivePtr<U>& b) { return a.get() != b.get(); }
+    template<class T>
+    inline bool operator==(const IntrusivePtr<T>& a, std::nullptr_t) { return !a; }
+    template<class T>
+    inline bool operator==(std::nullptr_t, const IntrusivePtr<T>& a) { return !a; }
+    template<class T>
+    inline bool operator!=(const IntrusivePtr<T>& a, std::nullptr_t) { return (bool)a; }
+    template<class T>
+    inline bool operator!=(std::nullptr_t, const IntrusivePtr<T>& a) { return (bool)a; }
+    template<class T>
+    inline bool operator<(const IntrusivePtr<T>& a, const IntrusivePtr<T>& b) { return a.get() < b.get(); }
+}
+
+namespace std {
+    template<class T>
+    struct hash<sylar::IntrusivePtr<T> > {
+        size_t operator()(const sylar::IntrusivePtr<T>& p) const {
+            return hash<T*>()(p.get());
+        }
+    };
+}
+
+#endif
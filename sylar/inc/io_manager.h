@@ -1,19 +1,24 @@
 #ifndef __SYLAR_IOMANAGER_H_
 #define __SYLAR_IOMANAGER_H_
 
+#include <sys/epoll.h>
 #include "scheduler.h"
 #include "timer.h"
+#include "uring.h"
+#include "fd_manager.h"
 
 namespace sylar{
 
     /**
-     * @brief 基于epoll的IO调度协程
+     * @brief IO调度协程
+     * @details 默认基于epoll，也可以选择io_uring后端，两者对外的事件、定时器接口相同
+     *          io_uring后端上IOManager::read/write/recv/send和hook的read/write/recv/send由内核完成读写，
+     *          共享栈协程仍然是先尝试、EAGAIN时用poll请求等待就绪再重试
     */
     class IOManager : public Scheduler, public TimerManager
     {
     public:
         typedef std::shared_ptr<IOManager> ptr;
-        typedef RWMutex RWMutexType;
 
         /**
          * @brief IO事件
@@ -28,56 +33,34 @@ namespace sylar{
             WRITE = 0x4
         };
 
-    private:
         /**
-         * @brief Socket事件上下文类
+         * @brief IO后端
         */
-        struct FdContext
+        enum Backend
         {
-            /**
-             * @brief 事件上下文类
-            */
-            typedef Mutex MutexType;
-            struct EventContext
-            {
-                Scheduler *scd = nullptr;
-                Fiber::ptr fiber = nullptr;
-                std::function<void()> cb = nullptr;
-            };
-            /**
-             * @brief 获取对应的事件上下文类
-             * @param[in] event 事件类型
-            */
-            EventContext& getContext(Event event);
-            /**
-             * @brief 重置事件上下文
-             * @param[in, out] ctx 待重置的上下文
-            */
-            void resetContext(EventContext &ctx);
-            /**
-             * @brief 触发事件
-             * @param[in] event 事件类型
-            */
-            void triggerEvent(Event event);
-            // 与事件关联的句柄
-            int fd = 0;
-            // 读事件
-            EventContext read;
-            // 写事件
-            EventContext write;
-
-            MutexType mutex;
-
-            Event events = NONE;
+            // 由配置iomanager.backend决定
+            BACKEND_DEFAULT = 0,
+            // epoll：就绪通知，由调用方读写
+            BACKEND_EPOLL = 1,
+            // io_uring：批量提交，读写由内核完成后通知
+            BACKEND_IO_URING = 2
         };
+
+    private:
+        /**
+         * @brief Socket事件上下文类，和FdManager的socket属性是同一个对象(见FdCtx)
+        */
+        typedef FdCtx FdContext;
     public:
         /**
          * @brief 构造函数
          * @param[in] threads 线程数量
          * @param[in] use_caller 是否使用当前线程
          * @param[in] name 调度器名称
+         * @param[in] backend IO后端，内核不支持io_uring时退回epoll
         */
-        IOManager(size_t thread = 1, bool use_caller = true, const std::string &name = "");
+        IOManager(size_t thread = 1, bool use_caller = true, const std::string &name = ""
+                , Backend backend = BACKEND_DEFAULT);
 
         /**
          * @brief 析构函数
@@ -92,6 +75,10 @@ namespace sylar{
          * @return 成功返回0，否则-1
         */
         int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
+        /**
+         * @brief 添加事件，fd_ctx是FdManager::get取到的句柄上下文，不需要再按fd查找
+        */
+        int addEvent(FdCtx* fd_ctx, Event event, std::function<void()> cb = nullptr);
 
         /**
          * @brief 删除事件
@@ -108,12 +95,65 @@ namespace sylar{
          * @attention 若事件存在会触发事件
         */
         bool cancelEvent(int fd, Event event);
+        /**
+         * @brief 取消事件，fd_ctx是FdManager::get取到的句柄上下文
+        */
+        bool cancelEvent(FdCtx* fd_ctx, Event event);
         /**
          * @brief 取消所有事件
          * @param[in] fd socket句柄
+         * @attention 持久注册模式(iomanager.epoll_persistent)下同时注销fd，关闭fd之前必须调用；hook的close会自动调用
          */
         bool cancelAll(int fd);
 
+        /**
+         * @brief 在当前协程里读
+         * @details io_uring后端先不阻塞地尝试一次，会阻塞时提交读请求，内核读完后恢复协程，不需要再等待可读、重新读；
+         *          epoll后端和共享栈协程先尝试读，EAGAIN时等待可读后重试，要求fd是非阻塞的
+         * @param[in] timeout_ms 超时时间，~0ull表示不超时，超时返回-1且errno为ETIMEDOUT
+         * @return 同read
+         */
+        ssize_t read(int fd, void* buf, size_t len, uint64_t timeout_ms = ~0ull);
+        /**
+         * @brief 在当前协程里写，同read
+         */
+        ssize_t write(int fd, const void* buf, size_t len, uint64_t timeout_ms = ~0ull);
+        /**
+         * @brief 在当前协程里接收，同read
+         */
+        ssize_t recv(int fd, void* buf, size_t len, int flags, uint64_t timeout_ms = ~0ull);
+        /**
+         * @brief 在当前协程里发送，同read
+         */
+        ssize_t send(int fd, const void* buf, size_t len, int flags, uint64_t timeout_ms = ~0ull);
+        /**
+         * @brief hook的读写在会阻塞时调用：io_uring后端提交读写请求，内核完成后带着结果恢复协程
+         * @details 请求记在fd_ctx上，hook的close通过cancelAll取消，此时返回-1且errno为EBADF；
+         *          epoll后端、不能使用io_uring的协程(见canRingIO)或者fd正由其他IOManager等待时
+         *          返回-1且errno为EAGAIN，调用方改为等待就绪
+         * @param[in] opcode IORING_OP_READ/WRITE/RECV/SEND
+         */
+        ssize_t hookIO(FdCtx* fd_ctx, uint8_t opcode, void* buf, size_t len, int flags, uint64_t timeout_ms);
+
+        /**
+         * @brief 实际使用的IO后端
+         */
+        Backend getBackend() const { return m_ring ? BACKEND_IO_URING : BACKEND_EPOLL; }
+        /**
+         * @brief 是否是epoll持久注册模式
+         * @details 每个fd的每个方向只在第一次等待时注册一次(EPOLLET)，触发、删除事件都不再调用epoll_ctl；
+         *          没有等待者时到达的就绪事件记在FdContext里，之后的等待者立即恢复
+         */
+        bool isPersistent() const { return m_persistent; }
+        /**
+         * @brief 是否是多reactor模式
+         * @details 每个线程进入idle时创建自己的epoll，fd注册到发起注册的线程的epoll里，
+         *          事件由该线程取出并在本地调度，协程在等待它的线程上恢复；
+         *          其他调度器的线程注册的fd放在共享的epoll里，由空闲线程轮流处理；
+         *          还没有测到比共享epoll更快的负载，默认关闭
+         */
+        bool isMultiReactor() const { return m_multiReactor; }
+
         /**
          * @brief 返回当前的IOManager
          */
@@ -122,16 +162,25 @@ namespace sylar{
         bool stopping(uint64_t &timeout);
 
     protected:
+        /**
+         * @brief 唤醒一个空闲线程
+         * @details 通过eventfd唤醒，唤醒标记在被唤醒的线程读走eventfd前一直有效，
+         *          这期间的tickle不再写eventfd；多个任务只唤醒一个线程，由它按需继续唤醒
+         */
         void tickle() override;
+        /**
+         * @brief 只唤醒指定的线程
+         * @details 目标线程睡在epoll_pwait里时给它发送唤醒信号，该信号只在epoll_pwait期间不被屏蔽，
+         *          信号在线程醒着时保持挂起，下一次epoll_pwait立即返回，不会丢失唤醒
+         */
+        void tickle(int thread) override;
         void idle() override;
         bool stopping() override;
         void onTimerInsertedAtFront() override;
-
         /**
-         * @brief 重置socket句柄上下文的容器大小
-         * @param[in] size 容量大小
+         * @brief io_uring后端：跟随线程在没有线程等待io_uring时也要醒来，接替等待
          */
-        void contextResize(size_t size);
+        bool hasWork(Worker* worker) override;
 
         // /**
         //  * @brief 判断是否可以停止
@@ -140,16 +189,111 @@ namespace sylar{
         //  */
         // bool stopping(uint64_t& timeout);
     private:
-        /// epoll 文件句柄
+        typedef Mutex RingMutexType;
+
+        /**
+         * @brief io_uring后端的idle
+         * @details 同一时间只有一个线程(等待者)在io_uring_enter里提交请求并等待完成事件，
+         *          其他空闲线程在futex上睡眠；等待者取到完成事件后放开等待，自己要去执行任务时叫醒一个跟随者接替
+         */
+        void idleRing();
+        /**
+         * @brief 成为等待者，已经有等待者时返回false
+         * @param[out] to_submit 需要由等待者提交的请求数
+         */
+        bool takePoller(Worker* worker, uint32_t& to_submit);
+        /**
+         * @brief 放开等待
+         */
+        void releasePoller();
+        /**
+         * @brief 叫醒睡在io_uring_enter里的等待者
+         */
+        void wakePoller();
+        /**
+         * @brief 取一个提交项，需要持有m_ringMutex，队列满时先提交已有的请求
+         */
+        io_uring_sqe* getSqe(RingMutexType::Lock& lock);
+        /**
+         * @brief 发布n个提交项，需要持有m_ringMutex
+         * @details 有等待者睡在内核里时立即提交，否则留给下一个等待者和它的等待一起批量提交
+         */
+        void commitSqes(uint32_t n);
+        /**
+         * @brief io_uring后端：为fd_ctx的事件提交一个poll请求，需要持有fd_ctx->mutex
+         */
+        void ringPoll(FdContext* fd_ctx, Event event);
+        /**
+         * @brief io_uring后端：删除fd_ctx的事件对应的poll请求，需要持有fd_ctx->mutex
+         */
+        void ringRemove(FdContext* fd_ctx, Event event);
+        /**
+         * @brief io_uring后端：监听唤醒用的eventfd
+         */
+        void ringArmTickle();
+        /**
+         * @brief io_uring后端：处理一个完成事件
+         */
+        void onCompletion(uint64_t data, int res);
+        /**
+         * @brief io_uring后端：提交一个读写请求，挂起当前协程直到完成
+         * @param[in] fd_ctx 不为空时把请求记在fd上，cancelAll会取消它；fd正由其他IOManager等待时返回-1且errno为EAGAIN
+         */
+        ssize_t ringIO(uint8_t opcode, int fd, void* buf, size_t len, int flags, uint64_t timeout_ms
+                , FdContext* fd_ctx = nullptr);
+        /**
+         * @brief 就绪通知的读写：EAGAIN时等待事件后重试
+         */
+        ssize_t readyIO(int fd, Event event, uint64_t timeout_ms, const std::function<ssize_t()>& fn);
+        /**
+         * @brief 当前协程能否使用io_uring读写：在调度器里且不在共享栈上(内核会在协程挂起期间写入缓冲区)
+         */
+        bool canRingIO();
+        /**
+         * @brief 持久注册模式下处理一个fd的epoll事件，需要持有fd_ctx->mutex
+         */
+        void onPersistentEvent(FdContext* fd_ctx, uint32_t events);
+        /**
+         * @brief 处理一个fd的epoll事件
+         */
+        void onFdEvent(epoll_event& event);
+        /**
+         * @brief 新注册的fd使用的epoll：当前线程的reactor，当前线程没有reactor时是共享的epoll
+         */
+        int reactorFor();
+        /**
+         * @brief 多reactor模式：为当前线程创建epoll，监听唤醒用的eventfd和共享的epoll
+         */
+        int openReactor();
+        /**
+         * @brief 多reactor模式：线程退出idle时把仍然注册在它的epoll里的fd转到共享的epoll，然后关闭
+         */
+        void closeReactor(int efd);
+    private:
+        /// epoll 文件句柄，多reactor模式下是共享的epoll，嵌套在每个线程的epoll里
         int m_efd = 0;
-        /// pipe 文件句柄
-        int m_tickleFds[2];
+        /// 唤醒用的eventfd
+        int m_tickleFd = -1;
+        /// 是否是epoll持久注册模式，构造时读取配置
+        bool m_persistent = false;
+        /// 是否是多reactor模式，构造时读取配置
+        bool m_multiReactor = false;
+        /// 是否有尚未被处理的唤醒
+        std::atomic<bool> m_tickling = {false};
         /// 当前等待执行的事件数量
         std::atomic<size_t> m_pendingEventCount = {0};
-        /// IOManager的Mutex
-        RWMutexType m_mutex;
-        /// socket事件上下文的容器
-        std::vector<FdContext*> m_fdContexts;
+        /// socket事件上下文所在的FdManager：无锁读取，第一次注册时分配，不会移动
+        FdManager* m_fdManager = nullptr;
+        /// io_uring后端的环形队列，epoll后端为空
+        IoUring* m_ring = nullptr;
+        /// 保护提交队列和等待者状态
+        RingMutexType m_ringMutex;
+        /// 已发布但还没有线程负责提交的请求数
+        uint32_t m_sqUnflushed = 0;
+        /// 是否有线程是等待者
+        std::atomic<bool> m_polling = {false};
+        /// 等待者的工作线程上下文
+        std::atomic<Worker*> m_poller = {nullptr};
     };
 }
 
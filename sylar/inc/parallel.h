@@ -0,0 +1,202 @@
+/**
+ * @file parallel.h
+ * @brief 基于调度器的fork-join数据并行
+ * @details 区间切成分片，分片由调度器的工作线程以协程执行；调用方也领取分片执行，
+ *          分片领完后挂起等待(协程里不阻塞线程)。辅助任务数量不超过调度器线程数，
+ *          不会超额订阅；不在调度器里调用时顺序执行
+ */
+#ifndef __SYLAR_PARALLEL_H_
+#define __SYLAR_PARALLEL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <vector>
+#include "future.h"
+#include "scheduler.h"
+
+namespace sylar{
+    /**
+     * @brief 一次并行执行的共享状态，辅助任务可能晚于调用方返回才开始，用shared_ptr持有
+     */
+    template<class Body>
+    class ParallelState {
+    public:
+        ParallelState(Body* body, size_t chunks)
+            :m_body(body)
+            ,m_chunks(chunks) {
+        }
+
+        /**
+         * @brief 领取并执行分片，直到分片领完
+         * @details 分片领完之后不再访问m_body，调用方返回后m_body失效也不影响晚到的辅助任务
+         */
+        void work() {
+            size_t i;
+            while((i = m_next.fetch_add(1, std::memory_order_relaxed)) < m_chunks) {
+                if(!m_failed.load(std::memory_order_relaxed)) {
+                    try {
+                        (*m_body)(i);
+                    } catch (...) {
+                        Mutex::Lock lock(m_mutex);
+                        if(!m_error) {
+                            m_error = std::current_exception();
+                        }
+                        m_failed = true;
+                    }
+                }
+                if(m_finished.fetch_add(1, std::memory_order_acq_rel) + 1 == m_chunks) {
+                    m_done.setValue();
+                }
+            }
+        }
+        Future<void> getFuture() const { return m_done.getFuture(); }
+        /**
+         * @brief 有分片抛出异常时重新抛出第一个
+         */
+        void rethrow() {
+            if(m_error) {
+                std::rethrow_exception(m_error);
+            }
+        }
+    private:
+        Body* m_body;
+        size_t m_chunks;
+        std::atomic<size_t> m_next{0};
+        std::atomic<size_t> m_finished{0};
+        std::atomic<bool> m_failed{false};
+        Mutex m_mutex;
+        std::exception_ptr m_error;
+        Promise<void> m_done;
+    };
+
+    /**
+     * @brief 在当前调度器上并行执行body(0)..body(chunks-1)，返回时全部执行完
+     * @exception 重新抛出第一个分片抛出的异常，之后还没开始的分片不再执行
+     */
+    template<class Body>
+    void ParallelRun(size_t chunks, Body& body) {
+        Scheduler* sc = Scheduler::GetThis();
+        if(!sc || chunks <= 1) {
+            for(size_t i = 0; i < chunks; ++i) {
+                body(i);
+            }
+            return;
+        }
+        auto state = std::make_shared<ParallelState<Body> >(&body, chunks);
+        //调用方自己占一个线程
+        size_t helpers = std::min(sc->getThreadCount(), chunks) - 1;
+        for(size_t i = 0; i < helpers; ++i) {
+            sc->schedule([state](){
+                state->work();
+            });
+        }
+        state->work();
+        state->getFuture().wait();
+        state->rethrow();
+    }
+
+    /**
+     * @brief 分片大小：未指定时按线程数的8倍切分，兼顾负载均衡和调度开销
+     */
+    inline size_t ParallelGrain(size_t n, size_t grain) {
+        if(grain) {
+            return grain;
+        }
+        Scheduler* sc = Scheduler::GetThis();
+        size_t threads = sc ? sc->getThreadCount() : 1;
+        return std::max<size_t>(1, n / (threads * 8));
+    }
+
+    /**
+     * @brief 并行执行f(i)，i属于[begin, end)
+     * @param[in] grain 每个分片的元素个数，0表示自动
+     */
+    template<class Index, class F>
+    void parallel_for(Index begin, Index end, F f, size_t grain = 0) {
+        if(!(begin < end)) {
+            return;
+        }
+        size_t n = end - begin;
+        grain = ParallelGrain(n, grain);
+        auto body = [&](size_t chunk) {
+            Index b = begin + chunk * grain;
+            Index e = chunk * grain + grain >= n ? end : b + grain;
+            for(Index i = b; i < e; ++i) {
+                f(i);
+            }
+        };
+        ParallelRun((n + grain - 1) / grain, body);
+    }
+
+    /**
+     * @brief 并行归约
+     * @param[in] identity 单位元，每个分片从它开始累积
+     * @param[in] f T f(Index b, Index e, T init)，累积[b, e)
+     * @param[in] reduce T reduce(T, T)，按分片顺序合并，不要求可交换
+     * @param[in] grain 每个分片的元素个数，0表示自动
+     */
+    template<class Index, class T, class F, class R>
+    T parallel_reduce(Index begin, Index end, T identity, F f, R reduce, size_t grain = 0) {
+        if(!(begin < end)) {
+            return identity;
+        }
+        size_t n = end - begin;
+        grain = ParallelGrain(n, grain);
+        size_t chunks = (n + grain - 1) / grain;
+        std::vector<T> partial(chunks, identity);
+        auto body = [&](size_t chunk) {
+            Index b = begin + chunk * grain;
+            Index e = chunk * grain + grain >= n ? end : b + grain;
+            partial[chunk] = f(b, e, identity);
+        };
+        ParallelRun(chunks, body);
+        T result = identity;
+        for(auto& i : partial) {
+            result = reduce(result, i);
+        }
+        return result;
+    }
+
+    /**
+     * @brief 并行排序：分片并行std::sort，再逐轮两两并行归并
+     * @details 不稳定；归并用std::inplace_merge，可能申请临时缓冲区
+     */
+    template<class RandomIt, class Compare>
+    void parallel_sort(RandomIt first, RandomIt last, Compare comp, size_t grain = 0) {
+        size_t n = last - first;
+        if(n < 2) {
+            return;
+        }
+        grain = ParallelGrain(n, grain);
+        size_t chunks = (n + grain - 1) / grain;
+        auto sort_body = [&](size_t chunk) {
+            RandomIt b = first + chunk * grain;
+            RandomIt e = chunk * grain + grain >= n ? last : b + grain;
+            std::sort(b, e, comp);
+        };
+        ParallelRun(chunks, sort_body);
+        for(size_t width = grain; width < n; width *= 2) {
+            size_t pairs = (n + 2 * width - 1) / (2 * width);
+            auto merge_body = [&](size_t pair) {
+                size_t b = pair * 2 * width;
+                size_t m = std::min(b + width, n);
+                size_t e = std::min(b + 2 * width, n);
+                if(m < e) {
+                    std::inplace_merge(first + b, first + m, first + e, comp);
+                }
+            };
+            ParallelRun(pairs, merge_body);
+        }
+    }
+
+    template<class RandomIt>
+    void parallel_sort(RandomIt first, RandomIt last) {
+        parallel_sort(first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+    }
+}
+
+#endif
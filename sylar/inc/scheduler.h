@@ -4,15 +4,27 @@
 #include <iostream>
 #include <vector>
 #include <list>
+#include <mutex>
+#include <condition_variable>
 #include <iostream>
 #include "fiber.h"
 #include "thread.h"
+#include "conf.h"
+#include "histogram.h"
+#include "task.h"
+#include "work_steal_queue.h"
 
 
 namespace sylar{
     /**
      * @brief 协程调度器
-     * @details 封装的N-M的协程调度器，内部有一个线程池，支持协程在线程池里切换
+     * @details 封装的N-M的协程调度器，内部有一个线程池，支持协程在线程池里切换。
+     *          每个工作线程有自己的无锁双端队列，工作线程提交的任务放入自己的队列(LIFO执行)，
+     *          空闲时从其他线程的队列窃取；外部线程提交的任务和指定线程的任务放入全局注入队列。
+     *          被唤醒的协程按亲和提示优先回到上次运行的线程(scheduler.cache_affinity)，
+     *          首选线程忙时其他线程才可以窃取。
+     *          高优先级和低优先级任务各有一个全局队列：高优先级总是先取，
+     *          低优先级按scheduler.low_priority_interval加权插入，或者只在没有其他任务时执行
     */
     class Scheduler
     {
@@ -50,18 +62,45 @@ namespace sylar{
          * @brief 结束
         */
         void stop();
+        /**
+         * @brief 运行中调整线程数量
+         * @param[in] threads 线程总数，和构造函数的含义相同(包括use_caller的调用线程)
+         * @details 扩容直接启动新线程；缩容时从最后加入的线程开始退休：退休线程不再领取新任务，
+         *          本地队列里的任务转到全局注入队列，等指定给它的任务和它上面的共享栈协程都结束后退出。
+         *          调用线程不会退休。未启动时只修改启动时创建的线程数
+        */
+        void setThreadCount(size_t threads);
+        /**
+         * @brief 线程总数(包括use_caller的调用线程)，不包括退休中的线程
+        */
+        size_t getThreadCount() const;
+        /**
+         * @brief 线程数量跟随配置项变化，例如workers.io.thread_num
+         * @details 立即应用当前值，调度器析构时移除监听
+        */
+        void bindThreadCount(ConfigVar<uint32_t>::ptr var);
 
         /**
-         * @brief 调度协程，将单个协程放入协程组中
+         * @brief 调度协程
+         * @param[in] fiber 协程
+         * @param[in] thread 指定执行的线程id，-1表示任意线程
         */
-        template <typename FiberOrCb>
-        void schedule(FiberOrCb fc,int thread = -1){
-            bool need_tickle = false;
-            {
-                MutexType::Lock lock(m_mutex);
-                need_tickle = schedulerNoLock(fc, thread);
-            }
-            if(need_tickle){
+        void schedule(Fiber::ptr fiber, int thread = -1) {
+            schedule(&fiber, thread);
+        }
+        /**
+         * @brief 调度协程或回调
+         * @details Fiber::ptr*和std::function<void()>*的内容被取走；其他可调度对象被转发构造到任务节点里，
+         *          不超过Task::INLINE_SIZE的lambda不需要堆分配
+         * @param[in] f 协程指针、std::function指针、或者任意无参可调用对象
+         * @param[in] thread 指定执行的线程id，-1表示任意线程
+         * @param[in] priority 回调的调度优先级，协程使用Fiber::setPriority设置的优先级；
+         *            指定了线程的任务总是先于其他任务执行，不区分优先级
+        */
+        template <typename F>
+        void schedule(F&& f, int thread = -1, Fiber::Priority priority = Fiber::PRIORITY_NORMAL){
+            Task* task = MakeTask(std::forward<F>(f), thread, priority);
+            if(task && enqueue(task)){
                 tickle();
             }
         }
@@ -71,22 +110,77 @@ namespace sylar{
         template <typename InputIterator>
         void schedule(InputIterator begin,InputIterator end){
             bool need_tickle = false;
-            {
-                MutexType::Lock lock(m_mutex);
-                while(begin != end){
-                    need_tickle = schedulerNoLock(&*begin, -1) || need_tickle;
-                    ++begin;
+            while(begin != end){
+                if(Task* task = MakeTask(&*begin, -1, Fiber::PRIORITY_NORMAL)) {
+                    need_tickle = enqueue(task) || need_tickle;
                 }
+                ++begin;
             }
             if(need_tickle){
                 tickle();
             }
         }
+        /**
+         * @brief 批量放入协程或回调，逐个指定优先级
+         * @param[in] priority 和[begin, end)一一对应的优先级
+        */
+        template <typename InputIterator, typename PriorityIterator>
+        void schedule(InputIterator begin, InputIterator end, PriorityIterator priority){
+            bool need_tickle = false;
+            while(begin != end){
+                if(Task* task = MakeTask(&*begin, -1, *priority)) {
+                    need_tickle = enqueue(task) || need_tickle;
+                }
+                ++begin;
+                ++priority;
+            }
+            if(need_tickle){
+                tickle();
+            }
+        }
+        /**
+         * @brief 调度器运行统计
+        */
+        struct Stats {
+            /// 提交的任务数，包括主动让出后重新放回的协程
+            uint64_t enqueued = 0;
+            /// 执行的任务数(每次切入算一次)
+            uint64_t executed = 0;
+            /// 从其他线程窃取的任务数
+            uint64_t stolen = 0;
+            /// 按亲和提示回到首选线程执行的协程数
+            uint64_t affine = 0;
+            /// idle协程返回调度循环的次数
+            uint64_t idleWakeups = 0;
+            /// 看门狗发现的超时运行次数
+            uint64_t slowSlices = 0;
+            /// 任务从放入队列到开始执行的时间
+            HistogramSnapshot queueWait;
+            /// 按优先级区分的排队时间，下标是Fiber::Priority
+            HistogramSnapshot priorityQueueWait[Fiber::PRIORITY_COUNT];
+            /// 每次切入任务到切回调度协程的时间
+            HistogramSnapshot runSlice;
+
+            /**
+             * @brief 输出成YAML
+            */
+            std::string toString() const;
+        };
+        /**
+         * @brief 汇总所有工作线程的统计，计数是近似值
+         * @details 耗时直方图只在scheduler.stats_timing为true时记录(默认关闭)
+        */
+        Stats getStats() const;
     protected:
         /**
          * @brief 通知协程调度器有任务了
         */
         virtual void tickle();
+        /**
+         * @brief 通知指定线程有任务了
+         * @details 默认退化为tickle()，子类可以只唤醒目标线程
+        */
+        virtual void tickle(int thread);
         /**
          * @brief 协程调度函数
         */
@@ -109,63 +203,267 @@ namespace sylar{
          * @brief 是否有空闲线程
         */
         bool hasIdleThreads() { return m_idleThreadCount > 0;}
+    protected:
+        /**
+         * @brief 工作线程的上下文
+        */
+        struct Worker {
+            /// 生命周期：运行 -> 退休中(排空任务) -> 已退出，已退出的上下文在扩容时复用
+            enum State {
+                ACTIVE,
+                RETIRING,
+                RETIRED
+            };
+            Worker(Scheduler* s)
+                :scheduler(s) {}
+            /// 所属调度器
+            Scheduler* scheduler;
+            std::atomic<int> state = {ACTIVE};
+            /// 运行该上下文的线程，调用线程为空
+            Thread::ptr runner;
+            /// 线程id，进入run之前为-1
+            std::atomic<int> thread = {-1};
+            /// 线程句柄
+            pthread_t handle = 0;
+            /// 本地任务队列
+            WorkStealQueue<Task> queue;
+            /// 取任务的次数，用于定期检查全局注入队列
+            uint32_t tick = 0;
+            /// 取任务的次数，用于按权重插入低优先级任务
+            uint32_t lowTick = 0;
+            /// 指定在该线程执行的任务，多个生产者，只有该线程消费
+            Mutex inboxMutex;
+            TaskList inbox;
+            std::atomic<size_t> inboxCount = {0};
+            /// 是否在idle中睡眠，定向唤醒只在睡眠时才需要通知
+            std::atomic<bool> sleeping = {false};
+            /// 睡眠期间是否已经通知过，合并重复的唤醒
+            std::atomic<bool> notified = {false};
+            /// 普通调度器idle时等待的futex，唤醒方置1
+            std::atomic<int> futex = {0};
+            /// 是否在idle协程里，不在时说明正忙，收件箱里的亲和任务可以被其他线程窃取
+            std::atomic<bool> idling = {false};
+            /// 运行统计，只有该线程写
+            std::atomic<uint64_t> enqueued = {0};
+            std::atomic<uint64_t> executed = {0};
+            std::atomic<uint64_t> stolen = {0};
+            std::atomic<uint64_t> affine = {0};
+            std::atomic<uint64_t> idleWakeups = {0};
+            Histogram queueWait[Fiber::PRIORITY_COUNT];
+            Histogram runSlice;
+            /// 正在执行的任务：协程id、入口、开始时间(us)，不在执行任务时开始时间为0
+            std::atomic<uint64_t> sliceFiber = {0};
+            std::atomic<const std::type_info*> sliceEntry = {nullptr};
+            std::atomic<uint64_t> sliceStart = {0};
+            /// 最近一次报告过的执行，同一次执行只报告一次，只有看门狗访问
+            uint64_t reportedSlice = 0;
+            /// 看门狗请求的调用栈，由该线程在信号处理函数里填写
+            void* backtrace[32];
+            std::atomic<int> backtraceSize = {0};
+            std::atomic<bool> backtraceReady = {false};
+        };
+
+        /**
+         * @brief 按线程id查找工作线程，不是本调度器的线程返回nullptr
+        */
+        Worker* findWorker(int thread);
+        /**
+         * @brief 当前线程的工作线程上下文
+        */
+        static Worker* GetWorker();
+        /**
+         * @brief 当前线程是否是已经排空、可以退出的退休线程，idle据此返回
+        */
+        bool canRetire();
+        /**
+         * @brief 是否有等待执行的任务(近似值)
+         * @details 检查全局注入队列、优先级队列、所有线程的本地队列和worker自己的收件箱
+        */
+        bool hasPendingTasks(Worker* worker);
+        /**
+         * @brief park的醒来条件：有任务、可以停止或者可以退休，子类可以增加自己的条件
+        */
+        virtual bool hasWork(Worker* worker);
+        /**
+         * @brief 当前线程自旋一段时间后睡眠，直到被unpark或者hasWork
+        */
+        void park(Worker* worker);
+        /**
+         * @brief 唤醒睡眠中的worker，已经通知过的不重复唤醒
+         * @return 是否发出了唤醒
+        */
+        bool unpark(Worker* worker);
+        /**
+         * @brief 唤醒一个睡眠中的运行线程
+         * @return 没有睡眠的线程时返回false
+        */
+        bool unparkOne();
     private:
+
         /**
-         * @brief 协程/函数/线程   组
-         * @details 被调度的元素
-        */
-        struct FiberAndThread{
-            ///协程
-            Fiber::ptr fiber;
-            ///函数
-            std::function<void()> cb;
-            ///线程组
-            int thread;
-
-            FiberAndThread(Fiber::ptr f, int thr)
-                : fiber(f), thread(thr){}
-            FiberAndThread(Fiber::ptr *f, int thr)
-                : fiber(*f), thread(thr){}
-            FiberAndThread(std::function<void()> f, int thr)
-                : cb(f), thread(thr){}
-            FiberAndThread(std::function<void()>* f, int thr)
-                :thread(thr) {
-                    cb.swap(*f);
-                }
-            /**
-            * @brief 无参构造函数
-            */
-            FiberAndThread()
-                :thread(-1) {
+         * @brief 从协程指针取走协程
+        */
+        static bool SetTask(Task* task, Fiber::ptr* fiber) {
+            task->fiber.swap(*fiber);
+            return (bool)task->fiber;
+        }
+        /**
+         * @brief 从std::function指针取走回调
+        */
+        static bool SetTask(Task* task, std::function<void()>* cb) {
+            if(!*cb) {
+                return false;
             }
-            /**
-             * @brief 重置
-            */
-            void reset()
-            {
-                fiber = nullptr;
-                cb = nullptr;
-                thread = -1;
+            task->setCallback(std::move(*cb));
+            *cb = nullptr;
+            return true;
+        }
+        template<class F>
+        static bool SetTask(Task* task, F&& f) {
+            if(IsNull(f)) {
+                return false;
             }
-        };
-    private:
-        template<class FiberOrCb>
-        bool schedulerNoLock(FiberOrCb fc,int thread){
-            bool need_tickle = m_fibers.empty();
-            FiberAndThread ft(fc, thread);
-            if(ft.fiber || ft.cb){
-                m_fibers.push_back(ft);
+            task->setCallback(std::forward<F>(f));
+            return true;
+        }
+        template<class F>
+        static bool IsNull(const F&) { return false; }
+        static bool IsNull(const std::function<void()>& f) { return !f; }
+        static bool IsNull(void (*f)()) { return !f; }
+
+        /**
+         * @brief 构造任务节点，没有可执行的内容时返回nullptr
+        */
+        template<class F>
+        static Task* MakeTask(F&& f, int thread, Fiber::Priority priority) {
+            Task* task = Task::Alloc();
+            if(!SetTask(task, std::forward<F>(f))) {
+                Task::Free(task);
+                return nullptr;
             }
-            return need_tickle;
+            task->thread = thread;
+            task->priority = task->fiber ? task->fiber->getPriority() : priority;
+            return task;
         }
+        /**
+         * @brief 放入任务
+         * @details 指定线程的任务放入目标线程的收件箱并只唤醒目标线程；
+         *          有首选线程的协程放入首选线程的收件箱(见enqueueAffine)；
+         *          当前线程是本调度器的工作线程时放入本地队列，否则放入全局注入队列
+         * @return 是否需要唤醒其他线程
+        */
+        bool enqueue(Task* task);
+        /**
+         * @brief 把没有指定线程的协程放入首选线程的收件箱
+         * @details 首选线程空闲时只唤醒它；首选线程忙时唤醒其他线程来窃取
+         * @param[out] need_tickle 是否需要唤醒其他线程
+         * @return 首选线程已经退休或者退休中时返回false，任务没有放入
+        */
+        bool enqueueAffine(Worker* target, Task* task, bool& need_tickle);
+        /**
+         * @brief 放入全局注入队列
+        */
+        bool inject(Task* task);
+        /**
+         * @brief 全局的高/低优先级队列
+        */
+        struct PriorityQueue {
+            Mutex mutex;
+            TaskList tasks;
+            std::atomic<size_t> count = {0};
+        };
+        /**
+         * @brief 非默认优先级的任务放入对应的全局队列
+        */
+        bool pushPriority(Task* task);
+        /**
+         * @brief 从全局优先级队列取出一个可以执行的任务
+        */
+        Task* takePriority(PriorityQueue& queue);
+        /**
+         * @brief 取下一个任务：收件箱 -> 高优先级队列 -> (按权重)低优先级队列 -> 本地队列 -> 全局注入队列
+         *        -> 窃取其他线程的队列 -> 窃取忙碌线程收件箱里的亲和任务 -> 低优先级队列
+         * @param[out] tickle_me 是否还有其他线程可以执行的任务
+        */
+        Task* nextTask(Worker* worker, bool& tickle_me);
+        /**
+         * @brief 从收件箱取出指定在当前线程执行的任务
+        */
+        Task* takePinned(Worker* worker);
+        /**
+         * @brief 从正在忙的线程的收件箱里窃取没有指定线程的亲和任务
+        */
+        Task* stealAffine(Worker* worker);
+        /**
+         * @brief 从全局注入队列取出当前线程可以执行的任务
+        */
+        Task* takeInjected(bool& tickle_me);
+        /**
+         * @brief 主动让出(READY)的协程放回全局注入队列尾部
+        */
+        void yieldTask(Fiber::ptr& fiber);
+        /**
+         * @brief 本地队列或窃取到的协程还没有真正切出时，转到全局注入队列等待
+        */
+        bool runnable(Task* task);
+        /**
+         * @brief 为worker启动一个线程，需要持有m_mutex
+        */
+        void spawn(Worker* worker);
+        /**
+         * @brief 已经创建的工作线程上下文数量，上下文只增不减，并发读取时用它代替m_workers.size()
+        */
+        size_t workerCount() const { return m_workerCount.load(std::memory_order_acquire); }
+        /**
+         * @brief 看门狗线程：定期检查每个工作线程当前任务的执行时间，超过scheduler.watchdog_budget_ms时
+         *        输出协程id、入口和调用栈
+        */
+        void watchdog();
+        /**
+         * @brief 报告一次超时的执行
+        */
+        void reportSlowSlice(Worker* worker, uint64_t start, uint64_t now);
+        /**
+         * @brief 停止看门狗线程
+        */
+        void stopWatchdog();
+        /**
+         * @brief 看门狗请求调用栈的信号处理函数，在被检查的线程上执行
+        */
+        static void WatchdogHandler(int sig);
 
     private:
         MutexType m_mutex;
         std::string m_name;
         std::vector<Thread::ptr> m_threads;
-        //待执行的协程队列
-        std::list<FiberAndThread> m_fibers;
+        //全局注入队列：外部线程提交的任务、目标线程还没有启动时指定线程的任务
+        TaskList m_fibers;
+        //全局注入队列的长度，为0时不加锁
+        std::atomic<size_t> m_injectCount = {0};
+        //高优先级和低优先级任务的全局队列
+        PriorityQueue m_highTasks;
+        PriorityQueue m_lowTasks;
+        //非工作线程提交的任务数
+        std::atomic<uint64_t> m_externalEnqueued = {0};
+        //工作线程上下文，启动时预留容量，扩容不会重新分配，其他线程可以无锁遍历
+        std::vector<Worker*> m_workers;
+        std::atomic<size_t> m_workerCount = {0};
+        //调用线程的上下文(use_caller)
+        Worker* m_rootWorker = nullptr;
+        //线程名的序号
+        size_t m_nextThreadIndex = 0;
+        //绑定的线程数配置项
+        ConfigVar<uint32_t>::ptr m_threadCountVar;
+        uint64_t m_threadCountListener = 0;
+        //当前线程的工作线程上下文
+        static thread_local Worker* t_worker;
         Fiber::ptr m_rootFiber;
+        //看门狗线程，scheduler.watchdog_budget_ms为0时不启动
+        Thread::ptr m_watchdog;
+        std::mutex m_watchdogMutex;
+        std::condition_variable m_watchdogCond;
+        bool m_watchdogStop = false;
+        std::atomic<uint64_t> m_slowSlices = {0};
 
     protected:
         /// 线程id数组
@@ -10,6 +10,9 @@
 #include "fiber.h"
 #include "scheduler.h"
 #include "io_manager.h"
+#include "future.h"
+#include "parallel.h"
+#include "task_group.h"
 #include <sys/epoll.h>
 
 #endif
\ No newline at end of file
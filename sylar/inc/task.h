@@ -0,0 +1,208 @@
+/**
+ * @file task.h
+ * @brief 调度器的任务节点
+ * @details 任务节点自带队列指针(侵入式)，回调直接构造在节点内部的小缓冲区里，
+ *          节点从线程本地的空闲链表分配，线程间多余的节点经全局中转池整批流转；
+ *          调度一个捕获不多的lambda不需要任何堆分配
+ */
+#ifndef __SYLAR_TASK_H_
+#define __SYLAR_TASK_H_
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include "fiber.h"
+
+namespace sylar{
+    /**
+     * @brief 任务：一个协程，或者一个要放到协程里执行的回调
+     * @details 节点只通过指针传递，不可拷贝；回调只能移动进来，大于INLINE_SIZE
+     *          或者移动可能抛异常的回调放到堆上
+     */
+    class Task {
+    public:
+        /// 内联存放回调的缓冲区大小
+        static const size_t INLINE_SIZE = 48;
+
+        Task() {}
+        ~Task() { clear(); }
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+
+        /**
+         * @brief 分配一个空的任务节点，优先使用线程本地空闲链表，其次从全局中转池整批取回
+         */
+        static Task* Alloc();
+        /**
+         * @brief 释放任务节点，放回当前线程的空闲链表，链表满时把一半节点交给全局中转池
+         */
+        static void Free(Task* task);
+        /**
+         * @brief 返回本地链表和中转池都没有空闲节点、从堆上新建节点的次数
+         */
+        static uint64_t CacheMisses();
+
+        /**
+         * @brief 设置回调，f被移动(右值)或拷贝(左值)进节点
+         */
+        template<class F>
+        void setCallback(F&& f) {
+            typedef typename std::decay<F>::type Fn;
+            clearCallback();
+            setCallbackImpl<Fn>(std::forward<F>(f), std::integral_constant<bool, IsInline<Fn>::value>());
+        }
+        /**
+         * @brief 是否有回调
+         */
+        bool hasCallback() const { return m_ops != nullptr; }
+        /**
+         * @brief 执行回调
+         */
+        void invoke() { m_ops->invoke(m_storage); }
+        /**
+         * @brief 回调的类型，std::function返回其内部可调用对象的类型
+         */
+        const std::type_info& target_type() const {
+            return m_ops ? m_ops->type(m_storage) : typeid(void);
+        }
+        /**
+         * @brief 销毁回调，释放协程
+         */
+        void clear() {
+            clearCallback();
+            fiber.reset();
+            thread = -1;
+            priority = Fiber::PRIORITY_NORMAL;
+            enqueueTime = 0;
+            next = nullptr;
+        }
+    public:
+        /// 队列指针
+        Task* next = nullptr;
+        /// 要调度的协程，和回调二选一
+        Fiber::ptr fiber;
+        /// 指定执行的线程id，-1表示任意线程
+        int thread = -1;
+        /// 调度优先级，协程任务取协程自己的优先级
+        Fiber::Priority priority = Fiber::PRIORITY_NORMAL;
+        /// 放入队列的时间(us)，用于统计排队耗时，0表示未记录
+        uint64_t enqueueTime = 0;
+    private:
+        struct Ops {
+            void (*invoke)(void*);
+            void (*destroy)(void*);
+            const std::type_info& (*type)(const void*);
+        };
+
+        template<class Fn>
+        struct IsInline {
+            static const bool value = sizeof(Fn) <= INLINE_SIZE
+                && alignof(Fn) <= alignof(std::max_align_t)
+                && std::is_nothrow_move_constructible<Fn>::value;
+        };
+
+        template<class Fn>
+        static const std::type_info& TargetType(const Fn&) { return typeid(Fn); }
+        static const std::type_info& TargetType(const std::function<void()>& f) { return f.target_type(); }
+
+        /// 回调存放在m_storage里
+        template<class Fn>
+        struct InlineOps {
+            static void Invoke(void* p) { (*static_cast<Fn*>(p))(); }
+            static void Destroy(void* p) { static_cast<Fn*>(p)->~Fn(); }
+            static const std::type_info& Type(const void* p) { return TargetType(*static_cast<const Fn*>(p)); }
+            static const Ops s_ops;
+        };
+        /// m_storage里存放回调的指针
+        template<class Fn>
+        struct HeapOps {
+            static Fn* Get(void* p) { return *static_cast<Fn**>(p); }
+            static void Invoke(void* p) { (*Get(p))(); }
+            static void Destroy(void* p) { delete Get(p); }
+            static const std::type_info& Type(const void* p) { return TargetType(**static_cast<Fn* const*>(p)); }
+            static const Ops s_ops;
+        };
+
+        template<class Fn, class F>
+        void setCallbackImpl(F&& f, std::true_type) {
+            new (m_storage) Fn(std::forward<F>(f));
+            m_ops = &InlineOps<Fn>::s_ops;
+        }
+        template<class Fn, class F>
+        void setCallbackImpl(F&& f, std::false_type) {
+            *reinterpret_cast<Fn**>(m_storage) = new Fn(std::forward<F>(f));
+            m_ops = &HeapOps<Fn>::s_ops;
+        }
+
+        void clearCallback() {
+            if(m_ops) {
+                m_ops->destroy(m_storage);
+                m_ops = nullptr;
+            }
+        }
+    private:
+        const Ops* m_ops = nullptr;
+        alignas(std::max_align_t) unsigned char m_storage[INLINE_SIZE];
+    };
+
+    template<class Fn>
+    const Task::Ops Task::InlineOps<Fn>::s_ops = {
+        &Task::InlineOps<Fn>::Invoke, &Task::InlineOps<Fn>::Destroy, &Task::InlineOps<Fn>::Type
+    };
+    template<class Fn>
+    const Task::Ops Task::HeapOps<Fn>::s_ops = {
+        &Task::HeapOps<Fn>::Invoke, &Task::HeapOps<Fn>::Destroy, &Task::HeapOps<Fn>::Type
+    };
+
+    /**
+     * @brief 侵入式单链表队列，不加锁，由使用方保护
+     */
+    class TaskList {
+    public:
+        bool empty() const { return m_head == nullptr; }
+        size_t size() const { return m_size; }
+        Task* front() const { return m_head; }
+
+        void push_back(Task* task) {
+            task->next = nullptr;
+            if(m_tail) {
+                m_tail->next = task;
+            } else {
+                m_head = task;
+            }
+            m_tail = task;
+            ++m_size;
+        }
+        Task* pop_front() {
+            Task* task = m_head;
+            if(task) {
+                erase(nullptr, task);
+            }
+            return task;
+        }
+        /**
+         * @brief 摘除prev之后的task，prev为nullptr表示task是头节点
+         */
+        void erase(Task* prev, Task* task) {
+            if(prev) {
+                prev->next = task->next;
+            } else {
+                m_head = task->next;
+            }
+            if(m_tail == task) {
+                m_tail = prev;
+            }
+            task->next = nullptr;
+            --m_size;
+        }
+    private:
+        Task* m_head = nullptr;
+        Task* m_tail = nullptr;
+        size_t m_size = 0;
+    };
+}
+
+#endif
@@ -0,0 +1,176 @@
+/**
+ * @file task_group.h
+ * @brief WaitGroup和结构化的任务组
+ * @details 等待方在协程里时挂起协程，不占用线程；在普通线程里时阻塞线程
+ */
+#ifndef __SYLAR_TASK_GROUP_H_
+#define __SYLAR_TASK_GROUP_H_
+
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "future.h"
+#include "noncopyable.h"
+#include "scheduler.h"
+
+namespace sylar{
+    /**
+     * @brief 等待一组子任务结束的计数器
+     * @details 计数归零时唤醒所有等待者，之后可以重新add开始下一轮
+     */
+    class WaitGroup : public NonCopyAble {
+    public:
+        typedef Mutex MutexType;
+
+        ~WaitGroup();
+        /**
+         * @brief 计数加n，n可以为负
+         */
+        void add(int64_t n = 1);
+        /**
+         * @brief 计数减一
+         */
+        void done() { add(-1); }
+        /**
+         * @brief 等待计数归零
+         * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示一直等待，超时依赖IOManager
+         * @return 归零返回true，超时返回false
+         */
+        bool wait(uint64_t timeout_ms = ~0ull);
+        /**
+         * @brief 当前计数
+         */
+        int64_t count();
+    private:
+        MutexType m_mutex;
+        int64_t m_count = 0;
+        /// 当前这一轮的完成状态，计数为0时为空
+        FutureState<void>::ptr m_state;
+    };
+
+    /**
+     * @brief 任务组里有子任务抛出异常
+     */
+    class TaskGroupError : public std::runtime_error {
+    public:
+        TaskGroupError(const std::vector<std::exception_ptr>& errors);
+        /**
+         * @brief 所有子任务抛出的异常，按发生顺序
+         */
+        const std::vector<std::exception_ptr>& errors() const { return m_errors; }
+    private:
+        std::vector<std::exception_ptr> m_errors;
+    };
+
+    /**
+     * @brief 结构化的任务组
+     * @details spawn的子任务以协程在调度器上执行，析构时等待所有子任务结束。
+     *          取消后还没有开始的子任务不再执行，执行中的子任务通过TaskGroup::Cancelled()自行检查；
+     *          在子任务里创建的任务组是它的子组，父组取消时子组也视为取消
+     */
+    class TaskGroup : public NonCopyAble {
+    public:
+        typedef Mutex MutexType;
+
+        /**
+         * @brief 构造函数
+         * @param[in] scheduler 执行子任务的调度器，默认当前调度器
+         * @param[in] cancel_on_error 有子任务抛出异常时是否取消整个组
+         */
+        TaskGroup(Scheduler* scheduler = nullptr, bool cancel_on_error = true);
+        /**
+         * @brief 析构函数，等待所有子任务结束，不抛出子任务的异常
+         */
+        ~TaskGroup();
+
+        /**
+         * @brief 启动一个子任务
+         * @param[in] f 无参可调用对象，转发构造到调度任务里
+         */
+        template<class F>
+        void spawn(F&& f) {
+            m_wait.add(1);
+            m_scheduler->schedule(Child<typename std::decay<F>::type>(this, std::forward<F>(f)));
+        }
+        /**
+         * @brief 等待所有子任务结束
+         * @return 超时返回false
+         */
+        bool wait(uint64_t timeout_ms = ~0ull);
+        /**
+         * @brief 等待所有子任务结束，有子任务抛出异常时抛出TaskGroupError
+         */
+        void join();
+        /**
+         * @brief 取消任务组
+         */
+        void cancel() { m_cancelled = true; }
+        /**
+         * @brief 任务组或者它的父组是否被取消
+         */
+        bool isCancelled() const;
+        /**
+         * @brief 子任务抛出的异常
+         */
+        std::vector<std::exception_ptr> errors();
+
+        /**
+         * @brief 当前协程所在的任务组，不在子任务里时返回nullptr
+         */
+        static TaskGroup* Current();
+        /**
+         * @brief 当前协程所在的任务组是否被取消，长时间运行的子任务应该定期检查
+         */
+        static bool Cancelled();
+    private:
+        /**
+         * @brief 子任务：检查取消、设置当前任务组、收集异常、计数减一
+         */
+        template<class Fn>
+        struct Child {
+            template<class F>
+            Child(TaskGroup* g, F&& f)
+                :group(g)
+                ,fn(std::forward<F>(f)) {
+            }
+            void operator()() {
+                TaskGroup* prev = nullptr;
+                if(group->enter(prev)) {
+                    try {
+                        fn();
+                    } catch (...) {
+                        group->onError(std::current_exception());
+                    }
+                    group->leave(prev);
+                }
+                group->m_wait.done();
+            }
+            TaskGroup* group;
+            Fn fn;
+        };
+
+        /**
+         * @brief 子任务开始，把当前任务组设为自己
+         * @param[out] prev 当前协程原来的任务组
+         * @return 组已取消时返回false
+         */
+        bool enter(TaskGroup*& prev);
+        /**
+         * @brief 子任务结束，恢复当前协程原来的任务组
+         */
+        void leave(TaskGroup* prev);
+        void onError(std::exception_ptr ex);
+    private:
+        Scheduler* m_scheduler;
+        TaskGroup* m_parent;
+        bool m_cancelOnError;
+        std::atomic<bool> m_cancelled = {false};
+        WaitGroup m_wait;
+        MutexType m_mutex;
+        std::vector<std::exception_ptr> m_errors;
+    };
+}
+
+#endif
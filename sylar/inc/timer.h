@@ -5,6 +5,7 @@
 #include <time.h>
 #include <vector>
 #include <set>
+#include "fiber.h"
 #include "thread.h"
 
 namespace sylar{
@@ -43,8 +44,10 @@ namespace sylar{
          * @param[in] cb 回调函数
          * @param[in] recurring 是否循环
          * @param[in] manager 定时器管理器
+         * @param[in] priority 回调的调度优先级
         */
-        Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager);
+        Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager
+                , Fiber::Priority priority = Fiber::PRIORITY_NORMAL);
     
         /**
          * @brief 构造函数
@@ -61,6 +64,8 @@ namespace sylar{
         std::function<void()> m_cb;
         /// 是否循环定时器
         bool m_recurring = false;
+        /// 回调的调度优先级
+        Fiber::Priority m_priority = Fiber::PRIORITY_NORMAL;
         /// 定时器管理器
         TimerManager *m_manager = nullptr;
     
@@ -95,10 +100,13 @@ namespace sylar{
 
         /**
          * @brief 添加定时器
+         * @param[in] priority 到期时回调按这个优先级调度
         */
-        Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
+        Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false
+                            , Fiber::Priority priority = Fiber::PRIORITY_NORMAL);
 
-        Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring);
+        Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring
+                            , Fiber::Priority priority = Fiber::PRIORITY_NORMAL);
 
         /**
          * @brief 到最近一个定时器执行的时间间隔(毫秒)
@@ -110,6 +118,10 @@ namespace sylar{
          * @param[out] cbs 回调函数数组
          */
         void listExpiredCb(std::vector<std::function<void()> >& cbs);
+        /**
+         * @brief 获取需要执行的定时器的回调函数列表，以及每个回调的调度优先级
+         */
+        void listExpiredCb(std::vector<std::function<void()> >& cbs, std::vector<Fiber::Priority>& priorities);
 
         /**
          * @brief 是否有定时器
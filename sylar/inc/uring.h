@@ -0,0 +1,93 @@
+/**
+ * @file uring.h
+ * @brief io_uring环形队列的封装
+ * @details 不依赖liburing，直接通过系统调用创建并映射提交/完成队列
+ */
+#ifndef __SYLAR_URING_H_
+#define __SYLAR_URING_H_
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "noncopyable.h"
+
+namespace sylar{
+
+    /**
+     * @brief io_uring环形队列
+     * @details 提交队列的getSqe/publish需要调用方串行化，完成队列的reap只能有一个线程调用；
+     *          enter可以被多个线程同时调用，内核会串行处理提交
+     */
+    class IoUring : public NonCopyAble {
+    public:
+        IoUring() {}
+        ~IoUring();
+
+        /**
+         * @brief 创建环形队列
+         * @param[in] entries 提交队列长度
+         * @return 内核不支持io_uring或者不支持带超时的等待(5.11以下)时返回false
+         */
+        bool init(uint32_t entries);
+
+        /**
+         * @brief 取一个清零的提交项，提交队列满时返回nullptr
+         */
+        io_uring_sqe* getSqe();
+
+        /**
+         * @brief 让getSqe取到的提交项对内核可见，之后的enter会提交它们
+         */
+        void publish();
+
+        /**
+         * @brief 提交请求并等待完成事件
+         * @param[in] to_submit 提交的请求数，不能超过已发布、还没有被提交的数量
+         * @param[in] min_complete 等待的完成事件数，0表示不等待
+         * @param[in] timeout_ms 等待超时时间，~0ull表示一直等待
+         * @return 提交的请求数，失败返回-1并设置errno
+         */
+        int enter(uint32_t to_submit, uint32_t min_complete, uint64_t timeout_ms = ~0ull);
+
+        /**
+         * @brief 取出所有完成事件
+         * @param[in] cb 对每个完成事件调用cb(const io_uring_cqe&)
+         * @return 完成事件数
+         */
+        template<class F>
+        uint32_t reap(F cb) {
+            uint32_t head = *m_cqHead;
+            uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+            uint32_t n = tail - head;
+            for(; head != tail; ++head) {
+                cb(m_cqes[head & m_cqMask]);
+            }
+            __atomic_store_n(m_cqHead, tail, __ATOMIC_RELEASE);
+            return n;
+        }
+
+        int getFd() const { return m_fd; }
+    private:
+        int m_fd = -1;
+        /// 提交/完成队列的共享映射
+        void* m_ring = nullptr;
+        size_t m_ringSize = 0;
+        /// 提交项数组的映射
+        io_uring_sqe* m_sqes = nullptr;
+        size_t m_sqesSize = 0;
+
+        uint32_t* m_sqHead = nullptr;
+        uint32_t* m_sqTail = nullptr;
+        uint32_t m_sqMask = 0;
+        uint32_t m_sqEntries = 0;
+        /// 已经取出但还没有发布的提交项的尾部
+        uint32_t m_sqLocalTail = 0;
+
+        uint32_t* m_cqHead = nullptr;
+        uint32_t* m_cqTail = nullptr;
+        uint32_t m_cqMask = 0;
+        io_uring_cqe* m_cqes = nullptr;
+    };
+}
+
+#endif
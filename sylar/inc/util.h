@@ -46,6 +46,8 @@ namespace sylar{
 
     //获取 ms
     uint64_t GetCurrentMS();
+    //获取单调时钟 us，用于统计耗时，不受系统时间调整影响
+    uint64_t GetMonotonicUS();
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,150 @@
+/**
+ * @file work_steal_queue.h
+ * @brief 无锁工作窃取双端队列(Chase-Lev)
+ * @details 只有所属线程可以push/pop(LIFO，缓存友好)，其他线程通过steal从另一端(FIFO)取走元素。
+ *          数组写满时扩容为两倍，旧数组保留到队列析构，保证并发的steal读到的内存有效
+ */
+#ifndef __SYLAR_WORK_STEAL_QUEUE_H_
+#define __SYLAR_WORK_STEAL_QUEUE_H_
+
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+
+namespace sylar{
+    template<class T>
+    class WorkStealQueue {
+    public:
+        /**
+         * @brief 构造函数
+         * @param[in] capacity 初始容量，必须是2的幂
+         */
+        WorkStealQueue(int64_t capacity = 256)
+            :m_top(0)
+            ,m_bottom(0)
+            ,m_array(new Array(capacity)) {
+        }
+        ~WorkStealQueue() {
+            for(auto i : m_garbage) {
+                delete i;
+            }
+            delete m_array.load(std::memory_order_relaxed);
+        }
+        WorkStealQueue(const WorkStealQueue&) = delete;
+        WorkStealQueue& operator=(const WorkStealQueue&) = delete;
+
+        /**
+         * @brief 是否为空(近似值)
+         */
+        bool empty() const {
+            return size() == 0;
+        }
+        /**
+         * @brief 元素数量(近似值)
+         */
+        size_t size() const {
+            int64_t b = m_bottom.load(std::memory_order_relaxed);
+            int64_t t = m_top.load(std::memory_order_relaxed);
+            return b > t ? b - t : 0;
+        }
+
+        /**
+         * @brief 所属线程压入元素
+         */
+        void push(T* v) {
+            int64_t b = m_bottom.load(std::memory_order_relaxed);
+            int64_t t = m_top.load(std::memory_order_acquire);
+            Array* a = m_array.load(std::memory_order_relaxed);
+            if(b - t > a->capacity - 1) {
+                a = grow(a, b, t);
+            }
+            a->put(b, v);
+            std::atomic_thread_fence(std::memory_order_release);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief 所属线程取出最后压入的元素，为空返回nullptr
+         */
+        T* pop() {
+            int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+            Array* a = m_array.load(std::memory_order_relaxed);
+            m_bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t t = m_top.load(std::memory_order_relaxed);
+            if(t > b) {
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            T* v = a->get(b);
+            if(t == b) {
+                //只剩最后一个元素，和steal竞争
+                if(!m_top.compare_exchange_strong(t, t + 1
+                            , std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                    v = nullptr;
+                }
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return v;
+        }
+
+        /**
+         * @brief 其他线程窃取最早压入的元素，为空或竞争失败返回nullptr
+         */
+        T* steal() {
+            int64_t t = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = m_bottom.load(std::memory_order_acquire);
+            if(t >= b) {
+                return nullptr;
+            }
+            Array* a = m_array.load(std::memory_order_acquire);
+            T* v = a->get(t);
+            if(!m_top.compare_exchange_strong(t, t + 1
+                        , std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                return nullptr;
+            }
+            return v;
+        }
+    private:
+        struct Array {
+            Array(int64_t c)
+                :capacity(c)
+                ,mask(c - 1)
+                ,buffer(new std::atomic<T*>[c]) {
+            }
+            ~Array() {
+                delete[] buffer;
+            }
+            void put(int64_t i, T* v) {
+                buffer[i & mask].store(v, std::memory_order_relaxed);
+            }
+            T* get(int64_t i) {
+                return buffer[i & mask].load(std::memory_order_relaxed);
+            }
+            int64_t capacity;
+            int64_t mask;
+            std::atomic<T*>* buffer;
+        };
+
+        Array* grow(Array* a, int64_t b, int64_t t) {
+            Array* na = new Array(a->capacity * 2);
+            for(int64_t i = t; i != b; ++i) {
+                na->put(i, a->get(i));
+            }
+            m_garbage.push_back(a);
+            m_array.store(na, std::memory_order_release);
+            return na;
+        }
+    private:
+        /// 窃取端，和m_bottom分开在不同的缓存行
+        std::atomic<int64_t> m_top;
+        char m_pad[64 - sizeof(std::atomic<int64_t>)];
+        std::atomic<int64_t> m_bottom;
+        std::atomic<Array*> m_array;
+        /// 扩容后的旧数组，只有所属线程访问
+        std::vector<Array*> m_garbage;
+    };
+}
+
+#endif
@@ -0,0 +1,149 @@
+#include "../inc/context.h"
+#include "../inc/macro.h"
+#include <stdint.h>
+
+#ifndef SYLAR_FIBER_UCONTEXT
+
+#if defined(__x86_64__)
+/**
+ * 栈布局（从低地址到高地址）：
+ *   mxcsr/x87控制字 | r12 | r13 | r14 | r15 | rbx | rbp | 返回地址
+ */
+asm(R"(
+    .text
+    .globl sylar_swap_context
+    .type sylar_swap_context, @function
+    .align 16
+sylar_swap_context:
+    pushq %rbp
+    pushq %rbx
+    pushq %r15
+    pushq %r14
+    pushq %r13
+    pushq %r12
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r12
+    popq %r13
+    popq %r14
+    popq %r15
+    popq %rbx
+    popq %rbp
+    ret
+    .size sylar_swap_context, .-sylar_swap_context
+)");
+#elif defined(__aarch64__)
+/**
+ * 栈布局（从低地址到高地址）：
+ *   d8-d15 | x19-x28 | x29(fp) | x30(lr)
+ */
+asm(R"(
+    .text
+    .globl sylar_swap_context
+    .type sylar_swap_context, %function
+    .align 4
+sylar_swap_context:
+    sub sp, sp, #176
+    stp d8, d9, [sp, #0]
+    stp d10, d11, [sp, #16]
+    stp d12, d13, [sp, #32]
+    stp d14, d15, [sp, #48]
+    stp x19, x20, [sp, #64]
+    stp x21, x22, [sp, #80]
+    stp x23, x24, [sp, #96]
+    stp x25, x26, [sp, #112]
+    stp x27, x28, [sp, #128]
+    stp x29, x30, [sp, #144]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp d8, d9, [sp, #0]
+    ldp d10, d11, [sp, #16]
+    ldp d12, d13, [sp, #32]
+    ldp d14, d15, [sp, #48]
+    ldp x19, x20, [sp, #64]
+    ldp x21, x22, [sp, #80]
+    ldp x23, x24, [sp, #96]
+    ldp x25, x26, [sp, #112]
+    ldp x27, x28, [sp, #128]
+    ldp x29, x30, [sp, #144]
+    add sp, sp, #176
+    ret
+    .size sylar_swap_context, .-sylar_swap_context
+)");
+#endif
+
+#endif
+
+namespace sylar{
+#ifdef SYLAR_FIBER_UCONTEXT
+    void InitContext(Context& ctx)
+    {
+        if(getcontext(&ctx)) {
+            SYLAR_ASSERT2(false, "getcontext");
+        }
+    }
+
+    void MakeContext(Context& ctx, void* stack, size_t size, void (*fn)())
+    {
+        if(getcontext(&ctx)) {
+            SYLAR_ASSERT2(false, "getcontext");
+        }
+        ctx.uc_link = nullptr;
+        ctx.uc_stack.ss_size = size;
+        ctx.uc_stack.ss_sp = stack;
+        makecontext(&ctx, fn, 0);
+    }
+
+    const char* ContextBackend()
+    {
+        return "ucontext";
+    }
+#else
+    void InitContext(Context& ctx)
+    {
+        //主协程的栈顶在第一次切出时保存
+        ctx = nullptr;
+    }
+
+    void MakeContext(Context& ctx, void* stack, size_t size, void (*fn)())
+    {
+        uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+#if defined(__x86_64__)
+        uint64_t* sp = (uint64_t*)top;
+        *--sp = 0;                  //fn的返回地址，fn不会返回
+        *--sp = (uint64_t)fn;       //ret跳转的地址
+        for(int i = 0; i < 6; ++i) {
+            *--sp = 0;              //rbp rbx r15 r14 r13 r12
+        }
+        --sp;
+        uint32_t* fpu = (uint32_t*)sp;
+        fpu[0] = 0x1F80;            //mxcsr默认值
+        fpu[1] = 0x037F;            //x87控制字默认值
+        ctx = sp;
+#elif defined(__aarch64__)
+        uint64_t* sp = (uint64_t*)(top - 176);
+        for(int i = 0; i < 22; ++i) {
+            sp[i] = 0;
+        }
+        sp[19] = (uint64_t)fn;      //x30，ret跳转的地址
+        ctx = sp;
+#endif
+    }
+
+    const char* ContextBackend()
+    {
+#if defined(__x86_64__)
+        return "asm-x86_64";
+#else
+        return "asm-aarch64";
+#endif
+    }
+#endif
+}
@@ -1,5 +1,7 @@
+#include "../inc/sylar.h"
 #include "../inc/hook.h"
 #include "../inc/fd_manager.h"
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -12,26 +14,37 @@ namespace sylar{
         ,m_isSocket(false)
         ,m_sysNonblock(false)
         ,m_userNonblock(false)
-        ,m_isClosed(false)
-        ,m_fd(fd)
+        ,m_isClosed(true)
         ,m_recvTimeout(-1)
         ,m_sendTimeout(-1) 
     {
-        init();
+        this->fd = fd;
     }
 
     FdCtx::~FdCtx(){}
+
+    void* FdCtx::operator new(size_t size)
+    {
+        void* ptr = nullptr;
+        if(posix_memalign(&ptr, alignof(FdCtx), size)) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    void FdCtx::operator delete(void* ptr)
+    {
+        free(ptr);
+    }
     
     bool FdCtx::init()
     {
-        if(isInit())
-            return true;
         // 先重置
         m_sendTimeout = -1;
         m_recvTimeout = -1;
         // 先看一下fd的信息，查看失败，证明fd有问题，初始化失败，否则继续
         struct stat fd_stat;
-        if(fstat(m_fd,&fd_stat) == -1){
+        if(fstat(fd,&fd_stat) == -1){
             m_isInit = false;
             m_isSocket = false;
         }
@@ -40,10 +53,10 @@ namespace sylar{
             m_isSocket = S_ISSOCK(fd_stat.st_mode);
         }
         if(m_isSocket){ // 如果是socket文件，则设置非阻塞
-            int flags = fcntl_f(m_fd, F_GETFL, 0);
+            int flags = fcntl_f(fd, F_GETFL, 0);
             if(!(flags & O_NONBLOCK))
             {
-                fcntl_f(m_fd, F_SETFL, flags | O_NONBLOCK);
+                fcntl_f(fd, F_SETFL, flags | O_NONBLOCK);
             }
             m_sysNonblock = true;
         }
@@ -52,10 +65,23 @@ namespace sylar{
         }
 
         m_userNonblock = false;
-        m_isClosed = false;
+        //fd号复用：旧fd关闭时没有经过hook的close，注册状态还是旧fd的
+        resetRegistration();
+        //属性写完之后才对不加锁的get可见
+        m_isClosed.store(false, std::memory_order_release);
         return m_isInit;
     }
 
+    void FdCtx::resetRegistration()
+    {
+        registered = 0;
+        ready = 0;
+        if(!events && !ringOps) {
+            efd = -1;
+            iom = nullptr;
+        }
+    }
+
     void FdCtx::setTimeOut(int type,uint64_t time)
     {
         if(type == SO_RCVTIMEO){
@@ -79,46 +105,74 @@ namespace sylar{
         return 0;
     }
 
-        FdManager::FdManager()
+    FdCtx::EventContext& FdCtx::getContext(int event)
+    {
+        switch(event) {
+        case IOManager::READ:
+            return read;
+        case IOManager::WRITE:
+            return write;
+        default:
+            SYLAR_ASSERT2(false, "getContext");
+        }
+        throw std::invalid_argument("getContext invalid event");
+    }
+
+    void FdCtx::resetContext(EventContext& ctx) {
+        ctx.scd = nullptr;
+        ctx.fiber.reset();
+        ctx.cb = nullptr;
+        ctx.priority = Fiber::PRIORITY_NORMAL;
+    }
+
+    void FdCtx::triggerEvent(int event)
     {
-        m_datas.resize(64);
+        SYLAR_ASSERT(events & event);
+        events = events & ~event;
+        //取引用，调度时把fiber/cb的所有权转移给调度队列，不产生额外的引用计数
+        EventContext& ctx = getContext(event);
+        if(ctx.cb) {
+            ctx.scd->schedule(&ctx.cb, -1, ctx.priority);
+        } else {
+            ctx.scd->schedule(&ctx.fiber);
+        }
+        ctx.scd = nullptr;
+        return;
     }
 
-    FdCtx::ptr FdManager::get(int fd,bool auto_create)
+    FdManager::FdManager()
+    {
+    }
+
+    FdCtx* FdManager::get(int fd,bool auto_create)
     {
         if(fd == -1)
             return nullptr;
-        RWMutexType::ReadLock lock(m_mutex);
-        if((int)m_datas.size() <= fd)
-        {
-            if(auto_create == false){
-                return nullptr;
-            }
+        // 无锁读取：有该文件，或者没有且不自动创建时
+        FdCtx* ctx = auto_create ? m_datas.getOrCreate(fd) : m_datas.get(fd);
+        if(!ctx || !ctx->isClose()) {
+            return ctx;
         }
-        else{
-            // 有该文件或者不自动创建时
-            if(m_datas[fd] || !auto_create) {
-                return m_datas[fd];
-            }
+        if(!auto_create) {
+            return nullptr;
         }
-        lock.unlock();
-        // 没有且自动创建时
-        RWMutexType::WriteLock lock2(m_mutex);
-        FdCtx::ptr ctx(new FdCtx(fd));
-        if(fd >= (int)m_datas.size()) {
-            m_datas.resize(fd * 1.5);
+        // 没有(或者已经删除，fd号被复用)且自动创建时，在记录的锁里初始化
+        FdCtx::MutexType::Lock lock(ctx->mutex);
+        if(ctx->isClose()) {
+            ctx->init();
         }
-        m_datas[fd] = ctx;
         return ctx;
     }
 
     
     void FdManager::del(int fd) {
-        RWMutexType::WriteLock lock(m_mutex);
-        if((int)m_datas.size() <= fd) {
+        FdCtx* ctx = m_datas.get(fd);
+        if(!ctx) {
             return;
         }
-        m_datas[fd].reset();
+        FdCtx::MutexType::Lock lock(ctx->mutex);
+        ctx->resetRegistration();
+        ctx->close();
     }
 
 }
\ No newline at end of file
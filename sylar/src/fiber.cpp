@@ -4,6 +4,12 @@
 #include "../inc/macro.h"
 #include "../inc/scheduler.h"
 #include <atomic>
+#include <map>
+#include <sstream>
+#include <typeindex>
+#include <cxxabi.h>
+#include <unordered_map>
+#include <sys/mman.h>
 
 namespace sylar {
     static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
@@ -18,27 +24,245 @@ namespace sylar {
     static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
         Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
 
-    class MallocStackAllocator {
+    static ConfigVar<uint32_t>::ptr g_fiber_stack_pool_size =
+        Config::Lookup<uint32_t>("fiber.stack_pool_size", 64, "fiber stack cache size per thread");
+
+    static uint32_t s_fiber_stack_pool_size = 64;
+    /// 默认栈大小，构造协程时读取，不经过配置项的读写锁
+    static std::atomic<uint32_t> s_fiber_stack_size{128 * 1024};
+
+    struct _StackPoolIniter {
+        _StackPoolIniter() {
+            s_fiber_stack_size.store(g_fiber_stack_size->getValue(), std::memory_order_relaxed);
+            g_fiber_stack_size->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+                s_fiber_stack_size.store(new_value, std::memory_order_relaxed);
+            });
+            s_fiber_stack_pool_size = g_fiber_stack_pool_size->getValue();
+            g_fiber_stack_pool_size->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+                s_fiber_stack_pool_size = new_value;
+            });
+        }
+    };
+    static _StackPoolIniter s_stack_pool_initer;
+
+    /**
+     * @brief 线程本地的协程栈缓存
+     * @details 按栈大小分组保存已释放的栈，线程退出时统一munmap
+     */
+    struct StackCache {
+        ~StackCache();
+        std::map<size_t, std::vector<void*> > free_stacks;
+    };
+    static thread_local StackCache t_stack_cache;
+    //线程退出时t_stack_cache可能先于协程析构，此后释放的栈直接munmap
+    static thread_local bool t_stack_cache_dead = false;
+
+    /**
+     * @brief 基于mmap的协程栈分配器
+     * @details 每个栈的最低地址处有一个PROT_NONE保护页，栈溢出直接触发SIGSEGV，而不是悄悄破坏堆；
+     *          释放时用MADV_DONTNEED归还物理页，再放入线程本地空闲链表，下次分配只需弹出一个指针
+     */
+    class MmapStackAllocator {
     public:
+        static size_t PageSize() {
+            static size_t s_page_size = sysconf(_SC_PAGESIZE);
+            return s_page_size;
+        }
+        static size_t RoundUp(size_t size) {
+            size_t page = PageSize();
+            return (size + page - 1) / page * page;
+        }
         static void* Alloc(size_t size) {
-            return malloc(size);
+            size = RoundUp(size);
+            if(!t_stack_cache_dead) {
+                auto it = t_stack_cache.free_stacks.find(size);
+                if(it != t_stack_cache.free_stacks.end() && !it->second.empty()) {
+                    void* vp = it->second.back();
+                    it->second.pop_back();
+                    return vp;
+                }
+            }
+            size_t page = PageSize();
+            void* base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE
+                            , MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if(base == MAP_FAILED) {
+                SYLAR_LOG_ERROR(g_logger) << "mmap fiber stack size=" << size
+                    << " errno=" << errno << " " << strerror(errno);
+                throw std::bad_alloc();
+            }
+            //栈向低地址增长，保护页放在最低处
+            if(mprotect(base, page, PROT_NONE)) {
+                SYLAR_LOG_ERROR(g_logger) << "mprotect guard page errno=" << errno
+                    << " " << strerror(errno);
+            }
+            return (char*)base + page;
         }
-        static void Dealloc(void *vp, size_t size)
-        {
-            return free(vp);
+        static void Dealloc(void *vp, size_t size) {
+            size = RoundUp(size);
+            if(!t_stack_cache_dead) {
+                std::vector<void*>& stacks = t_stack_cache.free_stacks[size];
+                if(stacks.size() < s_fiber_stack_pool_size) {
+                    madvise(vp, size, MADV_DONTNEED);
+                    stacks.push_back(vp);
+                    return;
+                }
+            }
+            Unmap(vp, size);
+        }
+        static void Unmap(void* vp, size_t size) {
+            size_t page = PageSize();
+            munmap((char*)vp - page, size + page);
+        }
+    };
+
+    StackCache::~StackCache() {
+        t_stack_cache_dead = true;
+        for(auto& i : free_stacks) {
+            for(auto& vp : i.second) {
+                MmapStackAllocator::Unmap(vp, i.first);
+            }
+        }
+    }
+
+    using StackAllocator = MmapStackAllocator;
+
+    static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+        Config::Lookup<uint32_t>("fiber.shared_stack_size", 1024 * 1024, "fiber shared stack size");
+
+    static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_count =
+        Config::Lookup<uint32_t>("fiber.shared_stack_count", 4, "fiber shared stack count per thread");
+
+    /**
+     * @brief 线程的共享栈
+     */
+    struct SharedStack {
+        /// 栈的最低地址
+        void *stack = nullptr;
+        /// 栈大小
+        size_t size = 0;
+        /// 当前栈上是谁的现场
+        Fiber *occupant = nullptr;
+    };
+
+    /**
+     * @brief 线程本地的共享栈组，首次使用时分配
+     */
+    struct SharedStackGroup {
+        ~SharedStackGroup() {
+            for(auto& i : stacks) {
+                StackAllocator::Dealloc(i.stack, i.size);
+            }
+        }
+        SharedStack* get(uint64_t id) {
+            if(stacks.empty()) {
+                size_t count = std::max(g_fiber_shared_stack_count->getValue(), 1u);
+                size_t size = g_fiber_shared_stack_size->getValue();
+                stacks.resize(count);
+                for(auto& i : stacks) {
+                    i.size = MmapStackAllocator::RoundUp(size);
+                    i.stack = StackAllocator::Alloc(i.size);
+                }
+            }
+            return &stacks[id % stacks.size()];
+        }
+        std::vector<SharedStack> stacks;
+    };
+    static thread_local SharedStackGroup t_shared_stacks;
+    //本线程上运行中的共享栈协程数量
+    static thread_local size_t t_shared_bound = 0;
+
+    static ConfigVar<uint32_t>::ptr g_fiber_pool_size =
+        Config::Lookup<uint32_t>("fiber.pool_size", 128, "terminated fiber pool size per thread");
+
+    static uint32_t s_fiber_pool_size = 128;
+    static std::atomic<uint64_t> s_pool_hits{0};
+    static std::atomic<uint64_t> s_pool_misses{0};
+
+    struct _FiberPoolIniter {
+        _FiberPoolIniter() {
+            s_fiber_pool_size = g_fiber_pool_size->getValue();
+            g_fiber_pool_size->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+                s_fiber_pool_size = new_value;
+            });
         }
     };
+    static _FiberPoolIniter s_fiber_pool_initer;
 
-    using StackAllocator = MallocStackAllocator;
+    /// 线程本地的已结束协程池
+    static thread_local std::vector<Fiber::ptr> t_fiber_pool;
+
+    static ConfigVar<bool>::ptr g_fiber_stack_profile =
+        Config::Lookup<bool>("fiber.stack_profile", false, "paint fiber stacks and record peak usage per entry");
+
+    static ConfigVar<std::unordered_map<std::string, uint32_t> >::ptr g_fiber_stack_classes =
+        Config::Lookup("fiber.stack_classes", std::unordered_map<std::string, uint32_t>()
+                , "fiber stack size per entry");
+
+    static bool s_fiber_stack_profile = false;
+
+    /// 栈的金丝雀值
+    static const uint64_t s_stack_canary = 0xA5A5A5A5A5A5A5A5ull;
+    /// 直方图桶数：[0,1K) [1K,2K) [2K,4K) ... [2^(N-2)K, +inf)
+    static const int s_stack_buckets = 16;
+    /// 栈顶不填充的字节数
+    static const size_t s_stack_unpainted = 256;
+
+    /**
+     * @brief 单个入口的栈峰值统计
+     */
+    struct StackUsage {
+        uint64_t count = 0;
+        uint64_t max = 0;
+        uint64_t total = 0;
+        uint32_t stacksize = 0;
+        uint64_t buckets[s_stack_buckets] = {0};
+    };
+
+    static Mutex s_stack_usage_mutex;
+    static std::unordered_map<std::type_index, StackUsage> s_stack_usage;
+
+    /**
+     * @brief 入口到栈大小的映射，按入口类型缓存，避免每次构造都做demangle
+     */
+    struct StackClasses {
+        RWMutex mutex;
+        std::unordered_map<std::string, uint32_t> classes;
+        std::unordered_map<std::type_index, uint32_t> cache;
+    };
+    static StackClasses s_stack_classes;
+    /// 没有配置按入口的栈大小，构造协程时直接用默认大小，不加锁
+    static std::atomic<bool> s_stack_classes_empty{true};
+
+    struct _StackProfileIniter {
+        _StackProfileIniter() {
+            s_fiber_stack_profile = g_fiber_stack_profile->getValue();
+            g_fiber_stack_profile->addListener([](const bool& old_value, const bool& new_value){
+                s_fiber_stack_profile = new_value;
+            });
+            s_stack_classes.classes = g_fiber_stack_classes->getValue();
+            s_stack_classes_empty.store(s_stack_classes.classes.empty(), std::memory_order_release);
+            g_fiber_stack_classes->addListener([](const std::unordered_map<std::string, uint32_t>& old_value
+                                                ,const std::unordered_map<std::string, uint32_t>& new_value){
+                RWMutex::WriteLock lock(s_stack_classes.mutex);
+                s_stack_classes.classes = new_value;
+                s_stack_classes.cache.clear();
+                s_stack_classes_empty.store(new_value.empty(), std::memory_order_release);
+            });
+        }
+    };
+    static _StackProfileIniter s_stack_profile_initer;
+
+    /// 已分配的协程局部变量槽位数
+    static std::atomic<size_t> s_local_slots{0};
+    /// 各槽位的析构函数
+    static Fiber::LocalDestructor s_local_dtors[Fiber::LOCAL_SLOTS] = {nullptr};
 
 
     Fiber::Fiber()
     {
-        m_state = EXEC;
+        m_state.store(EXEC, std::memory_order_release);
         SetThis(this);
-        if(getcontext(&m_ctx)){
-            SYLAR_ASSERT2(false, "getcontext");
-        }
+        InitContext(m_ctx);
         ++s_fiber_count;
         SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber main";
     }
@@ -48,25 +272,37 @@ namespace sylar {
      * @param[in] stacksize 协程栈大小
      * @param[in] use_caller 是否在MainFiber上调度
     */
-    Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
+    Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller, bool shared_stack)
     : m_id(++s_fiber_id),
-      m_cb(cb)
+      m_cb(cb),
+      m_entry(&cb.target_type())
     {
         ++s_fiber_count;
-        m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
+#ifdef SYLAR_FIBER_UCONTEXT
+        //ucontext无法拿到切出时准确的栈顶，共享栈模式依赖汇编实现
+        if(shared_stack) {
+            SYLAR_LOG_WARN(g_logger) << "shared stack needs asm context, fallback to private stack";
+            shared_stack = false;
+        }
+#endif
+        if(shared_stack) {
+            //共享栈在第一次切入时才确定，上下文也在那时创建
+            SYLAR_ASSERT(!use_caller);
+            m_shared = true;
+            SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber shared id = " << m_id;
+            return;
+        }
+        m_stacksize = stacksize ? stacksize : GetStackClass(*m_entry);
 
         m_stack = StackAllocator::Alloc(m_stacksize);
-        if(getcontext(&m_ctx)) {
-            SYLAR_ASSERT2(false, "getcontext");
+        if(s_fiber_stack_profile) {
+            paintStack();
         }
-        m_ctx.uc_link = nullptr;
-        m_ctx.uc_stack.ss_size = m_stacksize;
-        m_ctx.uc_stack.ss_sp = m_stack;
         if(!use_caller){
-            makecontext(&m_ctx, &Fiber::MainFunc, 0);
+            MakeContext(m_ctx, m_stack, m_stacksize, &Fiber::MainFunc);
         }
         else{
-            makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+            MakeContext(m_ctx, m_stack, m_stacksize, &Fiber::CallerMainFunc);
         }
         SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber id = " << m_id;
     }
@@ -77,18 +313,22 @@ namespace sylar {
     Fiber::~Fiber()
     {
         --s_fiber_count;
-        if(m_stack){
+        destroyLocals();
+        if(m_stack || m_shared){
             //子协程析构流程
             //只有处于终止、异常、初始化三种状态的协程可以被析构
-            SYLAR_ASSERT(m_state == TERM ||
-                         m_state == EXCEPT ||
-                         m_state == INIT);
-            StackAllocator::Dealloc(m_stack, m_stacksize);
+            SYLAR_ASSERT(getState() == TERM ||
+                         getState() == EXCEPT ||
+                         getState() == INIT);
+            if(m_stack) {
+                StackAllocator::Dealloc(m_stack, m_stacksize);
+            }
+            free(m_saveBuffer);
         }
         else{
             //主协程的析构流程，先确认是主协程（没有回调函数，始终处于EXEC状态）
             SYLAR_ASSERT(!m_cb);
-            SYLAR_ASSERT(m_state == EXEC);
+            SYLAR_ASSERT(getState() == EXEC);
 
             Fiber *cur = t_fiber;
             if(cur == this){
@@ -104,21 +344,23 @@ namespace sylar {
      * @pre getState() 为 TERM EXCEPT INIT
      * @post getState() = INIT
     */
-    void Fiber::reset(std::function<void()> cb)
+    void Fiber::reset(std::function<void()> cb, const std::type_info* entry)
     {
-        SYLAR_ASSERT(m_stack); //确定当前协程为子协程
-        SYLAR_ASSERT(m_state == TERM || m_state == INIT || m_state == EXCEPT);
+        SYLAR_ASSERT(m_stack || m_shared); //确定当前协程为子协程
+        SYLAR_ASSERT(getState() == TERM || getState() == INIT || getState() == EXCEPT);
         m_cb = cb;
-        if(getcontext(&m_ctx)){
-            SYLAR_ASSERT2(false, "getcontext");
+        m_entry = entry ? entry : &m_cb.target_type();
+        //复用的协程是新的执行流，不继承上一个回调的亲和性
+        m_affinity = AFFINITY_LAST;
+        m_lastThread = -1;
+        m_priority = PRIORITY_NORMAL;
+        if(!m_shared) {
+            if(s_fiber_stack_profile) {
+                paintStack();
+            }
+            MakeContext(m_ctx, m_stack, m_stacksize, &Fiber::MainFunc);
         }
-
-        m_ctx.uc_link = nullptr;
-        m_ctx.uc_stack.ss_size = m_stacksize;
-        m_ctx.uc_stack.ss_sp = m_stack;
-
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
-        m_state = INIT;
+        m_state.store(INIT, std::memory_order_release);
     }
 
     /**
@@ -129,12 +371,52 @@ namespace sylar {
     void Fiber::swapIn()
     {
         SetThis(this);
-        SYLAR_ASSERT(m_state != EXEC);
-        m_state = EXEC;
-        if(swapcontext(&Scheduler::GetMainFiber()->m_ctx,&m_ctx))
-        {
-            SYLAR_ASSERT2(false, "swapcontext");
+        SYLAR_ASSERT(getState() != EXEC);
+        if(m_shared) {
+            loadSharedStack();
         }
+        m_state.store(EXEC, std::memory_order_release);
+        SwapContext(Scheduler::GetMainFiber()->m_ctx, m_ctx);
+    }
+
+    void Fiber::loadSharedStack()
+    {
+        if(!m_sharedStack) {
+            m_sharedStack = t_shared_stacks.get(m_id);
+            m_bindThread = sylar::GetThreadID();
+        }
+        SYLAR_ASSERT2(m_bindThread == sylar::GetThreadID(), "shared stack fiber_id=" << m_id
+                << " bind_thread=" << m_bindThread << " resumed on thread=" << sylar::GetThreadID());
+        SharedStack *ss = m_sharedStack;
+        if(ss->occupant != this) {
+            if(ss->occupant) {
+                ss->occupant->saveSharedStack();
+            }
+            ss->occupant = this;
+            if(getState() != INIT) {
+                memcpy((char*)ss->stack + ss->size - m_saveSize, m_saveBuffer, m_saveSize);
+            }
+        }
+        if(getState() == INIT) {
+            m_saveSize = 0;
+            MakeContext(m_ctx, ss->stack, ss->size, &Fiber::MainFunc);
+            ++t_shared_bound;
+        }
+    }
+
+    void Fiber::saveSharedStack()
+    {
+#ifndef SYLAR_FIBER_UCONTEXT
+        char *top = (char*)m_sharedStack->stack + m_sharedStack->size;
+        m_saveSize = top - (char*)m_ctx;
+        //保存区按实际用量分配，用量大幅下降时也收缩
+        if(m_saveSize > m_saveCapacity || m_saveSize < m_saveCapacity / 4) {
+            free(m_saveBuffer);
+            m_saveBuffer = (char*)malloc(m_saveSize);
+            m_saveCapacity = m_saveSize;
+        }
+        memcpy(m_saveBuffer, m_ctx, m_saveSize);
+#endif
     }
 
     /**
@@ -143,9 +425,7 @@ namespace sylar {
     void Fiber::swapOut()
     {
         SetThis(Scheduler::GetMainFiber());
-        if(swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        SwapContext(m_ctx, Scheduler::GetMainFiber()->m_ctx);
     }
     /**
      * @brief 执行当前协程
@@ -154,10 +434,8 @@ namespace sylar {
     void Fiber::call()
     {
         SetThis(this);
-        m_state = EXEC;
-        if(swapcontext(&t_threadFiber->m_ctx,&m_ctx)){
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        m_state.store(EXEC, std::memory_order_release);
+        SwapContext(t_threadFiber->m_ctx, m_ctx);
     }
     /**
      * @brief 当前线程切换到后台
@@ -167,9 +445,7 @@ namespace sylar {
     void Fiber::back()
     {
         SetThis(t_threadFiber.get());
-        if(swapcontext(&m_ctx,&t_threadFiber->m_ctx)){
-            SYLAR_ASSERT2(false, "swapcontext");
-        }
+        SwapContext(m_ctx, t_threadFiber->m_ctx);
     }
 
     /**
@@ -185,16 +461,21 @@ namespace sylar {
      * @brief 返回当前所在的协程
     */
     Fiber::ptr Fiber::GetThis()
+    {
+        return Fiber::ptr(GetThisRaw());
+    }
+
+    Fiber* Fiber::GetThisRaw()
     {
         //t_fiber 指向的是当前正在执行的协程，若存在，则返回
-        if(t_fiber){
-            return t_fiber->shared_from_this();
+        if(SYLAR_LIKELY(t_fiber)){
+            return t_fiber;
         }
         //否则，创建主协程
         Fiber::ptr main_fiber(new Fiber);
         SYLAR_ASSERT(t_fiber == main_fiber.get());
         t_threadFiber = main_fiber;
-        return t_fiber->shared_from_this();
+        return t_fiber;
     }
     /**
      * @brief 当前协程切换到后台，并设置为Ready状态
@@ -202,9 +483,10 @@ namespace sylar {
     */
     void Fiber::YieldToReady()
     {
-        Fiber::ptr cur = GetThis();
-        SYLAR_ASSERT(cur->m_state == EXEC);
-        cur->m_state = READY;
+        //切出期间由调度器、定时器或IO事件持有引用，这里不需要再持有
+        Fiber *cur = GetThisRaw();
+        SYLAR_ASSERT(cur->getState() == EXEC);
+        cur->m_state.store(READY, std::memory_order_release);
         cur->swapOut();
     }
     /**
@@ -213,9 +495,11 @@ namespace sylar {
     */
     void Fiber::YieldToHold()
     {
-        Fiber::ptr cur = GetThis();
-        SYLAR_ASSERT(cur->m_state == EXEC);
-        cur->m_state = HOLD;
+        //切出期间由调度器、定时器或IO事件持有引用，这里不需要再持有
+        Fiber *cur = GetThisRaw();
+        SYLAR_ASSERT(cur->getState() == EXEC);
+        //状态保持EXEC直到真正切出，由调度协程置为HOLD；
+        //否则其他线程可能在上下文保存之前就把已经被唤醒的协程切入
         cur->swapOut();
     }
     /**
@@ -231,30 +515,41 @@ namespace sylar {
     */
     void Fiber::MainFunc()
     {
-        Fiber::ptr cur = GetThis(); 
+        //执行期间调度器持有该协程的引用，用裸指针即可
+        Fiber *cur = t_fiber;
         SYLAR_ASSERT(cur);  //确定当前协程非空
         try{
             cur->m_cb();
             cur->m_cb = nullptr;
-            cur->m_state = TERM;
+            cur->m_state.store(TERM, std::memory_order_release);
         } catch(std::exception& ex) {
-            cur->m_state = EXCEPT;
+            cur->m_state.store(EXCEPT, std::memory_order_release);
             SYLAR_LOG_ERROR(g_logger) << "Fiber Except: " << ex.what()
                 << " fiber_id=" << cur->getId()
                 << std::endl
                 << sylar::BacktraceToString();
         } catch (...){
-            cur->m_state = EXCEPT;
+            cur->m_state.store(EXCEPT, std::memory_order_release);
             SYLAR_LOG_ERROR(g_logger) << "Fiber Except"
                 << " fiber_id=" << cur->getId()
                 << std::endl
                 << sylar::BacktraceToString();
         }
-        auto raw_ptr = cur.get();
-        cur.reset();
-        raw_ptr->swapOut();
+        //局部变量的析构函数仍在协程栈上执行，可以访问其他局部变量
+        cur->destroyLocals();
+        if(cur->m_painted) {
+            cur->recordStackUsage();
+        }
+        if(cur->m_sharedStack && cur->m_sharedStack->occupant == cur) {
+            //已经结束，栈内容不需要再保存
+            cur->m_sharedStack->occupant = nullptr;
+        }
+        if(cur->m_shared) {
+            --t_shared_bound;
+        }
+        cur->swapOut();
 
-        SYLAR_ASSERT2(false, "never reach fiber_id=" + std::to_string(raw_ptr->getId()));
+        SYLAR_ASSERT2(false, "never reach fiber_id=" + std::to_string(cur->getId()));
         
     }
     /**
@@ -263,30 +558,33 @@ namespace sylar {
     */
     void Fiber::CallerMainFunc()
     {
-        Fiber::ptr cur = GetThis();
+        Fiber *cur = t_fiber;
         SYLAR_ASSERT(cur);
         try {
             cur->m_cb();
             cur->m_cb = nullptr;
-            cur->m_state = TERM;
+            cur->m_state.store(TERM, std::memory_order_release);
         } catch (std::exception& ex) {
-            cur->m_state = EXCEPT;
+            cur->m_state.store(EXCEPT, std::memory_order_release);
             SYLAR_LOG_ERROR(g_logger) << "Fiber Except: " << ex.what()
                 << " fiber_id=" << cur->getId()
                 << std::endl
                 << sylar::BacktraceToString();
         } catch (...) {
-            cur->m_state = EXCEPT;
+            cur->m_state.store(EXCEPT, std::memory_order_release);
             SYLAR_LOG_ERROR(g_logger) << "Fiber Except"
                 << " fiber_id=" << cur->getId()
                 << std::endl
                 << sylar::BacktraceToString();
         }
 
-        auto raw_ptr = cur.get();
-        cur.reset();
-        raw_ptr->back();
-        SYLAR_ASSERT2(false, "never reach fiber_id=" + std::to_string(raw_ptr->getId()));
+        //局部变量的析构函数仍在协程栈上执行，可以访问其他局部变量
+        cur->destroyLocals();
+        if(cur->m_painted) {
+            cur->recordStackUsage();
+        }
+        cur->back();
+        SYLAR_ASSERT2(false, "never reach fiber_id=" + std::to_string(cur->getId()));
     }
     /**
      * @brief 获取当前协程的id
@@ -298,4 +596,219 @@ namespace sylar {
         }
         return 0;
     }
+
+    size_t Fiber::GetSharedStackBound()
+    {
+        return t_shared_bound;
+    }
+
+    bool Fiber::OnSharedStack(const void* p)
+    {
+        Fiber* cur = t_fiber;
+        if(!cur || !cur->m_shared || !cur->m_sharedStack) {
+            return false;
+        }
+        const char* begin = (const char*)cur->m_sharedStack->stack;
+        return (const char*)p >= begin && (const char*)p < begin + cur->m_sharedStack->size;
+    }
+
+    Fiber::ptr Fiber::Create(std::function<void()> cb, const std::type_info* entry)
+    {
+        if(!entry) {
+            entry = &cb.target_type();
+        }
+        uint32_t stacksize = GetStackClass(*entry);
+        //配置了专门栈大小的入口不走协程池
+        if(!t_fiber_pool.empty()
+                && stacksize == t_fiber_pool.back()->m_stacksize) {
+            Fiber::ptr fiber;
+            fiber.swap(t_fiber_pool.back());
+            t_fiber_pool.pop_back();
+            fiber->reset(cb, entry);
+            s_pool_hits.fetch_add(1, std::memory_order_relaxed);
+            return fiber;
+        }
+        s_pool_misses.fetch_add(1, std::memory_order_relaxed);
+        Fiber::ptr fiber(new Fiber(cb, stacksize));
+        fiber->m_entry = entry;
+        return fiber;
+    }
+
+    bool Fiber::Recycle(Fiber::ptr fiber)
+    {
+        if(!fiber || !fiber->m_stack || fiber.use_count() > 1) {
+            return false;
+        }
+        if(fiber->getState() != TERM && fiber->getState() != EXCEPT) {
+            return false;
+        }
+        if(fiber->m_stacksize != s_fiber_stack_size.load(std::memory_order_relaxed)
+                || t_fiber_pool.size() >= s_fiber_pool_size) {
+            return false;
+        }
+        fiber->m_cb = nullptr;
+        t_fiber_pool.push_back(std::move(fiber));
+        return true;
+    }
+
+    uint64_t Fiber::PoolHits()
+    {
+        return s_pool_hits;
+    }
+
+    uint64_t Fiber::PoolMisses()
+    {
+        return s_pool_misses;
+    }
+
+    void Fiber::paintStack()
+    {
+        //栈顶留给MakeContext写入初始现场
+        size_t words = (m_stacksize - s_stack_unpainted) / sizeof(uint64_t);
+        uint64_t *p = (uint64_t*)m_stack;
+        for(size_t i = 0; i < words; ++i) {
+            p[i] = s_stack_canary;
+        }
+        m_painted = true;
+    }
+
+    void Fiber::recordStackUsage()
+    {
+        //栈从高地址向低地址增长，从栈底往上数未被改写的金丝雀值
+        size_t words = (m_stacksize - s_stack_unpainted) / sizeof(uint64_t);
+        uint64_t *p = (uint64_t*)m_stack;
+        size_t untouched = 0;
+        while(untouched < words && p[untouched] == s_stack_canary) {
+            ++untouched;
+        }
+        uint64_t used = m_stacksize - untouched * sizeof(uint64_t);
+        m_painted = false;
+
+        int bucket = 0;
+        while(bucket < s_stack_buckets - 1 && used >= (1024ull << bucket)) {
+            ++bucket;
+        }
+        Mutex::Lock lock(s_stack_usage_mutex);
+        StackUsage& usage = s_stack_usage[std::type_index(*m_entry)];
+        ++usage.count;
+        usage.total += used;
+        usage.max = std::max(usage.max, used);
+        usage.stacksize = m_stacksize;
+        ++usage.buckets[bucket];
+    }
+
+    static std::string Demangle(const char* mangled)
+    {
+        int status = 0;
+        char *name = abi::__cxa_demangle(mangled, nullptr, nullptr, &status);
+        std::string rt = (status == 0 && name) ? name : mangled;
+        free(name);
+        return rt;
+    }
+
+    std::string Fiber::GetEntryName(const std::type_info& entry)
+    {
+        return Demangle(entry.name());
+    }
+
+    uint32_t Fiber::GetStackClass(const std::type_info& entry)
+    {
+        //没有配置按入口的栈大小时(默认)不加锁
+        if(s_stack_classes_empty.load(std::memory_order_acquire)) {
+            return s_fiber_stack_size.load(std::memory_order_relaxed);
+        }
+        {
+            RWMutex::ReadLock lock(s_stack_classes.mutex);
+            auto it = s_stack_classes.cache.find(std::type_index(entry));
+            if(it != s_stack_classes.cache.end()) {
+                return it->second;
+            }
+        }
+        std::string name = GetEntryName(entry);
+        RWMutex::WriteLock lock(s_stack_classes.mutex);
+        auto it = s_stack_classes.classes.find(name);
+        uint32_t size = it == s_stack_classes.classes.end()
+                        ? s_fiber_stack_size.load(std::memory_order_relaxed) : it->second;
+        s_stack_classes.cache[std::type_index(entry)] = size;
+        return size;
+    }
+
+    std::string Fiber::DumpStackProfile()
+    {
+        YAML::Node node;
+        Mutex::Lock lock(s_stack_usage_mutex);
+        for(auto& i : s_stack_usage) {
+            const StackUsage& usage = i.second;
+            std::string name = Demangle(i.first.name());
+            YAML::Node n;
+            n["count"] = usage.count;
+            n["max"] = usage.max;
+            n["avg"] = usage.count ? usage.total / usage.count : 0;
+            n["stack_size"] = usage.stacksize;
+            for(int b = 0; b < s_stack_buckets; ++b) {
+                if(!usage.buckets[b]) {
+                    continue;
+                }
+                std::string label = b == s_stack_buckets - 1
+                                    ? ">=" + std::to_string(1 << (b - 1)) + "K"
+                                    : "<" + std::to_string(1 << b) + "K";
+                n["histogram"][label] = usage.buckets[b];
+            }
+            //峰值加50%余量(至少一页)，按页取整
+            uint64_t page = MmapStackAllocator::PageSize();
+            uint64_t suggest = MmapStackAllocator::RoundUp(usage.max + std::max(usage.max / 2, page));
+            n["suggest"] = suggest;
+            node["entries"][name] = n;
+            node["stack_classes"][name] = suggest;
+        }
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+
+    void Fiber::ResetStackProfile()
+    {
+        Mutex::Lock lock(s_stack_usage_mutex);
+        s_stack_usage.clear();
+    }
+
+    size_t Fiber::AllocLocalSlot(LocalDestructor dtor)
+    {
+        size_t slot = s_local_slots++;
+        SYLAR_ASSERT2(slot < LOCAL_SLOTS, "too many FiberLocal, max=" << LOCAL_SLOTS);
+        s_local_dtors[slot] = dtor;
+        return slot;
+    }
+
+    void* Fiber::GetLocal(size_t slot)
+    {
+        return GetThisRaw()->m_locals[slot];
+    }
+
+    void Fiber::SetLocal(size_t slot, void* value)
+    {
+        GetThisRaw()->m_locals[slot] = value;
+    }
+
+    void Fiber::destroyLocals()
+    {
+        //析构函数里可能再设置其他槽位，最多重复几轮
+        for(int round = 0; round < 4; ++round) {
+            bool found = false;
+            for(size_t i = 0; i < LOCAL_SLOTS; ++i) {
+                void* value = m_locals[i];
+                if(!value) {
+                    continue;
+                }
+                m_locals[i] = nullptr;
+                found = true;
+                if(s_local_dtors[i]) {
+                    s_local_dtors[i](value);
+                }
+            }
+            if(!found) {
+                return;
+            }
+        }
+    }
 }
\ No newline at end of file
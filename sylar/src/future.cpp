@@ -0,0 +1,193 @@
+#include "../inc/future.h"
+#include "../inc/fiber.h"
+#include "../inc/scheduler.h"
+#include "../inc/timer.h"
+#include "../inc/log.h"
+#include "../inc/macro.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <chrono>
+
+namespace sylar{
+    static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+    /**
+     * @brief 挂起在Future上的协程
+     * @details 结果和超时定时器谁先到谁负责把协程放回调度器
+     */
+    struct FiberWaiter {
+        Scheduler* scheduler = nullptr;
+        Fiber::ptr fiber;
+        std::atomic<bool> done{false};
+        bool timeout = false;
+
+        void wakeup(bool is_timeout) {
+            if(done.exchange(true)) {
+                return;
+            }
+            timeout = is_timeout;
+            Fiber::ptr f;
+            f.swap(fiber);
+            scheduler->schedule(&f);
+        }
+    };
+
+    /**
+     * @brief 阻塞在Future上的线程
+     */
+    struct ThreadWaiter {
+        std::mutex mutex;
+        std::condition_variable cond;
+        bool done = false;
+    };
+
+    bool FutureStateBase::isReady()
+    {
+        MutexType::Lock lock(m_mutex);
+        return m_ready;
+    }
+
+    bool FutureStateBase::wait(uint64_t timeout_ms)
+    {
+        Scheduler* scd = Scheduler::GetThis();
+        Fiber* cur = Fiber::GetThisRaw();
+        //只有调度器里的子协程可以挂起，线程的主协程和调度协程只能阻塞
+        bool in_fiber = scd && cur != Scheduler::GetMainFiber()
+                        && (cur->getStackSize() || cur->isSharedStack());
+        //设置结果的一方通过指针访问共享状态，共享状态不能在挂起的共享栈上(Future::get也经过这里)
+        SYLAR_ASSERT2(!Fiber::OnSharedStack(this), "future state on the waiting fiber's shared stack");
+        if(in_fiber) {
+            auto waiter = std::make_shared<FiberWaiter>();
+            waiter->scheduler = scd;
+            waiter->fiber = Fiber::ptr(cur);
+            Timer::ptr timer;
+            {
+                MutexType::Lock lock(m_mutex);
+                if(m_ready) {
+                    return true;
+                }
+                m_callbacks.push_back([waiter](){
+                    waiter->wakeup(false);
+                });
+                if(timeout_ms != ~0ull) {
+                    TimerManager* tm = dynamic_cast<TimerManager*>(scd);
+                    if(tm) {
+                        timer = tm->addTimer(timeout_ms, [waiter](){
+                            waiter->wakeup(true);
+                        });
+                    } else {
+                        SYLAR_LOG_WARN(g_logger) << "Future::wait timeout ignored, scheduler "
+                            << scd->getName() << " is not a TimerManager";
+                    }
+                }
+            }
+            //协程在真正切出之前保持EXEC状态，其他线程不会提前把它切入
+            Fiber::YieldToHold();
+            if(timer) {
+                timer->cancel();
+            }
+            return !waiter->timeout;
+        }
+
+        auto waiter = std::make_shared<ThreadWaiter>();
+        {
+            MutexType::Lock lock(m_mutex);
+            if(m_ready) {
+                return true;
+            }
+            m_callbacks.push_back([waiter](){
+                std::lock_guard<std::mutex> lock(waiter->mutex);
+                waiter->done = true;
+                waiter->cond.notify_all();
+            });
+        }
+        std::unique_lock<std::mutex> lock(waiter->mutex);
+        if(timeout_ms == ~0ull) {
+            waiter->cond.wait(lock, [&waiter](){ return waiter->done; });
+            return true;
+        }
+        return waiter->cond.wait_for(lock, std::chrono::milliseconds(timeout_ms)
+                                     ,[&waiter](){ return waiter->done; });
+    }
+
+    void FutureStateBase::onReady(std::function<void()> cb)
+    {
+        {
+            MutexType::Lock lock(m_mutex);
+            if(!m_ready) {
+                m_callbacks.push_back(std::move(cb));
+                return;
+            }
+        }
+        cb();
+    }
+
+    bool FutureStateBase::setException(std::exception_ptr ex)
+    {
+        return complete([this, &ex](){
+            m_exception = ex;
+        });
+    }
+
+    void FutureStateBase::rethrow()
+    {
+        if(m_exception) {
+            std::rethrow_exception(m_exception);
+        }
+    }
+
+    bool FutureStateBase::complete(const std::function<void()>& store)
+    {
+        std::vector<std::function<void()> > callbacks;
+        {
+            MutexType::Lock lock(m_mutex);
+            if(m_ready) {
+                return false;
+            }
+            store();
+            m_ready = true;
+            callbacks.swap(m_callbacks);
+        }
+        for(auto& i : callbacks) {
+            i();
+        }
+        return true;
+    }
+
+    Future<void> whenAll(const std::vector<Future<void> >& futures)
+    {
+        struct Context {
+            Context(const std::vector<Future<void> >& f)
+                :futures(f), left(f.size()) {}
+            std::vector<Future<void> > futures;
+            Promise<void> promise;
+            Mutex mutex;
+            size_t left;
+        };
+        auto ctx = std::make_shared<Context>(futures);
+        if(futures.empty()) {
+            ctx->promise.setValue();
+        }
+        for(auto& i : futures) {
+            i.onReady([ctx](){
+                {
+                    Mutex::Lock lock(ctx->mutex);
+                    if(--ctx->left) {
+                        return;
+                    }
+                }
+                try {
+                    for(auto& f : ctx->futures) {
+                        f.get();
+                    }
+                } catch (...) {
+                    ctx->promise.setException(std::current_exception());
+                    return;
+                }
+                ctx->promise.setValue();
+            });
+        }
+        return ctx->promise.getFuture();
+    }
+}
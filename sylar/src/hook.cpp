@@ -19,7 +19,13 @@ static sylar::ConfigVar<int>::ptr g_tcp_connect_timeout =
     XX(sleep)        \
     XX(usleep)  \
     XX(nanosleep)\
-    XX(socket)
+    XX(socket)  \
+    XX(close)   \
+    XX(fcntl)   \
+    XX(read)    \
+    XX(recv)    \
+    XX(write)   \
+    XX(send)
 
     static thread_local bool t_hook_enable = false;
 
@@ -62,16 +68,27 @@ static sylar::ConfigVar<int>::ptr g_tcp_connect_timeout =
         int cancelled = 0;
     };
 
+    /**
+     * @brief io_uring后端可以直接交给内核完成的读写请求
+     */
+    struct ring_io {
+        uint8_t opcode;
+        void* buf;
+        size_t len;
+        int flags;
+    };
+
     template <typename OriginFun, typename... Args>
     static ssize_t do_io(int fd, OriginFun fun, const char *hook_fun_name,
-                         uint32_t event, int timeout_so, Args &...args)
+                         uint32_t event, int timeout_so, const ring_io* ring, Args &...args)
     {
         //如果不能hook，使用原始函数
         if(!sylar::t_hook_enable)
         {
             return fun(fd, std::forward<Args>(args)...);
         }
-        sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+        //socket属性和事件等待状态在同一个对象里，之后注册、取消事件不需要再查找
+        sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
         //如果文件上下文没有，使用原始函数
         if(!ctx){
             return fun(fd, std::forward<Args>(args)...);
@@ -96,23 +113,31 @@ static sylar::ConfigVar<int>::ptr g_tcp_connect_timeout =
         if(n == -1 && errno == EAGAIN) {
             // 找到当前线程的IO调度器
             sylar::IOManager* iom = sylar::IOManager::GetThis();
+            //io_uring后端：请求交给内核，完成后带着结果恢复，不需要等待就绪再重试；
+            //不能使用io_uring时返回EAGAIN，按就绪通知等待
+            if(ring) {
+                ssize_t rt = iom->hookIO(ctx, ring->opcode, ring->buf, ring->len, ring->flags, to);
+                if(rt != -1 || errno != EAGAIN) {
+                    return rt;
+                }
+            }
             // 添加一个定时器
             sylar::Timer::ptr timer;
             std::weak_ptr<timer_info> winfo(tinfo);
             // 不等于-1，证明有超时时间，添加一个定时器，超时时间为to
             if(to != (uint64_t)-1) {
                 //添加定时器的内容为超时时间到了之后，触发该事件
-                timer = iom->addConditionTimer(to, [winfo, fd, iom, event]() {
+                timer = iom->addConditionTimer(to, [winfo, ctx, iom, event]() {
                     auto t = winfo.lock();
                     if(!t || t->cancelled) {
                         return;
                     }
                     t->cancelled = ETIMEDOUT;
-                    iom->cancelEvent(fd, (sylar::IOManager::Event)(event));
-                }, winfo);
+                    iom->cancelEvent(ctx, (sylar::IOManager::Event)(event));
+                }, winfo, false);
             }
             // 添加定时器要触发的事件
-            int rt = iom->addEvent(fd, (sylar::IOManager::Event)(event));
+            int rt = iom->addEvent(ctx, (sylar::IOManager::Event)(event));
             if(SYLAR_UNLIKELY(rt)) {
                 // 事件添加失败，取消定时器
                 SYLAR_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
@@ -196,9 +221,56 @@ extern "C" {
         return fd;
     }
 
-    int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen, uint64_t timeout_ms)
+    int close(int fd)
     {
+        if(!sylar::t_hook_enable){
+            return close_f(fd);
+        }
+        //只被IOManager注册过的fd(socketpair、pipe等)也有记录，但没有初始化socket属性
+        sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->getRecord(fd, false);
+        if(ctx) {
+            //由注册所在的IOManager唤醒等待者并注销持久注册，它不一定是当前线程的IOManager
+            sylar::IOManager* iom = nullptr;
+            {
+                sylar::FdCtx::MutexType::Lock lock(ctx->mutex);
+                iom = ctx->iom;
+            }
+            if(iom) {
+                iom->cancelAll(fd);
+            }
+            sylar::FdMgr::GetInstance()->del(fd);
+        }
+        return close_f(fd);
+    }
 
+    ssize_t read(int fd, void *buf, size_t count)
+    {
+        sylar::ring_io ring = {IORING_OP_READ, buf, count, 0};
+        return sylar::do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, &ring, buf, count);
+    }
+
+    ssize_t recv(int sockfd, void *buf, size_t len, int flags)
+    {
+        sylar::ring_io ring = {IORING_OP_RECV, buf, len, flags};
+        return sylar::do_io(sockfd, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO, &ring, buf, len, flags);
+    }
+
+    ssize_t write(int fd, const void *buf, size_t count)
+    {
+        sylar::ring_io ring = {IORING_OP_WRITE, (void*)buf, count, 0};
+        return sylar::do_io(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO, &ring, buf, count);
+    }
+
+    ssize_t send(int s, const void *msg, size_t len, int flags)
+    {
+        sylar::ring_io ring = {IORING_OP_SEND, (void*)msg, len, flags};
+        return sylar::do_io(s, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO, &ring, msg, len, flags);
+    }
+
+    int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen, uint64_t timeout_ms)
+    {
+        //connect还没有hook，超时暂不生效，直接调用系统的connect
+        return ::connect(fd, addr, addrlen);
     }
 
 }
\ No newline at end of file
@@ -1,89 +1,181 @@
 #include "../inc/sylar.h"
+#include "../inc/hook.h"
 #include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 
 namespace sylar{
     static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
-    
-    IOManager::FdContext::EventContext& IOManager::FdContext::getContext(Event event)
+
+    /**
+     * @brief 定向唤醒IO线程用的信号
+     */
+    static int WakeupSignal()
     {
-        switch(event) {
-        case IOManager::READ:
-            return read;
-        case IOManager::WRITE:
-            return write;
-        default:
-            SYLAR_ASSERT2(false, "getContext");
-        }
-        throw std::invalid_argument("getContext invalid event");
+        return SIGRTMIN + 3;
     }
 
-    void IOManager::FdContext::resetContext(EventContext& ctx) {
-        ctx.scd = nullptr;
-        ctx.fiber.reset();
-        ctx.cb = nullptr;
+    static void WakeupHandler(int sig)
+    {
     }
 
-    void IOManager::FdContext::triggerEvent(Event event)
+    static ConfigVar<std::string>::ptr g_iomanager_backend =
+        Config::Lookup<std::string>("iomanager.backend", "epoll", "iomanager backend: epoll or io_uring");
+
+    static ConfigVar<bool>::ptr g_iomanager_epoll_persistent =
+        Config::Lookup<bool>("iomanager.epoll_persistent", false
+                , "register each fd once per direction and cache readiness, the hooked close cancels them");
+
+    static ConfigVar<bool>::ptr g_iomanager_multi_reactor =
+        Config::Lookup<bool>("iomanager.multi_reactor", false
+                , "one epoll per thread, fds are polled by the thread that registered them; off by default, no measured gain yet");
+
+    /// 多reactor模式：当前线程的reactor所属的IOManager和它的epoll
+    static thread_local IOManager* t_reactor_owner = nullptr;
+    static thread_local int t_reactor_efd = -1;
+
+    /// 多reactor模式：线程epoll里代表共享epoll的标记
+    static char s_shared_reactor_tag;
+
+    /// io_uring提交队列长度
+    static const uint32_t s_uring_entries = 1024;
+
+    /**
+     * @brief io_uring请求的user_data：低3位是类型，高16位是序号，中间是对象地址(8字节对齐)
+     */
+    enum RingTag {
+        // 不需要处理的完成事件(删除、取消请求本身)
+        RING_IGNORE = 0,
+        // 唤醒用的eventfd可读
+        RING_TICKLE = 1,
+        // 读事件，地址是FdContext
+        RING_READ = 2,
+        // 写事件，地址是FdContext
+        RING_WRITE = 3,
+        // 读写请求完成，地址是RingOp
+        RING_IO = 4
+    };
+
+    static uint64_t RingData(void* ptr, RingTag tag, uint16_t seq)
     {
-        SYLAR_ASSERT(events & event);
-        events = (Event)(events & ~event);
-        EventContext ctx = getContext(event);
-        if(ctx.cb) {
-            ctx.scd->schedule(&ctx.cb);
-        } else {
-            ctx.scd->schedule(&ctx.fiber);
-        }
-        ctx.scd = nullptr;
-        return;
+        return ((uint64_t)seq << 48) | (uint64_t)ptr | tag;
     }
 
+    static void* RingPtr(uint64_t data)
+    {
+        return (void*)(data & 0x0000fffffffffff8ull);
+    }
+
+    /**
+     * @brief io_uring读写请求，放在发起请求的协程栈上，完成时由等待者填写结果并恢复协程
+     */
+    struct RingOp {
+        Scheduler* scd = nullptr;
+        Fiber::ptr fiber;
+        int res = 0;
+    };
+
+    /// 读写请求的序号，同一个栈地址上先后发起的请求不会被误取消
+    static std::atomic<uint16_t> s_ring_op_seq = {0};
+    
     //初始化调度器、初始化Epoll，启动IOManager
-    IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
+    IOManager::IOManager(size_t threads, bool use_caller, const std::string &name, Backend backend)
         : Scheduler(threads, use_caller, name)
+        , m_fdManager(FdMgr::GetInstance())
     {
-        m_efd = epoll_create(5000);
-        SYLAR_ASSERT(m_efd > 0)
-        int rt = pipe(m_tickleFds);  /*标记*/
-        SYLAR_ASSERT(!rt);
-        epoll_event event;
-        memset(&event, 0, sizeof(epoll_event));
-        event.events = EPOLLIN | EPOLLET;
-        event.data.fd = m_tickleFds[0]; //读端口
-        rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);//设置文件非阻塞
-        SYLAR_ASSERT(!rt);
-        contextResize(32);
+        if(backend == BACKEND_DEFAULT) {
+            backend = g_iomanager_backend->getValue() == "io_uring" ? BACKEND_IO_URING : BACKEND_EPOLL;
+        }
+        m_tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        SYLAR_ASSERT(m_tickleFd >= 0);
+        if(backend == BACKEND_IO_URING) {
+            m_ring = new IoUring;
+            if(!m_ring->init(s_uring_entries)) {
+                SYLAR_LOG_WARN(g_logger) << "name=" << name << " io_uring unavailable, fall back to epoll";
+                delete m_ring;
+                m_ring = nullptr;
+            }
+        }
+        if(m_ring) {
+            m_efd = -1;
+            ringArmTickle();
+        } else {
+            m_persistent = g_iomanager_epoll_persistent->getValue();
+            m_multiReactor = g_iomanager_multi_reactor->getValue();
+            m_efd = epoll_create(5000);
+            SYLAR_ASSERT(m_efd > 0)
+            //多reactor模式下eventfd注册在每个线程的epoll里(见openReactor)
+            if(!m_multiReactor) {
+                //边缘触发：每次写入只唤醒一个epoll_wait中的线程
+                epoll_event event;
+                memset(&event, 0, sizeof(epoll_event));
+                event.events = EPOLLIN | EPOLLET;
+                event.data.ptr = nullptr;
+                int rt = epoll_ctl(m_efd, EPOLL_CTL_ADD, m_tickleFd, &event);
+                SYLAR_ASSERT(!rt);
+            }
+        }
+        static bool s_wakeup_installed = [](){
+            struct sigaction sa;
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_handler = &WakeupHandler;
+            sigemptyset(&sa.sa_mask);
+            return sigaction(WakeupSignal(), &sa, nullptr) == 0;
+        }();
+        SYLAR_ASSERT(s_wakeup_installed);
         start();
     }
 
     IOManager::~IOManager()
     {
         stop();
-        close(m_efd);
-        close(m_tickleFds[0]);
-        close(m_tickleFds[1]);
-        for(size_t i = 0; i < m_fdContexts.size(); ++i) {
-            if(m_fdContexts[i]) {
-                delete m_fdContexts[i];
-            }
+        if(m_efd >= 0) {
+            close(m_efd);
         }
+        close(m_tickleFd);
+        delete m_ring;
+        //持久注册的状态属于已经关闭的epoll，fd之后可以被其他IOManager注册
+        m_fdManager->foreach([this](FdContext* fd_ctx){
+            FdContext::MutexType::Lock lock(fd_ctx->mutex);
+            if(fd_ctx->iom != this) {
+                return;
+            }
+            fd_ctx->registered = NONE;
+            fd_ctx->ready = NONE;
+            fd_ctx->efd = -1;
+            fd_ctx->iom = nullptr;
+        });
     }
     int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
     {
-        FdContext *fd_ctx = nullptr;  //socket事件上下文，是IO调度器操作的基本单元之一
-        RWMutexType::ReadLock lock(m_mutex);
-        if((int)m_fdContexts.size() > fd){
-            fd_ctx = m_fdContexts[fd];
-            lock.unlock();
-        }
-        else{
-            lock.unlock();
-            RWMutexType::WriteLock lock2(m_mutex);
-            contextResize(fd * 1.5);
-            fd_ctx = m_fdContexts[fd];
+        //socket事件上下文，是IO调度器操作的基本单元之一；和hook用的socket属性是同一个对象，第一次注册时分配，之后不会移动
+        FdContext *fd_ctx = m_fdManager->getRecord(fd, true);
+        if(SYLAR_UNLIKELY(!fd_ctx)) {
+            SYLAR_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " out of range, capacity="
+                    << FdManager::Capacity();
+            return -1;
         }
+        return addEvent(fd_ctx, event, std::move(cb));
+    }
 
+    int IOManager::addEvent(FdContext* fd_ctx, Event event, std::function<void()> cb)
+    {
+        int fd = fd_ctx->fd;
         FdContext::MutexType::Lock lock3(fd_ctx->mutex);
+        //同一个fd同时只能由一个IOManager等待
+        if(fd_ctx->iom != this) {
+            if(SYLAR_UNLIKELY(fd_ctx->events || fd_ctx->registered)) {
+                SYLAR_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " is waited by another iomanager";
+                return -1;
+            }
+            fd_ctx->iom = this;
+            fd_ctx->ready = NONE;
+        }
         //一个句柄，不可能重复加载事件
         if(SYLAR_UNLIKELY(fd_ctx->events & event)){
             SYLAR_LOG_ERROR(g_logger) << "addEvent assert fd=" << fd
@@ -91,19 +183,45 @@ namespace sylar{
                     << " fd_ctx.event=" << (EPOLL_EVENTS)fd_ctx->events;
             SYLAR_ASSERT(!(fd_ctx->events & event));   
         }
-        //注册或者修改一个epoll event
-        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-        epoll_event epevent;
-        //socket事件上下文类主要记录事件类型是读还是写
-        epevent.events = EPOLLET | fd_ctx->events | event;
-        epevent.data.ptr = fd_ctx;
-        int rt = epoll_ctl(m_efd, op, fd, &epevent);//监听事件的添加或调整
-        if(rt) {
-            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_efd << ", "
-                << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
-                << (EPOLL_EVENTS)fd_ctx->events;
-            return -1;
+        if(m_ring) {
+            //io_uring的poll请求是一次性的，读写事件各自一个请求，触发后不需要重新注册
+            ringPoll(fd_ctx, event);
+        } else if(m_persistent) {
+            //持久注册：每个方向第一次等待时注册，之后的等待不再调用epoll_ctl；
+            //只注册等待过的方向，从不等待可写的连接不会被对端每次读走数据产生的EPOLLOUT唤醒
+            if(!(fd_ctx->registered & event)) {
+                int op = fd_ctx->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+                int efd = fd_ctx->registered ? fd_ctx->efd : reactorFor();
+                epoll_event epevent;
+                epevent.events = EPOLLET | fd_ctx->registered | event;
+                epevent.data.ptr = fd_ctx;
+                int rt = epoll_ctl(efd, op, fd, &epevent);
+                if(rt) {
+                    SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << efd << ", "
+                        << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                        << rt << " (" << errno << ") (" << strerror(errno) << ")";
+                    return -1;
+                }
+                fd_ctx->registered = (Event)(fd_ctx->registered | event);
+                fd_ctx->efd = efd;
+            }
+        } else {
+            //注册或者修改一个epoll event；多reactor模式下新注册的fd放进当前线程的epoll
+            int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+            int efd = fd_ctx->events ? fd_ctx->efd : reactorFor();
+            epoll_event epevent;
+            //socket事件上下文类主要记录事件类型是读还是写
+            epevent.events = EPOLLET | fd_ctx->events | event;
+            epevent.data.ptr = fd_ctx;
+            int rt = epoll_ctl(efd, op, fd, &epevent);//监听事件的添加或调整
+            if(rt) {
+                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << efd << ", "
+                    << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                    << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
+                    << (EPOLL_EVENTS)fd_ctx->events;
+                return -1;
+            }
+            fd_ctx->efd = efd;
         }
         //成功注册epoll事件后，刷新队列中对应的元素
         ++m_pendingEventCount;
@@ -116,47 +234,60 @@ namespace sylar{
         //如此，就要为新的事件分配对应的执行主体与执行逻辑
         if(cb) {
             event_ctx.cb.swap(cb);
+            event_ctx.priority = Fiber::GetThisRaw()->getPriority();
         } else {
             event_ctx.fiber = Fiber::GetThis();
             SYLAR_ASSERT2(event_ctx.fiber->getState() == Fiber::EXEC
                         ,"state=" << event_ctx.fiber->getState());
         }
+        //就绪事件在没有等待者时已经到达，立即触发，不需要系统调用；
+        //就绪标记可能已经过时(数据已经被读走)，等待者重试时会再次EAGAIN，那时标记已经清除
+        if(fd_ctx->ready & event) {
+            fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+            fd_ctx->triggerEvent(event);
+            --m_pendingEventCount;
+        }
         return 0;
     }
 
     bool IOManager::delEvent(int fd, Event event)
     {
-        RWMutexType::ReadLock lock(m_mutex);
-        if((int)m_fdContexts.size() <= fd)
+        // 获取要删除的元素，从未注册过的fd没有上下文
+        FdContext *fd_ctx = m_fdManager->getRecord(fd, false);
+        if(!fd_ctx)
         {
             return false;
         }
-        // 获取要删除的元素
-        FdContext *fd_ctx = m_fdContexts[fd];
-        lock.unlock();
 
         FdContext::MutexType::Lock lock2(fd_ctx->mutex);
         // 要删除的事件大概率是存在的，否则报错
-        if (SYLAR_UNLIKELY(!(fd_ctx->events & event)))
+        if (SYLAR_UNLIKELY(!(fd_ctx->events & event) || fd_ctx->iom != this))
         {
             return false;
         }
-        Event new_Event = (Event)(fd_ctx->events & ~event);
-        int op = new_Event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-        epoll_event epevent;
-        epevent.events = EPOLLET | new_Event;
-        epevent.data.ptr = fd_ctx;
-        int rt = epoll_ctl(m_efd, op, fd, &epevent);
-        if(rt) {
-            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_efd << ", "
-                << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                << rt << " (" << errno << ") (" << strerror(errno) << ")";
-            return false;
+        if(m_ring) {
+            ringRemove(fd_ctx, event);
+        } else if(!m_persistent) {
+            Event new_Event = (Event)(fd_ctx->events & ~event);
+            int op = new_Event ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+            epoll_event epevent;
+            epevent.events = EPOLLET | new_Event;
+            epevent.data.ptr = fd_ctx;
+            int rt = epoll_ctl(fd_ctx->efd, op, fd, &epevent);
+            if(rt) {
+                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->efd << ", "
+                    << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                    << rt << " (" << errno << ") (" << strerror(errno) << ")";
+                return false;
+            }
+            if(op == EPOLL_CTL_DEL) {
+                fd_ctx->efd = -1;
+            }
         }
         //成功删除事件后,重置对应的元素
         --m_pendingEventCount;
-        fd_ctx->events = new_Event;
-        FdContext::EventContext event_ctx = fd_ctx->getContext(event);
+        fd_ctx->events = (Event)(fd_ctx->events & ~event);
+        FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
         fd_ctx->resetContext(event_ctx);
         return true;
     }
@@ -164,28 +295,39 @@ namespace sylar{
     bool IOManager::cancelEvent(int fd, Event event)
     {
         //获取要操作的元素
-        RWMutexType::ReadLock lock(m_mutex);
-        if((int)m_fdContexts.size() <= fd){
+        FdContext *fd_ctx = m_fdManager->getRecord(fd, false);
+        if(!fd_ctx){
             return false;
         }
-        FdContext *fd_ctx = m_fdContexts[fd];
-        lock.unlock();
+        return cancelEvent(fd_ctx, event);
+    }
+
+    bool IOManager::cancelEvent(FdContext* fd_ctx, Event event)
+    {
+        int fd = fd_ctx->fd;
         FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-        if(SYLAR_UNLIKELY(!(fd_ctx->events & event))) {
+        if(SYLAR_UNLIKELY(!(fd_ctx->events & event) || fd_ctx->iom != this)) {
             return false;
         }
         // 修改或删除事件
-        Event new_events = (Event)(fd_ctx->events & ~event);
-        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-        epoll_event epevent;
-        epevent.events = EPOLLET | new_events;
-        epevent.data.ptr = fd_ctx;
-        int rt = epoll_ctl(m_efd, op, fd, &epevent);
-        if(rt) {
-            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_efd << ", "
-                << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                << rt << " (" << errno << ") (" << strerror(errno) << ")";
-            return false;
+        if(m_ring) {
+            ringRemove(fd_ctx, event);
+        } else if(!m_persistent) {
+            Event new_events = (Event)(fd_ctx->events & ~event);
+            int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+            epoll_event epevent;
+            epevent.events = EPOLLET | new_events;
+            epevent.data.ptr = fd_ctx;
+            int rt = epoll_ctl(fd_ctx->efd, op, fd, &epevent);
+            if(rt) {
+                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->efd << ", "
+                    << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                    << rt << " (" << errno << ") (" << strerror(errno) << ")";
+                return false;
+            }
+            if(op == EPOLL_CTL_DEL) {
+                fd_ctx->efd = -1;
+            }
         }
 
         fd_ctx->triggerEvent(event);
@@ -196,28 +338,64 @@ namespace sylar{
     bool IOManager::cancelAll(int fd)
     {
          //获取要操作的元素
-        RWMutexType::ReadLock lock(m_mutex);
-        if((int)m_fdContexts.size() <= fd){
+        FdContext* fd_ctx = m_fdManager->getRecord(fd, false);
+        if(!fd_ctx){
             return false;
         }
-        FdContext* fd_ctx = m_fdContexts[fd];
-        lock.unlock();
         //将该元素锁住并操作
         FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-        if(!fd_ctx->events) {
+        if(fd_ctx->iom != this) {
             return false;
         }
-        int op = EPOLL_CTL_DEL;
-        epoll_event epevent;
-        epevent.events = 0;
-        epevent.data.ptr = fd_ctx;
+        if(fd_ctx->registered) {
+            //持久注册：关闭前注销，fd号被复用时重新注册；fd可能已经关闭，忽略错误
+            epoll_event epevent;
+            memset(&epevent, 0, sizeof(epevent));
+            epoll_ctl(fd_ctx->efd, EPOLL_CTL_DEL, fd, &epevent);
+            fd_ctx->registered = NONE;
+            fd_ctx->ready = NONE;
+            fd_ctx->efd = -1;
+        }
+        bool cancelled = false;
+        if(m_ring && fd_ctx->ringOps) {
+            //hook提交的读写请求按fd取消，以-ECANCELED完成；提交和登记都在fd_ctx->mutex里，不会漏掉
+            RingMutexType::Lock lock(m_ringMutex);
+            io_uring_sqe* sqe = getSqe(lock);
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = fd;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+            sqe->user_data = RING_IGNORE;
+            //内核按fd查找请求，fd关闭之后就找不到了，不能留给等待者批量提交；积攒的请求在它前面，一起提交
+            m_ring->publish();
+            uint32_t n = m_sqUnflushed + 1;
+            int rt = m_ring->enter(n, 0);
+            m_sqUnflushed = rt > 0 ? n - std::min<uint32_t>(rt, n) : n;
+            cancelled = true;
+        }
+        if(!fd_ctx->events) {
+            return cancelled;
+        }
+        if(m_ring) {
+            if(fd_ctx->events & READ) {
+                ringRemove(fd_ctx, READ);
+            }
+            if(fd_ctx->events & WRITE) {
+                ringRemove(fd_ctx, WRITE);
+            }
+        } else if(!m_persistent) {
+            int op = EPOLL_CTL_DEL;
+            epoll_event epevent;
+            epevent.events = 0;
+            epevent.data.ptr = fd_ctx;
 
-        int rt = epoll_ctl(m_efd, op, fd, &epevent);
-        if(rt) {
-            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_efd << ", "
-                << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-                << rt << " (" << errno << ") (" << strerror(errno) << ")";
-            return false;
+            int rt = epoll_ctl(fd_ctx->efd, op, fd, &epevent);
+            if(rt) {
+                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->efd << ", "
+                    << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                    << rt << " (" << errno << ") (" << strerror(errno) << ")";
+                return false;
+            }
+            fd_ctx->efd = -1;
         }
         // 删除对应的事件
         if(fd_ctx->events & READ) {
@@ -233,16 +411,6 @@ namespace sylar{
         return true;
     }
 
-    void IOManager::contextResize(size_t size)
-    {
-        m_fdContexts.resize(size);
-        for (size_t i = 0; i < m_fdContexts.size(); i++){
-            if(!m_fdContexts[i]){
-                m_fdContexts[i] = new FdContext;
-                m_fdContexts[i]->fd = i;
-            }
-        }
-    }
     IOManager* IOManager::GetThis()
     {
         return dynamic_cast<IOManager *>(Scheduler::GetThis());
@@ -254,47 +422,120 @@ namespace sylar{
         {
             return;
         }
-        int rt = write(m_tickleFds[1], "T", 1);
-        //std::cout << "**********" << std::endl;
-        SYLAR_ASSERT(rt == 1);
+        if(m_ring) {
+            //先叫醒睡在futex上的跟随者，等待者留在内核里继续等待IO
+            if(!unparkOne()) {
+                wakePoller();
+            }
+            return;
+        }
+        //已经有一个唤醒在路上，被唤醒的线程取到任务后如果还有剩余会继续唤醒下一个
+        if(m_tickling.exchange(true)) {
+            return;
+        }
+        uint64_t one = 1;
+        int rt = write_f(m_tickleFd, &one, sizeof(one));
+        SYLAR_ASSERT(rt == sizeof(one));
+    }
+
+    void IOManager::tickle(int thread)
+    {
+        Worker* worker = findWorker(thread);
+        if(!worker) {
+            tickle();
+            return;
+        }
+        if(m_ring) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(m_poller == worker) {
+                wakePoller();
+            } else {
+                unpark(worker);
+            }
+            return;
+        }
+        //只在目标线程睡眠时发送信号，睡眠期间的多次唤醒合并成一次
+        if(worker->sleeping && !worker->notified.exchange(true)) {
+            pthread_kill(worker->handle, WakeupSignal());
+        }
     }
 
     void IOManager::idle()
     {
+        if(m_ring) {
+            idleRing();
+            return;
+        }
         SYLAR_LOG_DEBUG(g_logger) << "idle";
         const uint64_t MAX_EVENTS = 256;
         epoll_event *events = new epoll_event[MAX_EVENTS]();
         std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr){
             delete[] ptr;
         });
+        //多reactor模式：等待当前线程自己的epoll，共享的epoll嵌套在里面
+        int efd = m_efd;
+        std::unique_ptr<epoll_event[]> reactor_events;
+        if(m_multiReactor) {
+            efd = openReactor();
+            reactor_events.reset(new epoll_event[MAX_EVENTS]());
+        }
+        //唤醒信号平时屏蔽，只在epoll_pwait期间放开
+        Worker* worker = GetWorker();
+        sigset_t wakeup_set;
+        sigset_t old_mask;
+        sigemptyset(&wakeup_set);
+        sigaddset(&wakeup_set, WakeupSignal());
+        pthread_sigmask(SIG_BLOCK, &wakeup_set, &old_mask);
+        sigset_t wait_mask = old_mask;
+        sigdelset(&wait_mask, WakeupSignal());
         while(true){
             uint64_t next_timeout = 0;
             if(SYLAR_UNLIKELY(stopping(next_timeout))){
                 SYLAR_LOG_INFO(g_logger) << "name=" << getName()
                                      << " idle stopping exit";
+                //唤醒是合并的，stop()只能叫醒一个线程，退出前依次叫醒下一个
+                tickle();
+                break;
+            }
+            if(canRetire()) {
+                SYLAR_LOG_INFO(g_logger) << "name=" << getName()
+                                     << " idle retire exit";
                 break;
             }
 
-            int rt = 0;
-            do{
-                static const int MAX_TIMEOUT = 3000;
-                if(next_timeout != ~0ull) {
-                    next_timeout = (int)next_timeout > MAX_TIMEOUT
-                                    ? MAX_TIMEOUT : next_timeout;
-                } else {
-                    next_timeout = MAX_TIMEOUT;
+            static const int MAX_TIMEOUT = 3000;
+            if(next_timeout != ~0ull) {
+                next_timeout = (int)next_timeout > MAX_TIMEOUT
+                                ? MAX_TIMEOUT : next_timeout;
+            } else {
+                next_timeout = MAX_TIMEOUT;
+            }
+            if(worker) {
+                worker->sleeping = true;
+                //先标记睡眠再检查收件箱，和enqueue的"先放入再检查睡眠"配对
+                if(worker->inboxCount) {
+                    next_timeout = 0;
                 }
-                rt = epoll_wait(m_efd, events, MAX_EVENTS, (int)next_timeout);
-                if(rt < 0 && errno == EINTR) {
-                } else {
-                    break;
+            }
+            int rt = epoll_pwait(efd, events, MAX_EVENTS, (int)next_timeout, &wait_mask);
+            if(worker) {
+                worker->sleeping = false;
+                worker->notified = false;
+            }
+            if(rt < 0) {
+                //EINTR：被定向唤醒，回到调度循环取指定给本线程的任务
+                if(errno != EINTR) {
+                    SYLAR_LOG_ERROR(g_logger) << "epoll_pwait(" << efd << ") errno="
+                        << errno << " (" << strerror(errno) << ")";
                 }
-            } while (true);
+                rt = 0;
+            }
             std::vector<std::function<void()> > cbs;
-            listExpiredCb(cbs);
+            std::vector<Fiber::Priority> priorities;
+            listExpiredCb(cbs, priorities);
             if(!cbs.empty()) {
                 //SYLAR_LOG_DEBUG(g_logger) << "on timer cbs.size=" << cbs.size();
-                schedule(cbs.begin(), cbs.end());
+                schedule(cbs.begin(), cbs.end(), priorities.begin());
                 cbs.clear();
             }
 
@@ -305,61 +546,177 @@ namespace sylar{
             //遍历监听到的事件
             for(int i = 0; i < rt; ++i) {
                 epoll_event& event = events[i];
-                //处理无效消息
-                if(event.data.fd == m_tickleFds[0]) {
-                    uint8_t dummy[256];
-                    while(read(m_tickleFds[0], dummy, sizeof(dummy)) > 0);
+                //唤醒消息：先清掉标记再回到调度循环取任务，之后提交的任务会重新唤醒
+                if(event.data.ptr == nullptr) {
+                    uint64_t dummy;
+                    if(read_f(m_tickleFd, &dummy, sizeof(dummy)) < 0 && errno != EAGAIN) {
+                        SYLAR_LOG_ERROR(g_logger) << "read(" << m_tickleFd << ") errno="
+                            << errno << " (" << strerror(errno) << ")";
+                    }
+                    m_tickling = false;
                     continue;
                 }
-                //对Socket事件上下文的处理
-                FdContext* fd_ctx = (FdContext*)event.data.ptr;
-                FdContext::MutexType::Lock lock(fd_ctx->mutex);
-                //如果出现错误和中断，那么相关的读写事件要进行处理
-                if(event.events & (EPOLLERR | EPOLLHUP)) {
-                    event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
-                }
-                int real_events = NONE;
-                if(event.events & EPOLLIN) {
-                    real_events |= READ;
-                }
-                if(event.events & EPOLLOUT) {
-                    real_events |= WRITE;
-                }
-                //在其他地方已经被处理掉了，因为有多个监听的idle
-                if((fd_ctx->events & real_events) == NONE) {
+                //共享的epoll有事件：取出来在本线程处理，取满时继续取，否则剩下的事件不会再产生边缘
+                if(event.data.ptr == &s_shared_reactor_tag) {
+                    int n = 0;
+                    do {
+                        n = epoll_wait(m_efd, reactor_events.get(), MAX_EVENTS, 0);
+                        for(int j = 0; j < n; ++j) {
+                            onFdEvent(reactor_events[j]);
+                        }
+                    } while(n == (int)MAX_EVENTS);
                     continue;
                 }
+                onFdEvent(event);
+            }
+            // 切换出去执行任务协程
+            Fiber::GetThisRaw()->swapOut();
+        }
+        if(m_multiReactor) {
+            closeReactor(efd);
+        }
+        pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    }
+
+    void IOManager::onFdEvent(epoll_event& event)
+    {
+        //对Socket事件上下文的处理
+        FdContext* fd_ctx = (FdContext*)event.data.ptr;
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        //fd已经转给其他IOManager，迟到的事件不属于这里
+        if(fd_ctx->iom != this) {
+            return;
+        }
+        if(m_persistent) {
+            onPersistentEvent(fd_ctx, event.events);
+            return;
+        }
+        //如果出现错误和中断，那么相关的读写事件要进行处理
+        if(event.events & (EPOLLERR | EPOLLHUP)) {
+            event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
+        }
+        int real_events = NONE;
+        if(event.events & EPOLLIN) {
+            real_events |= READ;
+        }
+        if(event.events & EPOLLOUT) {
+            real_events |= WRITE;
+        }
+        //在其他地方已经被处理掉了，因为有多个监听的idle
+        if((fd_ctx->events & real_events) == NONE) {
+            return;
+        }
 
-                //提取剩余事件，重新注册
-                int left_events = (fd_ctx->events & ~real_events);
-                int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-                event.events = EPOLLET | left_events;
+        //提取剩余事件，重新注册
+        int left_events = (fd_ctx->events & ~real_events);
+        int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        event.events = EPOLLET | left_events;
 
-                int rt2 = epoll_ctl(m_efd, op, fd_ctx->fd, &event);
-                if(rt2) {
-                    SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_efd << ", "
-                        << op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
-                        << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
-                    continue;
-                }
+        int rt = epoll_ctl(fd_ctx->efd, op, fd_ctx->fd, &event);
+        if(rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->efd << ", "
+                << op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
+                << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return;
+        }
+        if(op == EPOLL_CTL_DEL) {
+            fd_ctx->efd = -1;
+        }
 
-                //SYLAR_LOG_INFO(g_logger) << " fd=" << fd_ctx->fd << " events=" << fd_ctx->events
-                //                         << " real_events=" << real_events;
-                if(real_events & READ) {
-                    fd_ctx->triggerEvent(READ);
-                    --m_pendingEventCount;
-                }
-                if(real_events & WRITE) {
-                    fd_ctx->triggerEvent(WRITE);
-                    --m_pendingEventCount;
-                }
+        //SYLAR_LOG_INFO(g_logger) << " fd=" << fd_ctx->fd << " events=" << fd_ctx->events
+        //                         << " real_events=" << real_events;
+        if(real_events & READ) {
+            fd_ctx->triggerEvent(READ);
+            --m_pendingEventCount;
+        }
+        if(real_events & WRITE) {
+            fd_ctx->triggerEvent(WRITE);
+            --m_pendingEventCount;
+        }
+    }
+
+    int IOManager::reactorFor()
+    {
+        return t_reactor_owner == this ? t_reactor_efd : m_efd;
+    }
+
+    int IOManager::openReactor()
+    {
+        int efd = epoll_create(5000);
+        SYLAR_ASSERT(efd > 0);
+        //eventfd注册在所有线程的epoll里，EPOLLEXCLUSIVE让一次唤醒只叫醒一个等待中的线程
+        epoll_event event;
+        memset(&event, 0, sizeof(epoll_event));
+        event.events = EPOLLIN | EPOLLET | EPOLLEXCLUSIVE;
+        event.data.ptr = nullptr;
+        int rt = epoll_ctl(efd, EPOLL_CTL_ADD, m_tickleFd, &event);
+        if(rt && errno == EINVAL) {
+            //4.5以下的内核不支持EPOLLEXCLUSIVE
+            event.events = EPOLLIN | EPOLLET;
+            rt = epoll_ctl(efd, EPOLL_CTL_ADD, m_tickleFd, &event);
+        }
+        SYLAR_ASSERT(!rt);
+        event.events = EPOLLIN | EPOLLET;
+        event.data.ptr = &s_shared_reactor_tag;
+        rt = epoll_ctl(efd, EPOLL_CTL_ADD, m_efd, &event);
+        SYLAR_ASSERT(!rt);
+        t_reactor_owner = this;
+        t_reactor_efd = efd;
+        return efd;
+    }
+
+    void IOManager::closeReactor(int efd)
+    {
+        t_reactor_owner = nullptr;
+        t_reactor_efd = -1;
+        //其他线程只会修改已经注册在这里的fd，不会新加入；持有fd_ctx->mutex时转移，不会和它们交错
+        m_fdManager->foreach([this, efd](FdContext* fd_ctx){
+            FdContext::MutexType::Lock lock(fd_ctx->mutex);
+            if(fd_ctx->iom != this || fd_ctx->efd != efd) {
+                return;
             }
-            // 切换出去执行任务协程
-            Fiber::ptr cur = Fiber::GetThis();
-            auto raw_ptr = cur.get();
-            cur.reset();
+            //加入时内核会检查当前状态，已经就绪的fd在共享的epoll里立即产生事件
+            epoll_event epevent;
+            epevent.events = EPOLLET | (m_persistent ? fd_ctx->registered : fd_ctx->events);
+            epevent.data.ptr = fd_ctx;
+            int rt = epoll_ctl(m_efd, EPOLL_CTL_ADD, fd_ctx->fd, &epevent);
+            if(rt) {
+                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_efd << ", "
+                    << EPOLL_CTL_ADD << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                    << rt << " (" << errno << ") (" << strerror(errno) << ")";
+                fd_ctx->efd = -1;
+                return;
+            }
+            fd_ctx->efd = m_efd;
+        });
+        close(efd);
+    }
 
-            raw_ptr->swapOut();
+    void IOManager::onPersistentEvent(FdContext* fd_ctx, uint32_t events)
+    {
+        //已经注销(cancelAll)的fd可能还有取出来的旧事件
+        if(!fd_ctx->registered) {
+            return;
+        }
+        if(events & (EPOLLERR | EPOLLHUP)) {
+            events |= fd_ctx->registered;
+        }
+        int real_events = NONE;
+        if(events & EPOLLIN) {
+            real_events |= READ;
+        }
+        if(events & EPOLLOUT) {
+            real_events |= WRITE;
+        }
+        //没有等待者的方向记下就绪，之后的等待者立即恢复
+        fd_ctx->ready = (Event)(fd_ctx->ready | (real_events & ~fd_ctx->events));
+        if(real_events & fd_ctx->events & READ) {
+            fd_ctx->triggerEvent(READ);
+            --m_pendingEventCount;
+        }
+        if(real_events & fd_ctx->events & WRITE) {
+            fd_ctx->triggerEvent(WRITE);
+            --m_pendingEventCount;
         }
     }
 
@@ -377,6 +734,440 @@ namespace sylar{
     }
 
     void IOManager::onTimerInsertedAtFront(){
+        if(m_ring) {
+            //只需要等待者重新计算超时时间，没有等待者时下一个等待者会取到新的超时时间
+            wakePoller();
+            return;
+        }
         tickle();
     }
+
+    bool IOManager::hasWork(Worker* worker)
+    {
+        return Scheduler::hasWork(worker) || (m_ring && !m_polling);
+    }
+
+    void IOManager::idleRing()
+    {
+        SYLAR_LOG_DEBUG(g_logger) << "idle ring";
+        Worker* worker = GetWorker();
+        std::vector<std::pair<uint64_t, int> > completions;
+        while(true) {
+            uint64_t next_timeout = 0;
+            if(SYLAR_UNLIKELY(stopping(next_timeout))) {
+                SYLAR_LOG_INFO(g_logger) << "name=" << getName()
+                                     << " idle stopping exit";
+                tickle();
+                break;
+            }
+            if(canRetire()) {
+                SYLAR_LOG_INFO(g_logger) << "name=" << getName()
+                                     << " idle retire exit";
+                //退休的线程可能刚刚放开等待，叫醒一个跟随者接替
+                unparkOne();
+                break;
+            }
+            uint32_t to_submit = 0;
+            if(!takePoller(worker, to_submit)) {
+                //已经有等待者，睡在futex上，等待者要去执行任务时会叫醒一个跟随者接替
+                if(worker) {
+                    park(worker);
+                }
+                Fiber::GetThisRaw()->swapOut();
+                continue;
+            }
+
+            static const int MAX_TIMEOUT = 3000;
+            if(next_timeout != ~0ull) {
+                next_timeout = (int)next_timeout > MAX_TIMEOUT
+                                ? MAX_TIMEOUT : next_timeout;
+            } else {
+                next_timeout = MAX_TIMEOUT;
+            }
+            //先成为等待者再检查任务，和tickle的"先放入再检查等待者"配对
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(worker && hasPendingTasks(worker)) {
+                next_timeout = 0;
+            }
+            //批量提交积攒的请求并等待完成事件，一次系统调用
+            int rt = m_ring->enter(to_submit, 1, next_timeout);
+            if(rt < 0) {
+                //ETIME：超时；EINTR：被信号打断
+                if(errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                    SYLAR_LOG_ERROR(g_logger) << "io_uring_enter(" << m_ring->getFd() << ") errno="
+                        << errno << " (" << strerror(errno) << ")";
+                }
+                rt = 0;
+            }
+            if((uint32_t)rt < to_submit) {
+                RingMutexType::Lock lock(m_ringMutex);
+                m_sqUnflushed += to_submit - rt;
+            }
+            m_ring->reap([&completions](const io_uring_cqe& cqe){
+                completions.push_back(std::make_pair((uint64_t)cqe.user_data, cqe.res));
+            });
+            releasePoller();
+
+            std::vector<std::function<void()> > cbs;
+            std::vector<Fiber::Priority> priorities;
+            listExpiredCb(cbs, priorities);
+            if(!cbs.empty()) {
+                schedule(cbs.begin(), cbs.end(), priorities.begin());
+                cbs.clear();
+            }
+            for(auto& i : completions) {
+                onCompletion(i.first, i.second);
+            }
+            completions.clear();
+            //自己要去执行任务时叫醒一个跟随者接替等待，完成事件不会排在长任务后面
+            if(worker && hasPendingTasks(worker)) {
+                unparkOne();
+            }
+            Fiber::GetThisRaw()->swapOut();
+        }
+    }
+
+    bool IOManager::takePoller(Worker* worker, uint32_t& to_submit)
+    {
+        RingMutexType::Lock lock(m_ringMutex);
+        if(m_polling) {
+            return false;
+        }
+        m_polling = true;
+        m_poller = worker;
+        //在这之前发布的请求由等待者提交，之后发布的由发布者自己提交
+        to_submit = m_sqUnflushed;
+        m_sqUnflushed = 0;
+        return true;
+    }
+
+    void IOManager::releasePoller()
+    {
+        RingMutexType::Lock lock(m_ringMutex);
+        m_polling = false;
+        m_poller = nullptr;
+    }
+
+    void IOManager::wakePoller()
+    {
+        //没有等待者时不需要唤醒，下一个等待者进入内核前会检查任务和定时器
+        if(!m_polling || m_tickling.exchange(true)) {
+            return;
+        }
+        uint64_t one = 1;
+        int rt = write_f(m_tickleFd, &one, sizeof(one));
+        SYLAR_ASSERT(rt == sizeof(one));
+    }
+
+    io_uring_sqe* IOManager::getSqe(RingMutexType::Lock& lock)
+    {
+        io_uring_sqe* sqe = m_ring->getSqe();
+        while(!sqe) {
+            //提交队列满：先提交积攒的请求腾出位置，已经由等待者负责的请求让它提交
+            if(m_sqUnflushed) {
+                int rt = m_ring->enter(m_sqUnflushed, 0);
+                if(rt > 0) {
+                    m_sqUnflushed -= rt;
+                }
+            } else {
+                lock.unlock();
+                sched_yield();
+                lock.lock();
+            }
+            sqe = m_ring->getSqe();
+        }
+        return sqe;
+    }
+
+    void IOManager::commitSqes(uint32_t n)
+    {
+        m_ring->publish();
+        if(m_polling) {
+            int rt = m_ring->enter(n, 0);
+            if(rt > 0) {
+                n -= rt;
+            }
+        }
+        m_sqUnflushed += n;
+    }
+
+    void IOManager::ringPoll(FdContext* fd_ctx, Event event)
+    {
+        FdContext::EventContext& ctx = fd_ctx->getContext(event);
+        ++ctx.seq;
+        RingMutexType::Lock lock(m_ringMutex);
+        io_uring_sqe* sqe = getSqe(lock);
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd_ctx->fd;
+        sqe->poll32_events = event == READ ? POLLIN : POLLOUT;
+        sqe->user_data = RingData(fd_ctx, event == READ ? RING_READ : RING_WRITE, ctx.seq);
+        commitSqes(1);
+    }
+
+    void IOManager::ringRemove(FdContext* fd_ctx, Event event)
+    {
+        FdContext::EventContext& ctx = fd_ctx->getContext(event);
+        RingMutexType::Lock lock(m_ringMutex);
+        io_uring_sqe* sqe = getSqe(lock);
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = RingData(fd_ctx, event == READ ? RING_READ : RING_WRITE, ctx.seq);
+        sqe->user_data = RING_IGNORE;
+        commitSqes(1);
+    }
+
+    void IOManager::ringArmTickle()
+    {
+        RingMutexType::Lock lock(m_ringMutex);
+        io_uring_sqe* sqe = getSqe(lock);
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = m_tickleFd;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = RING_TICKLE;
+        commitSqes(1);
+    }
+
+    void IOManager::onCompletion(uint64_t data, int res)
+    {
+        switch(data & 7) {
+        case RING_TICKLE: {
+            uint64_t dummy;
+            if(read_f(m_tickleFd, &dummy, sizeof(dummy)) < 0 && errno != EAGAIN) {
+                SYLAR_LOG_ERROR(g_logger) << "read(" << m_tickleFd << ") errno="
+                    << errno << " (" << strerror(errno) << ")";
+            }
+            m_tickling = false;
+            ringArmTickle();
+            break;
+        }
+        case RING_READ:
+        case RING_WRITE: {
+            FdContext* fd_ctx = (FdContext*)RingPtr(data);
+            Event event = (data & 7) == RING_READ ? READ : WRITE;
+            FdContext::MutexType::Lock lock(fd_ctx->mutex);
+            //已经删除、取消，或者是之前一次注册迟到的完成事件；出错(res < 0)时和epoll一样触发事件
+            if(!(fd_ctx->events & event) || fd_ctx->iom != this
+                    || fd_ctx->getContext(event).seq != (uint16_t)(data >> 48)) {
+                break;
+            }
+            fd_ctx->triggerEvent(event);
+            --m_pendingEventCount;
+            break;
+        }
+        case RING_IO: {
+            //调度之后协程可能立即恢复并离开发起请求的栈帧，不能再访问op
+            RingOp* op = (RingOp*)RingPtr(data);
+            op->res = res;
+            Scheduler* scd = op->scd;
+            --m_pendingEventCount;
+            scd->schedule(&op->fiber);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    bool IOManager::canRingIO()
+    {
+        if(!m_ring || !Scheduler::GetThis()) {
+            return false;
+        }
+        Fiber* fiber = Fiber::GetThisRaw();
+        return fiber != Scheduler::GetMainFiber() && !fiber->isSharedStack();
+    }
+
+    ssize_t IOManager::ringIO(uint8_t opcode, int fd, void* buf, size_t len, int flags, uint64_t timeout_ms
+            , FdContext* fd_ctx)
+    {
+        if(fd_ctx) {
+            //登记和提交都在fd_ctx->mutex里完成，cancelAll要么看到请求并取消它，要么在提交之前
+            fd_ctx->mutex.lock();
+            if(fd_ctx->iom != this) {
+                if(fd_ctx->events || fd_ctx->registered || fd_ctx->ringOps) {
+                    fd_ctx->mutex.unlock();
+                    errno = EAGAIN;
+                    return -1;
+                }
+                fd_ctx->iom = this;
+                fd_ctx->ready = NONE;
+            }
+            ++fd_ctx->ringOps;
+        }
+        RingOp op;
+        op.scd = Scheduler::GetThis();
+        op.fiber = Fiber::GetThis();
+        uint64_t data = RingData(&op, RING_IO, s_ring_op_seq++);
+        {
+            RingMutexType::Lock lock(m_ringMutex);
+            io_uring_sqe* sqe = getSqe(lock);
+            sqe->opcode = opcode;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)buf;
+            sqe->len = len > 0x7ffff000 ? 0x7ffff000 : len;
+            if(opcode == IORING_OP_RECV || opcode == IORING_OP_SEND) {
+                sqe->msg_flags = flags;
+            } else {
+                //从当前文件偏移读写，和read/write一致
+                sqe->off = (uint64_t)-1;
+            }
+            sqe->user_data = data;
+            ++m_pendingEventCount;
+            commitSqes(1);
+        }
+        if(fd_ctx) {
+            fd_ctx->mutex.unlock();
+        }
+        //超时后取消请求，请求以-ECANCELED完成；和完成同时发生时以完成为准
+        Timer::ptr timer;
+        std::shared_ptr<int> cancelled;
+        if(timeout_ms != ~0ull) {
+            cancelled.reset(new int(0));
+            std::weak_ptr<int> winfo(cancelled);
+            timer = addConditionTimer(timeout_ms, [this, winfo, data](){
+                auto t = winfo.lock();
+                if(!t || *t) {
+                    return;
+                }
+                *t = ETIMEDOUT;
+                RingMutexType::Lock lock(m_ringMutex);
+                io_uring_sqe* sqe = getSqe(lock);
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->fd = -1;
+                sqe->addr = data;
+                sqe->user_data = RING_IGNORE;
+                commitSqes(1);
+            }, winfo, false);
+        }
+        Fiber::YieldToHold();
+        if(timer) {
+            timer->cancel();
+        }
+        if(fd_ctx) {
+            FdContext::MutexType::Lock lock(fd_ctx->mutex);
+            --fd_ctx->ringOps;
+        }
+        if(op.res < 0) {
+            if(op.res == -ECANCELED && cancelled && *cancelled) {
+                errno = ETIMEDOUT;
+            } else if(op.res == -ECANCELED && fd_ctx) {
+                //被cancelAll取消，fd已经关闭
+                errno = EBADF;
+            } else {
+                errno = -op.res;
+            }
+            return -1;
+        }
+        return op.res;
+    }
+
+    ssize_t IOManager::hookIO(FdCtx* fd_ctx, uint8_t opcode, void* buf, size_t len, int flags, uint64_t timeout_ms)
+    {
+        if(!canRingIO()) {
+            errno = EAGAIN;
+            return -1;
+        }
+        return ringIO(opcode, fd_ctx->fd, buf, len, flags, timeout_ms, fd_ctx);
+    }
+
+    ssize_t IOManager::readyIO(int fd, Event event, uint64_t timeout_ms, const std::function<ssize_t()>& fn)
+    {
+        //fn调用原始的系统函数(read_f等)：等待由这里负责，不能再经过hook等待一次
+        std::shared_ptr<int> cancelled(new int(0));
+        while(true) {
+            ssize_t n = fn();
+            while(n == -1 && errno == EINTR) {
+                n = fn();
+            }
+            if(n != -1 || errno != EAGAIN || !Scheduler::GetThis()) {
+                return n;
+            }
+            Timer::ptr timer;
+            if(timeout_ms != ~0ull) {
+                std::weak_ptr<int> winfo(cancelled);
+                timer = addConditionTimer(timeout_ms, [this, winfo, fd, event](){
+                    auto t = winfo.lock();
+                    if(!t || *t) {
+                        return;
+                    }
+                    *t = ETIMEDOUT;
+                    cancelEvent(fd, event);
+                }, winfo, false);
+            }
+            if(addEvent(fd, event)) {
+                if(timer) {
+                    timer->cancel();
+                }
+                return -1;
+            }
+            Fiber::YieldToHold();
+            if(timer) {
+                timer->cancel();
+            }
+            if(*cancelled) {
+                errno = *cancelled;
+                return -1;
+            }
+        }
+    }
+
+    ssize_t IOManager::read(int fd, void* buf, size_t len, uint64_t timeout_ms)
+    {
+        if(canRingIO()) {
+            //数据已经就绪时直接返回，不需要经过等待者；RWF_NOWAIT不改变fd的阻塞属性，不支持时返回EOPNOTSUPP
+            iovec iov = {buf, len};
+            ssize_t n = preadv2(fd, &iov, 1, -1, RWF_NOWAIT);
+            if(n != -1 || (errno != EAGAIN && errno != EINTR && errno != EOPNOTSUPP)) {
+                return n;
+            }
+            return ringIO(IORING_OP_READ, fd, buf, len, 0, timeout_ms);
+        }
+        return readyIO(fd, READ, timeout_ms, [fd, buf, len](){
+            return read_f(fd, buf, len);
+        });
+    }
+
+    ssize_t IOManager::write(int fd, const void* buf, size_t len, uint64_t timeout_ms)
+    {
+        if(canRingIO()) {
+            iovec iov = {(void*)buf, len};
+            ssize_t n = pwritev2(fd, &iov, 1, -1, RWF_NOWAIT);
+            if(n != -1 || (errno != EAGAIN && errno != EINTR && errno != EOPNOTSUPP)) {
+                return n;
+            }
+            return ringIO(IORING_OP_WRITE, fd, (void*)buf, len, 0, timeout_ms);
+        }
+        return readyIO(fd, WRITE, timeout_ms, [fd, buf, len](){
+            return write_f(fd, buf, len);
+        });
+    }
+
+    ssize_t IOManager::recv(int fd, void* buf, size_t len, int flags, uint64_t timeout_ms)
+    {
+        if(canRingIO()) {
+            //数据已经就绪时直接返回，不需要经过等待者；只有会阻塞的请求才提交
+            ssize_t n = recv_f(fd, buf, len, flags | MSG_DONTWAIT);
+            if(n != -1 || (errno != EAGAIN && errno != EINTR)) {
+                return n;
+            }
+            return ringIO(IORING_OP_RECV, fd, buf, len, flags, timeout_ms);
+        }
+        return readyIO(fd, READ, timeout_ms, [fd, buf, len, flags](){
+            return recv_f(fd, buf, len, flags);
+        });
+    }
+
+    ssize_t IOManager::send(int fd, const void* buf, size_t len, int flags, uint64_t timeout_ms)
+    {
+        if(canRingIO()) {
+            ssize_t n = send_f(fd, buf, len, flags | MSG_DONTWAIT);
+            if(n != -1 || (errno != EAGAIN && errno != EINTR)) {
+                return n;
+            }
+            return ringIO(IORING_OP_SEND, fd, (void*)buf, len, flags, timeout_ms);
+        }
+        return readyIO(fd, WRITE, timeout_ms, [fd, buf, len, flags](){
+            return send_f(fd, buf, len, flags);
+        });
+    }
 }
\ No newline at end of file
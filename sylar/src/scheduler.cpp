@@ -2,6 +2,13 @@
 #include "../inc/log.h"
 #include "../inc/macro.h"
 #include "../inc/hook.h"
+#include "../inc/conf.h"
+#include <linux/futex.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 
 namespace sylar{
@@ -10,6 +17,123 @@ namespace sylar{
     static thread_local Scheduler *t_scheduler = nullptr;
     //指向当前线程的调度协程
     static thread_local Fiber *t_scheduler_fiber = nullptr;
+    //窃取时选择起始线程的随机数
+    static thread_local uint32_t t_steal_seed = 0;
+
+    thread_local Scheduler::Worker* Scheduler::t_worker = nullptr;
+
+    static ConfigVar<uint32_t>::ptr g_scheduler_idle_spin =
+        Config::Lookup<uint32_t>("scheduler.idle_spin", 200, "idle worker spin rounds before park");
+
+    static uint32_t s_scheduler_idle_spin = 200;
+
+    struct _SchedulerIdleIniter {
+        _SchedulerIdleIniter() {
+            s_scheduler_idle_spin = g_scheduler_idle_spin->getValue();
+            g_scheduler_idle_spin->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+                s_scheduler_idle_spin = new_value;
+            });
+        }
+    };
+    static _SchedulerIdleIniter s_scheduler_idle_initer;
+
+    static ConfigVar<bool>::ptr g_scheduler_stats_timing =
+        Config::Lookup<bool>("scheduler.stats_timing", false, "record scheduler queue wait and run slice histograms, two clock reads per task");
+
+    static bool s_scheduler_stats_timing = false;
+
+    struct _SchedulerStatsIniter {
+        _SchedulerStatsIniter() {
+            s_scheduler_stats_timing = g_scheduler_stats_timing->getValue();
+            g_scheduler_stats_timing->addListener([](const bool& old_value, const bool& new_value){
+                s_scheduler_stats_timing = new_value;
+            });
+        }
+    };
+    static _SchedulerStatsIniter s_scheduler_stats_initer;
+
+    static ConfigVar<bool>::ptr g_scheduler_cache_affinity =
+        Config::Lookup<bool>("scheduler.cache_affinity", true, "resume woken fibers on the thread they last ran on");
+
+    static bool s_scheduler_cache_affinity = true;
+
+    struct _SchedulerAffinityIniter {
+        _SchedulerAffinityIniter() {
+            s_scheduler_cache_affinity = g_scheduler_cache_affinity->getValue();
+            g_scheduler_cache_affinity->addListener([](const bool& old_value, const bool& new_value){
+                s_scheduler_cache_affinity = new_value;
+            });
+        }
+    };
+    static _SchedulerAffinityIniter s_scheduler_affinity_initer;
+
+    static ConfigVar<uint32_t>::ptr g_scheduler_low_priority_interval =
+        Config::Lookup<uint32_t>("scheduler.low_priority_interval", 16, "take one low priority task every N picks, 0 runs them only when idle");
+
+    static uint32_t s_scheduler_low_priority_interval = 16;
+
+    struct _SchedulerPriorityIniter {
+        _SchedulerPriorityIniter() {
+            s_scheduler_low_priority_interval = g_scheduler_low_priority_interval->getValue();
+            g_scheduler_low_priority_interval->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+                s_scheduler_low_priority_interval = new_value;
+            });
+        }
+    };
+    static _SchedulerPriorityIniter s_scheduler_priority_initer;
+
+    static ConfigVar<uint32_t>::ptr g_scheduler_max_threads =
+        Config::Lookup<uint32_t>("scheduler.max_threads", 256, "max worker threads a scheduler can grow to");
+
+    static ConfigVar<uint32_t>::ptr g_scheduler_watchdog_budget =
+        Config::Lookup<uint32_t>("scheduler.watchdog_budget_ms", 0, "report tasks running longer than this, 0 disables the watchdog");
+
+    static uint32_t s_scheduler_watchdog_budget = 0;
+
+    struct _SchedulerWatchdogIniter {
+        _SchedulerWatchdogIniter() {
+            s_scheduler_watchdog_budget = g_scheduler_watchdog_budget->getValue();
+            g_scheduler_watchdog_budget->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+                s_scheduler_watchdog_budget = new_value;
+            });
+        }
+    };
+    static _SchedulerWatchdogIniter s_scheduler_watchdog_initer;
+
+    /**
+     * @brief 看门狗请求调用栈用的信号
+     */
+    static int WatchdogSignal()
+    {
+        return SIGRTMIN + 4;
+    }
+
+    /**
+     * @brief 只有一个线程写的计数器加一，不需要原子的加法指令
+     */
+    static inline void Bump(std::atomic<uint64_t>& v)
+    {
+        v.store(v.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static void FutexWait(std::atomic<int>* addr, int value)
+    {
+        syscall(SYS_futex, (int*)addr, FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+    }
+
+    static void FutexWake(std::atomic<int>* addr)
+    {
+        syscall(SYS_futex, (int*)addr, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+
+    static inline void CpuRelax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield" ::: "memory");
+#endif
+    }
     Scheduler::Scheduler(size_t threads,bool use_caller,const std::string& name)
     :m_name(name) {
         SYLAR_ASSERT(threads > 0);
@@ -33,6 +157,13 @@ namespace sylar{
 
     Scheduler::~Scheduler(){
         SYLAR_ASSERT(m_stopping);
+        if(m_threadCountVar) {
+            m_threadCountVar->delListener(m_threadCountListener);
+        }
+        stopWatchdog();
+        for(auto i : m_workers) {
+            delete i;
+        }
         if(GetThis() == this){
             t_scheduler = nullptr;
         }
@@ -57,11 +188,36 @@ namespace sylar{
         }
         m_stopping = false;
         SYLAR_ASSERT(m_threads.empty());
-        m_threads.resize(m_threadCount);
-        for(size_t i = 0; i < m_threadCount; ++i) {
-            m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this)
-                                , m_name + "_" + std::to_string(i)));
-            m_threadIds.push_back(m_threads[i]->getID());
+        //工作线程上下文要在线程启动前全部创建好，窃取时会遍历；预留容量，扩容时不重新分配
+        if(m_workers.empty()) {
+            size_t n = m_threadCount + (m_rootFiber ? 1 : 0);
+            m_workers.reserve(std::max<size_t>(n, g_scheduler_max_threads->getValue()));
+            for(size_t i = 0; i < n; ++i) {
+                m_workers.push_back(new Worker(this));
+            }
+            if(m_rootFiber) {
+                m_rootWorker = m_workers[0];
+            }
+            m_workerCount.store(m_workers.size(), std::memory_order_release);
+        }
+        if(s_scheduler_watchdog_budget && !m_watchdog) {
+            static bool s_watchdog_installed = [](){
+                struct sigaction sa;
+                memset(&sa, 0, sizeof(sa));
+                sa.sa_handler = &Scheduler::WatchdogHandler;
+                sa.sa_flags = SA_RESTART;
+                sigemptyset(&sa.sa_mask);
+                return sigaction(WatchdogSignal(), &sa, nullptr) == 0;
+            }();
+            SYLAR_ASSERT(s_watchdog_installed);
+            m_watchdogStop = false;
+            m_watchdog.reset(new Thread(std::bind(&Scheduler::watchdog, this)
+                                , m_name + "_watchdog"));
+        }
+        for(auto i : m_workers) {
+            if(i != m_rootWorker && i->state == Worker::ACTIVE) {
+                spawn(i);
+            }
         }
         // lock.unlock();
         // if (m_rootFiber)
@@ -108,17 +264,121 @@ namespace sylar{
         }
         std::vector<Thread::ptr> thrs;
         {
-            MutexType::Lock lock(Mutex);
+            MutexType::Lock lock(m_mutex);
             thrs.swap(m_threads);
         }
         for(auto& i : thrs){
             i->join();
         }
+        stopWatchdog();
     }
     void Scheduler::setThis()
     {
         t_scheduler = this;
     }
+
+    void Scheduler::spawn(Worker* worker)
+    {
+        worker->runner.reset(new Thread([this, worker](){
+                    t_worker = worker;
+                    run();
+                }, m_name + "_" + std::to_string(m_nextThreadIndex++)));
+        //Thread构造返回时线程已经启动，马上发布新的线程id：复用的上下文不再按退休线程的id找到，
+        //指定给新线程的任务也不会在它进入run之前被当成找不到目标
+        worker->thread = worker->runner->getID();
+        m_threads.push_back(worker->runner);
+        m_threadIds.push_back(worker->runner->getID());
+    }
+
+    void Scheduler::setThreadCount(size_t threads)
+    {
+        SYLAR_ASSERT(threads > 0);
+        size_t target = threads - (m_rootFiber ? 1 : 0);
+        MutexType::Lock lock(m_mutex);
+        if(m_workers.empty()) {
+            //还没有启动
+            m_threadCount = target;
+            return;
+        }
+        if(m_stopping) {
+            SYLAR_LOG_WARN(g_logger) << "scheduler " << m_name << " is stopping, ignore thread count " << threads;
+            return;
+        }
+        size_t active = m_threadCount;
+        while(active < target) {
+            //优先复用已经退出的线程上下文
+            Worker* worker = nullptr;
+            for(auto i : m_workers) {
+                if(i->state == Worker::RETIRED) {
+                    worker = i;
+                    break;
+                }
+            }
+            if(worker) {
+                Thread::ptr old = worker->runner;
+                old->join();
+                m_threads.erase(std::find(m_threads.begin(), m_threads.end(), old));
+                worker->state = Worker::ACTIVE;
+            } else if(m_workers.size() < m_workers.capacity()) {
+                worker = new Worker(this);
+                m_workers.push_back(worker);
+                m_workerCount.store(m_workers.size(), std::memory_order_release);
+            } else {
+                SYLAR_LOG_WARN(g_logger) << "scheduler " << m_name << " reached scheduler.max_threads="
+                    << m_workers.capacity();
+                break;
+            }
+            spawn(worker);
+            ++active;
+        }
+        //从最后加入的线程开始退休
+        for(size_t i = m_workers.size(); i > 0 && active > target; --i) {
+            Worker* worker = m_workers[i - 1];
+            if(worker == m_rootWorker || worker->state != Worker::ACTIVE) {
+                continue;
+            }
+            worker->state = Worker::RETIRING;
+            --active;
+            int thread = worker->thread;
+            if(thread != -1) {
+                tickle(thread);
+            }
+        }
+        SYLAR_LOG_INFO(g_logger) << "scheduler " << m_name << " thread count "
+            << m_threadCount + (m_rootFiber ? 1 : 0) << " -> " << active + (m_rootFiber ? 1 : 0);
+        m_threadCount = active;
+    }
+
+    size_t Scheduler::getThreadCount() const
+    {
+        return m_threadCount + (m_rootFiber ? 1 : 0);
+    }
+
+    void Scheduler::bindThreadCount(ConfigVar<uint32_t>::ptr var)
+    {
+        if(m_threadCountVar) {
+            m_threadCountVar->delListener(m_threadCountListener);
+        }
+        m_threadCountVar = var;
+        m_threadCountListener = var->addListener([this](const uint32_t& old_value, const uint32_t& new_value){
+            if(new_value > 0) {
+                setThreadCount(new_value);
+            }
+        });
+        if(var->getValue() > 0) {
+            setThreadCount(var->getValue());
+        }
+    }
+
+    bool Scheduler::canRetire()
+    {
+        Worker* worker = t_worker;
+        return worker && worker->scheduler == this
+            && worker->state == Worker::RETIRING
+            && worker->queue.empty()
+            && !worker->inboxCount
+            && !Fiber::GetSharedStackBound();
+    }
     void Scheduler::run()
     {
         SYLAR_LOG_DEBUG(g_logger) << m_name << " run";
@@ -132,100 +392,188 @@ namespace sylar{
         Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
         
         Fiber::ptr cb_fiber;
-        //创建一个待添加元素
-        FiberAndThread ft;
+        //工作线程在spawn时已经绑定了上下文，调用线程使用m_rootWorker
+        Worker* worker = t_worker;
+        if(!worker || worker->scheduler != this) {
+            worker = m_rootWorker;
+        }
+        SYLAR_ASSERT2(worker, "scheduler " << m_name << " not started");
+        worker->handle = pthread_self();
+        const int thread_id = sylar::GetThreadID();
+        worker->thread = thread_id;
+        t_worker = worker;
+        t_steal_seed = sylar::GetThreadID() * 2654435761u + 1;
+        if(m_watchdog) {
+            //backtrace第一次调用会加载libgcc，不能发生在信号处理函数里
+            void* frames[1];
+            backtrace(frames, 1);
+        }
+        //记录一次执行：计数，以及开启计时时的运行耗时
+        auto finish_slice = [worker](uint64_t start){
+            Bump(worker->executed);
+            worker->sliceStart.store(0, std::memory_order_relaxed);
+            if(start && s_scheduler_stats_timing) {
+                worker->runSlice.record(GetMonotonicUS() - start);
+            }
+        };
+        //记录开始执行的协程，给看门狗检查
+        auto begin_slice = [worker](Fiber* fiber, uint64_t start){
+            if(start) {
+                worker->sliceFiber.store(fiber->getId(), std::memory_order_relaxed);
+                worker->sliceEntry.store(&fiber->getEntry(), std::memory_order_relaxed);
+                worker->sliceStart.store(start, std::memory_order_release);
+            }
+        };
         set_hook_enable(true);
         while (true)
         {
-            ft.reset();
-            bool tickle_me = false;
-            bool is_active = false;
-            {
-                MutexType::Lock lock(m_mutex);
-                auto it = m_fibers.begin();
-                //找到一个可调度的协程
-                while(it != m_fibers.end())
-                {
-                    if(it->thread != -1 && it->thread != sylar::GetThreadID()){
-                        it++;
-                        tickle_me = true;
-                        continue;
-                    }
-                    SYLAR_ASSERT(it->fiber || it->cb);
-                    if(it->fiber && it->fiber->getState() == sylar::Fiber::EXEC){
-                        it++;
-                        continue;
-                    }
-                    ft = *it;
-                    m_fibers.erase(it++);
-                    ++m_activeThreadCount;
-                    is_active = true;
-                    break;
+            if(worker->state == Worker::RETIRING && !worker->queue.empty()) {
+                //退休中：本地队列的任务交给其他线程
+                bool need_tickle = false;
+                while(Task* task = worker->queue.pop()) {
+                    need_tickle = inject(task) || need_tickle;
+                }
+                if(need_tickle) {
+                    tickle();
                 }
-                //如果迭代器不等于end,证明取出了合适的ft
-                tickle_me |= it != m_fibers.end();
+            }
+            bool tickle_me = false;
+            //先计入活跃线程再取任务，stopping()不会在任务出队到开始执行之间误判为空闲
+            ++m_activeThreadCount;
+            Task* task = nextTask(worker, tickle_me);
+            if(!task) {
+                --m_activeThreadCount;
             }
             // 通知调度器？？？
             if(tickle_me){
                 tickle();
             }
+            uint64_t start = 0;
+            if(task && (s_scheduler_stats_timing || m_watchdog)) {
+                start = GetMonotonicUS();
+                if(task->enqueueTime && start >= task->enqueueTime) {
+                    worker->queueWait[task->priority].record(start - task->enqueueTime);
+                }
+            }
             //第一种情况：注册的是协程，确保切成状态不是终止或异常，启动协程
-            if(ft.fiber && (ft.fiber->getState() != Fiber::TERM
-                            && ft.fiber->getState() != Fiber::EXCEPT))
-            {
-                ft.fiber->swapIn(); //执行该协程
+            if(task && task->fiber) {
+                Fiber::ptr fiber;
+                fiber.swap(task->fiber);
+                Task::Free(task);
+                if(fiber->getState() == Fiber::TERM || fiber->getState() == Fiber::EXCEPT) {
+                    --m_activeThreadCount;
+                    continue;
+                }
+                begin_slice(fiber.get(), start);
+                fiber->m_lastThread = thread_id;
+                fiber->swapIn(); //执行该协程
                 --m_activeThreadCount;
+                finish_slice(start);
                 //协程执行结束后，根据协程状态，选择放入调度队列，或者结束执行
-                if(ft.fiber->getState() == Fiber::READY){
-                    schedule(ft.fiber);
+                if(fiber->getState() == Fiber::READY){
+                    yieldTask(fiber);
+                }
+                else if(fiber->getState() != Fiber::TERM
+                    && fiber->getState() != Fiber::EXCEPT){
+                    //HOLD的协程由持有它的一方(IO事件、定时器)负责重新调度
+                    fiber->m_state.store(Fiber::HOLD, std::memory_order_release);
                 }
-                else if(ft.fiber->getState() != Fiber::TERM
-                    && ft.fiber->getState() != Fiber::EXCEPT){
-                    ft.fiber->m_state = Fiber::HOLD;    
-                    schedule(ft.fiber);
+                else {
+                    //执行结束的协程放回协程池，给后续的回调复用
+                    Fiber::Recycle(std::move(fiber));
                 }
-                ft.reset();
             }
-            else if(ft.cb){
+            else if(task){
+                //回调留在任务节点里原地执行，包装函数只捕获一个指针，不会触发std::function的堆分配；
+                //栈统计和栈大小档位按真正的回调类型计算
+                const std::type_info* entry = &task->target_type();
+                std::function<void()> cb = [task](){
+                    struct Guard {
+                        ~Guard() { Task::Free(task); }
+                        Task* task;
+                    } guard = {task};
+                    task->invoke();
+                };
+                if(cb_fiber && cb_fiber->getStackSize() != Fiber::GetStackClass(*entry)) {
+                    //栈大小档位不同，不能复用
+                    cb_fiber.reset();
+                }
                 if(cb_fiber){
-                    cb_fiber->reset(ft.cb);
+                    cb_fiber->reset(cb, entry);
                 }else{
-                    cb_fiber.reset(new Fiber(ft.cb));
+                    cb_fiber = Fiber::Create(cb, entry);
                 }
-                ft.reset();
+                cb = nullptr;
+                begin_slice(cb_fiber.get(), start);
+                cb_fiber->m_lastThread = thread_id;
+                cb_fiber->m_priority = task->priority;
                 cb_fiber->swapIn(); // 调度当前协程
                 --m_activeThreadCount;
+                finish_slice(start);
                 if(cb_fiber->getState() == Fiber::READY){
-                    schedule(cb_fiber);
-                    cb_fiber.reset();
+                    yieldTask(cb_fiber);
                 }
                 else if (cb_fiber->getState() == Fiber::TERM || cb_fiber->getState() == Fiber::EXCEPT)
                 {
                     cb_fiber->reset(nullptr);
                 }
                 else{
-                    cb_fiber->m_state = Fiber::HOLD;
+                    cb_fiber->m_state.store(Fiber::HOLD, std::memory_order_release);
                     //schedule(cb_fiber); // 自行添加的代码
                     cb_fiber.reset();
                 }
             }
             else{
                 //未获取到可调度协程
-                if(is_active){
-                    --m_activeThreadCount;
-                    continue;
-                }
                 if(idle_fiber->getState() == Fiber::TERM){
+                    if(worker->state == Worker::RETIRING && !canRetire() && !stopping()) {
+                        //idle返回之后又有了指定给本线程的任务，排空之前不能退出
+                        idle_fiber->reset(std::bind(&Scheduler::idle, this));
+                        continue;
+                    }
                     SYLAR_LOG_INFO(g_logger) << "idle fiber term";
+                    t_worker = nullptr;
+                    if(worker->state != Worker::RETIRING) {
+                        //线程退出后不再按线程id找到它，亲和任务不会再投递过来
+                        worker->thread = -1;
+                    } else {
+                        //检查canRetire之后才放进收件箱的任务先交给其他线程，收件箱在锁里确认为空时才标记RETIRED：
+                        //标记之后setThreadCount可能持有m_mutex来join本线程，而inject也要取m_mutex
+                        while(true) {
+                            std::vector<Task*> left;
+                            {
+                                Mutex::Lock lock(worker->inboxMutex);
+                                while(Task* task = worker->inbox.pop_front()) {
+                                    --worker->inboxCount;
+                                    task->thread = -1;
+                                    left.push_back(task);
+                                }
+                                if(left.empty()) {
+                                    //之后按线程id找到它的任务在锁里看到RETIRED，交给任意线程
+                                    worker->state = Worker::RETIRED;
+                                    break;
+                                }
+                            }
+                            for(auto task : left) {
+                                if(inject(task)) {
+                                    tickle();
+                                }
+                            }
+                        }
+                        SYLAR_LOG_INFO(g_logger) << m_name << " worker retired";
+                    }
                     break;
                 }
                 ++m_idleThreadCount;
+                worker->idling.store(true, std::memory_order_relaxed);
                 idle_fiber->swapIn();
+                worker->idling.store(false, std::memory_order_relaxed);
                 --m_idleThreadCount;
+                Bump(worker->idleWakeups);
                 if(idle_fiber->getState() != Fiber::TERM
                         && idle_fiber->getState() != Fiber::EXCEPT) 
                 {
-                    idle_fiber->m_state = Fiber::HOLD;
+                    idle_fiber->m_state.store(Fiber::HOLD, std::memory_order_release);
                 }
             }
         }
@@ -233,19 +581,574 @@ namespace sylar{
     void Scheduler::idle()
     {
         SYLAR_LOG_INFO(g_logger) << "idle";
+        Worker* worker = GetWorker();
         while(!stopping()) {
+            if(canRetire()) {
+                return;
+            }
+            if(worker) {
+                park(worker);
+            }
             sylar::Fiber::YieldToHold();
         }
+        //唤醒是合并的，stop()不一定叫醒了所有线程，退出前叫醒下一个
+        tickle();
+    }
+
+    bool Scheduler::hasWork(Worker* worker)
+    {
+        return hasPendingTasks(worker) || stopping() || canRetire();
+    }
+
+    void Scheduler::park(Worker* worker)
+    {
+        for(uint32_t i = 0; i < s_scheduler_idle_spin; ++i) {
+            if(hasWork(worker)) {
+                return;
+            }
+            CpuRelax();
+        }
+        //先清通知、再标记睡眠、最后检查任务，和enqueue的"先放入再检查睡眠"配对，不会丢失唤醒
+        worker->notified = false;
+        worker->futex = 0;
+        worker->sleeping = true;
+        if(!hasWork(worker)) {
+            FutexWait(&worker->futex, 0);
+        }
+        worker->sleeping = false;
+    }
+
+    bool Scheduler::unpark(Worker* worker)
+    {
+        if(!worker->sleeping || worker->notified.exchange(true)) {
+            return false;
+        }
+        worker->futex = 1;
+        FutexWake(&worker->futex);
+        return true;
+    }
+
+    bool Scheduler::hasPendingTasks(Worker* worker)
+    {
+        if(worker->inboxCount) {
+            return true;
+        }
+        if(worker->state != Worker::ACTIVE) {
+            //退休中的线程只执行指定给它的任务
+            return false;
+        }
+        if(m_injectCount || m_highTasks.count || m_lowTasks.count) {
+            return true;
+        }
+        for(size_t n = workerCount(), idx = 0; idx < n; ++idx) {
+            Worker* i = m_workers[idx];
+            if(!i->queue.empty()) {
+                return true;
+            }
+        }
+        return false;
     }
 
     bool Scheduler::stopping()
+    {
+        if(!m_autoStop || !m_stopping || m_activeThreadCount != 0 || m_injectCount != 0
+                || m_highTasks.count != 0 || m_lowTasks.count != 0) {
+            return false;
+        }
+        for(size_t n = workerCount(), idx = 0; idx < n; ++idx) {
+            Worker* i = m_workers[idx];
+            if(!i->queue.empty() || i->inboxCount) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool Scheduler::enqueue(Task* task)
+    {
+        if(s_scheduler_stats_timing) {
+            task->enqueueTime = GetMonotonicUS();
+        }
+        Worker* worker = t_worker;
+        if(worker && worker->scheduler == this) {
+            Bump(worker->enqueued);
+        } else {
+            worker = nullptr;
+            m_externalEnqueued.fetch_add(1, std::memory_order_relaxed);
+        }
+        if(task->thread == -1 && task->fiber && task->fiber->getBindThread() != -1) {
+            //共享栈协程只能在绑定的线程上恢复
+            task->thread = task->fiber->getBindThread();
+        }
+        if(task->thread == -1 && task->priority != Fiber::PRIORITY_NORMAL) {
+            //高/低优先级任务不进本地队列，所有线程按优先级从全局队列取
+            return pushPriority(task);
+        }
+        if(task->thread == -1 && task->fiber && s_scheduler_cache_affinity) {
+            int prefer = task->fiber->getPreferredThread();
+            if(prefer != -1 && (!worker || prefer != worker->thread)) {
+                Worker* target = findWorker(prefer);
+                bool need_tickle = false;
+                if(target && enqueueAffine(target, task, need_tickle)) {
+                    return need_tickle;
+                }
+            }
+            //首选线程就是当前线程时放入本地队列，同样留在这个核上
+        }
+        if(task->thread != -1) {
+            Worker* target = findWorker(task->thread);
+            if(!target) {
+                if(task->thread != m_rootThread) {
+                    //不是本调度器的线程，或者线程已经退休、上下文被复用，任务交给任意线程
+                    task->thread = -1;
+                }
+                //调用线程在stop之前还没有进入run，由它从全局注入队列里取
+                return inject(task);
+            }
+            {
+                Mutex::Lock lock(target->inboxMutex);
+                if(target->state == Worker::RETIRED) {
+                    //目标线程已经退休，任务交给任意线程
+                    lock.unlock();
+                    task->thread = -1;
+                    return inject(task);
+                }
+                target->inbox.push_back(task);
+                ++target->inboxCount;
+            }
+            if(target != worker) {
+                tickle(task->thread);
+            }
+            return false;
+        }
+        if(!worker || worker->state != Worker::ACTIVE) {
+            return inject(task);
+        }
+        worker->queue.push(task);
+        return hasIdleThreads();
+    }
+
+    bool Scheduler::pushPriority(Task* task)
+    {
+        PriorityQueue& queue = task->priority == Fiber::PRIORITY_HIGH ? m_highTasks : m_lowTasks;
+        bool need_tickle = false;
+        {
+            Mutex::Lock lock(queue.mutex);
+            need_tickle = queue.tasks.empty();
+            queue.tasks.push_back(task);
+            ++queue.count;
+        }
+        return need_tickle || hasIdleThreads();
+    }
+
+    Task* Scheduler::takePriority(PriorityQueue& queue)
+    {
+        Mutex::Lock lock(queue.mutex);
+        Task* prev = nullptr;
+        for(Task* task = queue.tasks.front(); task; prev = task, task = task->next) {
+            if(task->fiber && task->fiber->getState() == Fiber::EXEC) {
+                continue;
+            }
+            queue.tasks.erase(prev, task);
+            --queue.count;
+            return task;
+        }
+        return nullptr;
+    }
+
+    bool Scheduler::enqueueAffine(Worker* target, Task* task, bool& need_tickle)
+    {
+        {
+            Mutex::Lock lock(target->inboxMutex);
+            if(target->state != Worker::ACTIVE) {
+                return false;
+            }
+            //thread保持-1，和指定线程的任务区分开，其他线程可以窃取
+            target->inbox.push_back(task);
+            ++target->inboxCount;
+        }
+        if(target->idling.load(std::memory_order_relaxed)) {
+            tickle(target->thread);
+            need_tickle = false;
+        } else {
+            //首选线程正忙，叫醒一个空闲线程来窃取
+            need_tickle = hasIdleThreads();
+        }
+        return true;
+    }
+
+    Scheduler::Worker* Scheduler::findWorker(int thread)
+    {
+        //线程数量不多，顺序查找比加锁的哈希表快
+        for(size_t n = workerCount(), idx = 0; idx < n; ++idx) {
+            Worker* i = m_workers[idx];
+            if(i->thread == thread) {
+                return i;
+            }
+        }
+        return nullptr;
+    }
+
+    Scheduler::Worker* Scheduler::GetWorker()
+    {
+        return t_worker;
+    }
+
+    Task* Scheduler::takePinned(Worker* worker)
+    {
+        Mutex::Lock lock(worker->inboxMutex);
+        Task* prev = nullptr;
+        for(Task* task = worker->inbox.front(); task; prev = task, task = task->next) {
+            //其他线程上的协程指定到本线程时，要等它真正切出
+            if(task->fiber && task->fiber->getState() == Fiber::EXEC) {
+                continue;
+            }
+            worker->inbox.erase(prev, task);
+            --worker->inboxCount;
+            if(task->thread == -1) {
+                Bump(worker->affine);
+            }
+            return task;
+        }
+        return nullptr;
+    }
+
+    Task* Scheduler::stealAffine(Worker* worker)
+    {
+        for(size_t n = workerCount(), idx = 0; idx < n; ++idx) {
+            Worker* victim = m_workers[idx];
+            //空闲的首选线程已经被唤醒，马上就会自己取走
+            if(victim == worker || !victim->inboxCount
+                    || victim->idling.load(std::memory_order_relaxed)) {
+                continue;
+            }
+            Mutex::Lock lock(victim->inboxMutex);
+            Task* prev = nullptr;
+            for(Task* task = victim->inbox.front(); task; prev = task, task = task->next) {
+                if(task->thread != -1
+                        || task->fiber->getState() == Fiber::EXEC) {
+                    continue;
+                }
+                victim->inbox.erase(prev, task);
+                --victim->inboxCount;
+                Bump(worker->stolen);
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    bool Scheduler::inject(Task* task)
     {
         MutexType::Lock lock(m_mutex);
-        return m_autoStop && m_stopping && m_fibers.empty() && m_activeThreadCount == 0;
+        bool need_tickle = m_fibers.empty();
+        m_fibers.push_back(task);
+        ++m_injectCount;
+        return need_tickle || hasIdleThreads();
+    }
+
+    void Scheduler::yieldTask(Fiber::ptr& fiber)
+    {
+        //主动让出的协程放到全局队列尾部，本地队列是LIFO，放回去会立刻又被取出来，饿死其他任务
+        int thread = fiber->getBindThread();
+        Task* task = Task::Alloc();
+        task->priority = fiber->getPriority();
+        task->fiber.swap(fiber);
+        task->thread = thread;
+        if(s_scheduler_stats_timing) {
+            task->enqueueTime = GetMonotonicUS();
+        }
+        Bump(t_worker->enqueued);
+        bool need_tickle = thread == -1 && task->priority != Fiber::PRIORITY_NORMAL
+                            ? pushPriority(task) : inject(task);
+        if(need_tickle) {
+            tickle();
+        }
+    }
+
+    bool Scheduler::runnable(Task* task)
+    {
+        //唤醒方可能在协程真正切出之前就把它放回了队列
+        if(task->fiber && task->fiber->getState() == Fiber::EXEC) {
+            inject(task);
+            return false;
+        }
+        return true;
+    }
+
+    Task* Scheduler::takeInjected(bool& tickle_me)
+    {
+        MutexType::Lock lock(m_mutex);
+        Task* prev = nullptr;
+        //找到一个可调度的协程
+        for(Task* task = m_fibers.front(); task; prev = task, task = task->next) {
+            if(task->thread != -1 && task->thread != sylar::GetThreadID()){
+                tickle_me = true;
+                continue;
+            }
+            SYLAR_ASSERT(task->fiber || task->hasCallback());
+            if(task->fiber && task->fiber->getState() == sylar::Fiber::EXEC){
+                continue;
+            }
+            m_fibers.erase(prev, task);
+            --m_injectCount;
+            //后面还有节点,证明还有其他任务
+            tickle_me |= (prev ? prev->next : m_fibers.front()) != nullptr;
+            return task;
+        }
+        return nullptr;
+    }
+
+    Task* Scheduler::nextTask(Worker* worker, bool& tickle_me)
+    {
+        //本地队列一直有任务时，定期先看一眼全局队列，避免外部提交的任务饿死
+        if(worker->inboxCount) {
+            if(Task* task = takePinned(worker)) {
+                return task;
+            }
+        }
+        if(worker->state != Worker::ACTIVE) {
+            //退休中的线程只执行指定给它的任务
+            return nullptr;
+        }
+        if(m_highTasks.count) {
+            if(Task* task = takePriority(m_highTasks)) {
+                tickle_me = m_highTasks.count && hasIdleThreads();
+                return task;
+            }
+        }
+        //低优先级任务按权重插入，为0时只在没有其他任务时执行
+        if(m_lowTasks.count && s_scheduler_low_priority_interval
+                && ++worker->lowTick % s_scheduler_low_priority_interval == 0) {
+            if(Task* task = takePriority(m_lowTasks)) {
+                return task;
+            }
+        }
+        bool inject_first = m_injectCount && ++worker->tick % 61 == 0;
+        if(inject_first) {
+            if(Task* task = takeInjected(tickle_me)) {
+                return task;
+            }
+        }
+        while(Task* task = worker->queue.pop()) {
+            if(runnable(task)) {
+                tickle_me = !worker->queue.empty() && hasIdleThreads();
+                return task;
+            }
+        }
+
+        if(!inject_first && m_injectCount) {
+            if(Task* task = takeInjected(tickle_me)) {
+                return task;
+            }
+        }
+
+        //从随机的起点开始依次窃取其他线程的队列
+        size_t n = workerCount();
+        t_steal_seed ^= t_steal_seed << 13;
+        t_steal_seed ^= t_steal_seed >> 17;
+        t_steal_seed ^= t_steal_seed << 5;
+        size_t start = t_steal_seed % n;
+        for(size_t i = 0; i < n; ++i) {
+            Worker* victim = m_workers[(start + i) % n];
+            if(victim == worker) {
+                continue;
+            }
+            Task* task = victim->queue.steal();
+            if(task && runnable(task)) {
+                Bump(worker->stolen);
+                tickle_me = !victim->queue.empty() && hasIdleThreads();
+                return task;
+            }
+        }
+        if(Task* task = stealAffine(worker)) {
+            return task;
+        }
+        if(m_lowTasks.count) {
+            if(Task* task = takePriority(m_lowTasks)) {
+                tickle_me = m_lowTasks.count && hasIdleThreads();
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    void Scheduler::watchdog()
+    {
+        while(true) {
+            uint64_t budget = s_scheduler_watchdog_budget * 1000ull;
+            //按预算的一半采样，超时最多晚半个预算被发现
+            uint64_t interval = std::min<uint64_t>(std::max<uint64_t>(budget / 2, 1000), 100000);
+            {
+                std::unique_lock<std::mutex> lock(m_watchdogMutex);
+                m_watchdogCond.wait_for(lock, std::chrono::microseconds(interval)
+                                        , [this](){ return m_watchdogStop; });
+                if(m_watchdogStop) {
+                    break;
+                }
+            }
+            if(!budget) {
+                continue;
+            }
+            uint64_t now = GetMonotonicUS();
+            for(size_t n = workerCount(), idx = 0; idx < n; ++idx) {
+                Worker* i = m_workers[idx];
+                uint64_t start = i->sliceStart.load(std::memory_order_acquire);
+                if(!start || now < start + budget || i->reportedSlice == start) {
+                    continue;
+                }
+                i->reportedSlice = start;
+                m_slowSlices.fetch_add(1, std::memory_order_relaxed);
+                reportSlowSlice(i, start, now);
+            }
+        }
+    }
+
+    void Scheduler::reportSlowSlice(Worker* worker, uint64_t start, uint64_t now)
+    {
+        uint64_t fiber_id = worker->sliceFiber.load(std::memory_order_relaxed);
+        const std::type_info* entry = worker->sliceEntry.load(std::memory_order_relaxed);
+        //让该线程在信号处理函数里记录自己的调用栈，协程已经切出时不输出
+        worker->backtraceReady = false;
+        std::string bt;
+        if(pthread_kill(worker->handle, WatchdogSignal()) == 0) {
+            for(int i = 0; i < 100 && !worker->backtraceReady; ++i) {
+                usleep(500);
+            }
+            if(worker->backtraceReady && worker->sliceStart.load(std::memory_order_acquire) == start) {
+                int size = worker->backtraceSize;
+                char** strings = backtrace_symbols(worker->backtrace, size);
+                if(strings) {
+                    std::stringstream ss;
+                    //跳过信号处理函数和信号跳板
+                    for(int i = 2; i < size; ++i) {
+                        ss << "    " << strings[i] << std::endl;
+                    }
+                    bt = ss.str();
+                    free(strings);
+                }
+            }
+        }
+        SYLAR_LOG_WARN(g_logger) << "scheduler " << m_name << " slow slice: thread="
+            << worker->thread << " fiber_id=" << fiber_id
+            << " entry=" << (entry ? Fiber::GetEntryName(*entry) : "unknown")
+            << " running=" << (now - start) / 1000 << "ms"
+            << " budget=" << s_scheduler_watchdog_budget << "ms"
+            << std::endl << bt;
+    }
+
+    void Scheduler::stopWatchdog()
+    {
+        if(!m_watchdog) {
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> lock(m_watchdogMutex);
+            m_watchdogStop = true;
+        }
+        m_watchdogCond.notify_all();
+        m_watchdog->join();
+        m_watchdog.reset();
+    }
+
+    void Scheduler::WatchdogHandler(int sig)
+    {
+        Worker* worker = t_worker;
+        if(!worker) {
+            return;
+        }
+        int saved = errno;
+        worker->backtraceSize = ::backtrace(worker->backtrace, sizeof(worker->backtrace) / sizeof(void*));
+        worker->backtraceReady = true;
+        errno = saved;
+    }
+
+    Scheduler::Stats Scheduler::getStats() const
+    {
+        Stats stats;
+        stats.enqueued = m_externalEnqueued.load(std::memory_order_relaxed);
+        stats.slowSlices = m_slowSlices.load(std::memory_order_relaxed);
+        for(size_t n = workerCount(), idx = 0; idx < n; ++idx) {
+            Worker* i = m_workers[idx];
+            stats.enqueued += i->enqueued.load(std::memory_order_relaxed);
+            stats.executed += i->executed.load(std::memory_order_relaxed);
+            stats.stolen += i->stolen.load(std::memory_order_relaxed);
+            stats.affine += i->affine.load(std::memory_order_relaxed);
+            stats.idleWakeups += i->idleWakeups.load(std::memory_order_relaxed);
+            for(int p = 0; p < Fiber::PRIORITY_COUNT; ++p) {
+                i->queueWait[p].snapshot(stats.queueWait);
+                i->queueWait[p].snapshot(stats.priorityQueueWait[p]);
+            }
+            i->runSlice.snapshot(stats.runSlice);
+        }
+        return stats;
+    }
+
+    static YAML::Node HistogramToYaml(const HistogramSnapshot& h)
+    {
+        YAML::Node node;
+        node["count"] = h.count;
+        node["avg_us"] = h.avg();
+        node["p50_us"] = h.percentile(0.5);
+        node["p99_us"] = h.percentile(0.99);
+        node["max_us"] = h.max;
+        for(int i = 0; i < HistogramSnapshot::BUCKETS; ++i) {
+            if(h.buckets[i]) {
+                node["histogram"][HistogramSnapshot::BucketName(i)] = h.buckets[i];
+            }
+        }
+        return node;
+    }
+
+    std::string Scheduler::Stats::toString() const
+    {
+        YAML::Node node;
+        node["enqueued"] = enqueued;
+        node["executed"] = executed;
+        node["stolen"] = stolen;
+        node["affine"] = affine;
+        node["idle_wakeups"] = idleWakeups;
+        node["slow_slices"] = slowSlices;
+        node["queue_wait"] = HistogramToYaml(queueWait);
+        static const char* s_priority_names[Fiber::PRIORITY_COUNT] = {"high", "normal", "low"};
+        for(int p = 0; p < Fiber::PRIORITY_COUNT; ++p) {
+            if(priorityQueueWait[p].count) {
+                node["queue_wait_by_priority"][s_priority_names[p]] = HistogramToYaml(priorityQueueWait[p]);
+            }
+        }
+        node["run_slice"] = HistogramToYaml(runSlice);
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
     }
 
     void Scheduler::tickle()
     {
-        SYLAR_LOG_INFO(g_logger) << "tickle";
+        //只叫醒一个睡眠的线程，它取到任务后如果还有剩余会继续唤醒下一个
+        unparkOne();
+    }
+
+    bool Scheduler::unparkOne()
+    {
+        //任务的写入和睡眠标记的读取之间需要全屏障，和park对称
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for(size_t n = workerCount(), idx = 0; idx < n; ++idx) {
+            Worker* i = m_workers[idx];
+            if(i->state == Worker::ACTIVE && unpark(i)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Scheduler::tickle(int thread)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        Worker* worker = findWorker(thread);
+        if(!worker) {
+            tickle();
+            return;
+        }
+        unpark(worker);
     }
 }
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include "../inc/task.h"
+#include "../inc/conf.h"
+#include "../inc/mutex.h"
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace sylar {
+    static ConfigVar<uint32_t>::ptr g_task_cache_size =
+        Config::Lookup<uint32_t>("scheduler.task_cache_size", 1024, "free task nodes cached per thread");
+
+    static uint32_t s_task_cache_size = 1024;
+
+    struct _TaskCacheIniter {
+        _TaskCacheIniter() {
+            s_task_cache_size = g_task_cache_size->getValue();
+            g_task_cache_size->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+                s_task_cache_size = new_value;
+            });
+        }
+    };
+    static _TaskCacheIniter s_task_cache_initer;
+
+    static ConfigVar<uint32_t>::ptr g_task_transfer_batches =
+        Config::Lookup<uint32_t>("scheduler.task_transfer_batches", 64
+                , "batches of free task nodes kept in the global transfer pool");
+
+    static uint32_t s_task_transfer_batches = 64;
+    static std::atomic<uint64_t> s_task_cache_misses{0};
+
+    struct _TaskTransferIniter {
+        _TaskTransferIniter() {
+            s_task_transfer_batches = g_task_transfer_batches->getValue();
+            g_task_transfer_batches->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+                s_task_transfer_batches = new_value;
+            });
+        }
+    };
+    static _TaskTransferIniter s_task_transfer_initer;
+
+    /**
+     * @brief 全局的空闲节点中转池
+     * @details 节点在执行完的线程释放：只提交不执行的线程(外部生产者)本地链表总是空的，
+     *          只执行不提交的工作线程本地链表总是满的。本地链表满了把一半节点整批交给中转池，
+     *          本地链表空了先从中转池整批取回，两边都只在批次粒度上加一次锁
+     */
+    struct TaskTransfer {
+        struct Batch {
+            Task* head;
+            uint32_t size;
+        };
+        Mutex mutex;
+        std::vector<Batch> batches;
+    };
+
+    //不析构：线程可能在静态对象析构之后才退出并归还节点
+    static TaskTransfer& GetTaskTransfer() {
+        static TaskTransfer* s_transfer = new TaskTransfer;
+        return *s_transfer;
+    }
+
+    static void DeleteList(Task* head) {
+        while(head) {
+            Task* task = head;
+            head = task->next;
+            delete task;
+        }
+    }
+
+    /**
+     * @brief 把一批节点放进中转池，中转池满时直接释放
+     */
+    static void PutBatch(Task* head, uint32_t size) {
+        TaskTransfer& transfer = GetTaskTransfer();
+        {
+            Mutex::Lock lock(transfer.mutex);
+            if(transfer.batches.size() < s_task_transfer_batches) {
+                transfer.batches.push_back(TaskTransfer::Batch{head, size});
+                return;
+            }
+        }
+        DeleteList(head);
+    }
+
+    /**
+     * @brief 从中转池取一批节点，没有时返回nullptr
+     */
+    static Task* GetBatch(uint32_t& size) {
+        TaskTransfer& transfer = GetTaskTransfer();
+        Mutex::Lock lock(transfer.mutex);
+        if(transfer.batches.empty()) {
+            return nullptr;
+        }
+        TaskTransfer::Batch batch = transfer.batches.back();
+        transfer.batches.pop_back();
+        size = batch.size;
+        return batch.head;
+    }
+
+    /**
+     * @brief 线程本地的空闲任务节点
+     * @details 节点在哪个线程执行完就放回哪个线程，多出来的和缺少的节点通过TaskTransfer在线程间流转
+     */
+    struct TaskCache {
+        ~TaskCache();
+        Task* head = nullptr;
+        uint32_t size = 0;
+    };
+    static thread_local TaskCache t_task_cache;
+    //线程退出时t_task_cache可能先于任务释放，此后直接delete
+    static thread_local bool t_task_cache_dead = false;
+
+    TaskCache::~TaskCache() {
+        t_task_cache_dead = true;
+        //退出线程的节点交给中转池，留给还在提交任务的线程
+        if(head) {
+            PutBatch(head, size);
+        }
+        head = nullptr;
+        size = 0;
+    }
+
+    Task* Task::Alloc()
+    {
+        TaskCache& cache = t_task_cache;
+        if(!cache.head && !t_task_cache_dead) {
+            cache.head = GetBatch(cache.size);
+        }
+        if(cache.head) {
+            Task* task = cache.head;
+            cache.head = task->next;
+            task->next = nullptr;
+            --cache.size;
+            return task;
+        }
+        s_task_cache_misses.fetch_add(1, std::memory_order_relaxed);
+        return new Task;
+    }
+
+    void Task::Free(Task* task)
+    {
+        task->clear();
+        if(t_task_cache_dead || s_task_cache_size == 0) {
+            delete task;
+            return;
+        }
+        TaskCache& cache = t_task_cache;
+        if(cache.size >= s_task_cache_size) {
+            //本地链表满了，把前一半整批交出去
+            uint32_t batch = std::max<uint32_t>(cache.size / 2, 1);
+            Task* head = cache.head;
+            Task* tail = head;
+            for(uint32_t i = 1; i < batch; ++i) {
+                tail = tail->next;
+            }
+            cache.head = tail->next;
+            cache.size -= batch;
+            tail->next = nullptr;
+            PutBatch(head, batch);
+        }
+        task->next = cache.head;
+        cache.head = task;
+        ++cache.size;
+    }
+
+    uint64_t Task::CacheMisses()
+    {
+        return s_task_cache_misses;
+    }
+}
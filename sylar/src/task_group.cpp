@@ -0,0 +1,141 @@
+#include "../inc/task_group.h"
+#include "../inc/fiber.h"
+#include "../inc/macro.h"
+
+namespace sylar{
+    /// 当前协程所在的任务组，子任务结束时恢复，不需要析构函数
+    static size_t s_group_slot = Fiber::AllocLocalSlot(nullptr);
+
+    WaitGroup::~WaitGroup()
+    {
+        SYLAR_ASSERT(m_count == 0);
+    }
+
+    void WaitGroup::add(int64_t n)
+    {
+        FutureState<void>::ptr state;
+        {
+            MutexType::Lock lock(m_mutex);
+            int64_t old = m_count;
+            m_count += n;
+            SYLAR_ASSERT2(m_count >= 0, "WaitGroup count negative");
+            if(old == 0 && m_count > 0) {
+                m_state = std::make_shared<FutureState<void> >();
+            } else if(old > 0 && m_count == 0) {
+                state.swap(m_state);
+            }
+        }
+        //在锁外唤醒，被唤醒的等待者可以立即析构WaitGroup
+        if(state) {
+            state->setValue();
+        }
+    }
+
+    bool WaitGroup::wait(uint64_t timeout_ms)
+    {
+        //挂起期间done()会写到别的协程的栈上
+        SYLAR_ASSERT2(!Fiber::OnSharedStack(this), "WaitGroup on the waiting fiber's shared stack");
+        FutureState<void>::ptr state;
+        {
+            MutexType::Lock lock(m_mutex);
+            if(m_count == 0) {
+                return true;
+            }
+            state = m_state;
+        }
+        return state->wait(timeout_ms);
+    }
+
+    int64_t WaitGroup::count()
+    {
+        MutexType::Lock lock(m_mutex);
+        return m_count;
+    }
+
+    TaskGroupError::TaskGroupError(const std::vector<std::exception_ptr>& errors)
+        :std::runtime_error(std::to_string(errors.size()) + " task(s) in group failed")
+        ,m_errors(errors) {
+    }
+
+    TaskGroup::TaskGroup(Scheduler* scheduler, bool cancel_on_error)
+        :m_scheduler(scheduler ? scheduler : Scheduler::GetThis())
+        ,m_parent(Current())
+        ,m_cancelOnError(cancel_on_error) {
+        SYLAR_ASSERT2(m_scheduler, "TaskGroup needs a scheduler");
+    }
+
+    TaskGroup::~TaskGroup()
+    {
+        m_wait.wait();
+    }
+
+    bool TaskGroup::wait(uint64_t timeout_ms)
+    {
+        //子任务结束时通过指针访问任务组，任务组不能在挂起的共享栈上
+        SYLAR_ASSERT2(!Fiber::OnSharedStack(this), "TaskGroup on the waiting fiber's shared stack");
+        return m_wait.wait(timeout_ms);
+    }
+
+    void TaskGroup::join()
+    {
+        m_wait.wait();
+        MutexType::Lock lock(m_mutex);
+        if(!m_errors.empty()) {
+            throw TaskGroupError(m_errors);
+        }
+    }
+
+    bool TaskGroup::isCancelled() const
+    {
+        for(const TaskGroup* g = this; g; g = g->m_parent) {
+            if(g->m_cancelled.load(std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<std::exception_ptr> TaskGroup::errors()
+    {
+        MutexType::Lock lock(m_mutex);
+        return m_errors;
+    }
+
+    TaskGroup* TaskGroup::Current()
+    {
+        return static_cast<TaskGroup*>(Fiber::GetLocal(s_group_slot));
+    }
+
+    bool TaskGroup::Cancelled()
+    {
+        TaskGroup* g = Current();
+        return g && g->isCancelled();
+    }
+
+    bool TaskGroup::enter(TaskGroup*& prev)
+    {
+        if(isCancelled()) {
+            return false;
+        }
+        //子任务的协程来自协程池，原来的值一定为空，但子任务可能是被直接调用的
+        prev = Current();
+        Fiber::SetLocal(s_group_slot, this);
+        return true;
+    }
+
+    void TaskGroup::leave(TaskGroup* prev)
+    {
+        Fiber::SetLocal(s_group_slot, prev);
+    }
+
+    void TaskGroup::onError(std::exception_ptr ex)
+    {
+        {
+            MutexType::Lock lock(m_mutex);
+            m_errors.push_back(ex);
+        }
+        if(m_cancelOnError) {
+            cancel();
+        }
+    }
+}
@@ -23,10 +23,12 @@ namespace sylar{
         }
         return lhs.get() < rhs.get();
     }
-    Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager)
+    Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager
+                , Fiber::Priority priority)
     : m_ms(ms),
       m_cb(cb),
       m_recurring(recurring),
+      m_priority(priority),
       m_manager(manager)
     {
         m_next = sylar::GetCurrentMS() + m_ms;
@@ -96,10 +98,11 @@ namespace sylar{
     /// @param ms 执行周期
     /// @param cb 回调函数
     /// @param recurring 是否循环
+    /// @param priority 回调的调度优先级
     /// @return 智能指针
     Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb
-                                    ,bool recurring) {
-        Timer::ptr timer(new Timer(ms, cb, recurring, this));
+                                    ,bool recurring, Fiber::Priority priority) {
+        Timer::ptr timer(new Timer(ms, cb, recurring, this, priority));
         RWMutexType::WriteLock lock(m_mutex);
         addTimer(timer, lock);
         return timer;
@@ -114,8 +117,8 @@ namespace sylar{
     /// @brief 实现绑定一个变量，变量有效时，才执行该定时器
     Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb
                                         ,std::weak_ptr<void> weak_cond
-                                        ,bool recurring) {
-        return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
+                                        ,bool recurring, Fiber::Priority priority) {
+        return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring, priority);
     }
 
     uint64_t TimerManager::getNextTimer() {
@@ -135,6 +138,12 @@ namespace sylar{
     }
     
     void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
+        std::vector<Fiber::Priority> priorities;
+        listExpiredCb(cbs, priorities);
+    }
+
+    void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs
+                                    ,std::vector<Fiber::Priority>& priorities) {
         uint64_t now_ms = sylar::GetCurrentMS();
         std::vector<Timer::ptr> expired;
         {
@@ -160,9 +169,11 @@ namespace sylar{
         expired.insert(expired.begin(), m_timers.begin(), it);
         m_timers.erase(m_timers.begin(), it);
         cbs.reserve(expired.size());
+        priorities.reserve(expired.size());
 
         for(auto& timer : expired) {
             cbs.push_back(timer->m_cb);
+            priorities.push_back(timer->m_priority);
             if(timer->m_recurring) {
                 timer->m_next = now_ms + timer->m_ms;
                 m_timers.insert(timer);
@@ -0,0 +1,114 @@
+#include "../inc/uring.h"
+#include "../inc/sylar.h"
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace sylar{
+    static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+    IoUring::~IoUring()
+    {
+        if(m_sqes) {
+            munmap(m_sqes, m_sqesSize);
+        }
+        if(m_ring) {
+            munmap(m_ring, m_ringSize);
+        }
+        if(m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+    bool IoUring::init(uint32_t entries)
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        m_fd = syscall(__NR_io_uring_setup, entries, &p);
+        if(m_fd < 0) {
+            SYLAR_LOG_WARN(g_logger) << "io_uring_setup(" << entries << ") errno="
+                << errno << " (" << strerror(errno) << ")";
+            return false;
+        }
+        //带超时的等待(5.11)，同时意味着单次映射、不丢弃完成事件等更早的特性都可用
+        if(!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+            SYLAR_LOG_WARN(g_logger) << "io_uring features=" << p.features << " not supported";
+            return false;
+        }
+        size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+        size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        m_ringSize = sq_size > cq_size ? sq_size : cq_size;
+        void* ring = mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE
+                        , MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+        if(ring == MAP_FAILED) {
+            SYLAR_LOG_WARN(g_logger) << "mmap io_uring ring errno=" << errno;
+            return false;
+        }
+        m_ring = ring;
+        m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE
+                        , MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+        if(sqes == MAP_FAILED) {
+            SYLAR_LOG_WARN(g_logger) << "mmap io_uring sqes errno=" << errno;
+            return false;
+        }
+        m_sqes = (io_uring_sqe*)sqes;
+
+        char* base = (char*)m_ring;
+        m_sqHead = (uint32_t*)(base + p.sq_off.head);
+        m_sqTail = (uint32_t*)(base + p.sq_off.tail);
+        m_sqMask = *(uint32_t*)(base + p.sq_off.ring_mask);
+        m_sqEntries = p.sq_entries;
+        m_sqLocalTail = *m_sqTail;
+        //提交项和数组下标一一对应，之后不再修改
+        uint32_t* array = (uint32_t*)(base + p.sq_off.array);
+        for(uint32_t i = 0; i < m_sqEntries; ++i) {
+            array[i] = i;
+        }
+        m_cqHead = (uint32_t*)(base + p.cq_off.head);
+        m_cqTail = (uint32_t*)(base + p.cq_off.tail);
+        m_cqMask = *(uint32_t*)(base + p.cq_off.ring_mask);
+        m_cqes = (io_uring_cqe*)(base + p.cq_off.cqes);
+        return true;
+    }
+
+    io_uring_sqe* IoUring::getSqe()
+    {
+        uint32_t head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        if(m_sqLocalTail - head >= m_sqEntries) {
+            return nullptr;
+        }
+        io_uring_sqe* sqe = &m_sqes[m_sqLocalTail & m_sqMask];
+        ++m_sqLocalTail;
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    void IoUring::publish()
+    {
+        __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+    }
+
+    int IoUring::enter(uint32_t to_submit, uint32_t min_complete, uint64_t timeout_ms)
+    {
+        unsigned flags = 0;
+        if(min_complete) {
+            flags |= IORING_ENTER_GETEVENTS;
+        }
+        if(!min_complete || timeout_ms == ~0ull) {
+            return syscall(__NR_io_uring_enter, m_fd, to_submit, min_complete, flags, nullptr, 0);
+        }
+        __kernel_timespec ts;
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+        io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (uint64_t)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        return syscall(__NR_io_uring_enter, m_fd, to_submit, min_complete, flags, &arg, sizeof(arg));
+    }
+}
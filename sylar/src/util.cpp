@@ -45,4 +45,11 @@ namespace sylar{
         gettimeofday(&tv, NULL);
         return tv.tv_sec * 1000ul  + tv.tv_usec / 1000;
     }
+
+    uint64_t GetMonotonicUS()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,97 @@
+#include "../sylar/inc/sylar.h"
+#include <set>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::ConfigVar<bool>::ptr g_cache_affinity =
+    sylar::Config::Lookup<bool>("scheduler.cache_affinity", true);
+
+static sylar::Mutex s_mutex;
+static std::set<int> s_threads;
+static std::atomic<bool> s_done{false};
+
+/**
+ * @brief 一组协程反复睡眠，统计被唤醒后换了线程的次数
+ */
+uint64_t count_migrations(bool affinity) {
+    g_cache_affinity->setValue(affinity);
+    std::atomic<uint64_t> migrations{0};
+    sylar::TaskGroup group;
+    for(int i = 0; i < 8; ++i) {
+        group.spawn([&migrations](){
+            for(int j = 0; j < 50; ++j) {
+                int before = sylar::GetThreadID();
+                usleep(1000);
+                int after = sylar::GetThreadID();
+                if(before != after) {
+                    ++migrations;
+                }
+                sylar::Mutex::Lock lock(s_mutex);
+                s_threads.insert(after);
+            }
+        });
+    }
+    group.join();
+    SYLAR_LOG_INFO(g_logger) << "cache_affinity=" << affinity
+                << " migrations=" << migrations << "/400";
+    return migrations;
+}
+
+/**
+ * @brief 亲和提示指定的线程空闲时，协程每次都在该线程恢复
+ */
+void test_hint() {
+    int target = -1;
+    {
+        sylar::Mutex::Lock lock(s_mutex);
+        for(auto i : s_threads) {
+            if(i != sylar::GetThreadID()) {
+                target = i;
+                break;
+            }
+        }
+    }
+    SYLAR_ASSERT(target != -1);
+    std::atomic<int> hits{0};
+    sylar::TaskGroup group;
+    group.spawn([target, &hits](){
+        sylar::Fiber::GetThis()->setAffinity(target);
+        for(int i = 0; i < 20; ++i) {
+            usleep(1000);
+            if(sylar::GetThreadID() == target) {
+                ++hits;
+            }
+        }
+        //没有偏好时照常调度
+        sylar::Fiber::GetThis()->setAffinity(sylar::Fiber::AFFINITY_ANY);
+        SYLAR_ASSERT(sylar::Fiber::GetThis()->getPreferredThread() == -1);
+        usleep(1000);
+    });
+    group.join();
+    SYLAR_LOG_INFO(g_logger) << "hint target=" << target << " hits=" << hits << "/20";
+    SYLAR_ASSERT(hits >= 18);
+}
+
+void run() {
+    uint64_t off = count_migrations(false);
+    uint64_t on = count_migrations(true);
+    SYLAR_ASSERT(on < off);
+    test_hint();
+    g_cache_affinity->setValue(true);
+    sylar::Scheduler::Stats stats = sylar::Scheduler::GetThis()->getStats();
+    SYLAR_LOG_INFO(g_logger) << "affine=" << stats.affine << " stolen=" << stats.stolen;
+    SYLAR_ASSERT(stats.affine > 0);
+    SYLAR_LOG_INFO(g_logger) << "affinity test ok";
+    s_done = true;
+}
+
+int main(int argc, char** argv) {
+    sylar::LoggerMgr::GetInstance()->getLogger("system")->setLevel(sylar::LogLevel::WARN);
+    sylar::IOManager iom(4, false, "affinity");
+    iom.schedule(&run);
+    //停止中的调度器会让空闲线程提前退出，测试结束前保持线程数不变
+    while(!s_done) {
+        usleep(10 * 1000);
+    }
+    return 0;
+}
@@ -0,0 +1,242 @@
+#include "../sylar/inc/sylar.h"
+#include "../sylar/inc/hook.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <thread>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::ConfigVar<bool>::ptr g_persistent =
+    sylar::Config::Lookup<bool>("iomanager.epoll_persistent", false);
+
+/// 统计IOManager调用epoll_ctl的次数
+static std::atomic<uint64_t> s_epoll_ctl{0};
+
+extern "C" int epoll_ctl(int epfd, int op, int fd, struct epoll_event* event) {
+    ++s_epoll_ctl;
+    return syscall(SYS_epoll_ctl, epfd, op, fd, event);
+}
+
+static void make_pair(int fds[2]) {
+    int rt = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    SYLAR_ASSERT(!rt);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+}
+
+/**
+ * @brief 长连接上的请求-响应，返回每个请求的epoll_ctl次数
+ */
+double keep_alive(bool persistent, int requests) {
+    g_persistent->setValue(persistent);
+    int fds[2];
+    make_pair(fds);
+    uint64_t before = 0;
+    uint64_t begin = sylar::GetCurrentMS();
+    {
+        sylar::IOManager iom(2, false, "keep_alive");
+        SYLAR_ASSERT(iom.isPersistent() == persistent);
+        before = s_epoll_ctl;
+        int client = fds[0];
+        int server = fds[1];
+        iom.schedule([&iom, client, requests](){
+            for(int i = 0; i < requests; ++i) {
+                SYLAR_ASSERT(iom.send(client, &i, sizeof(i), 0) == sizeof(i));
+                int v = -1;
+                SYLAR_ASSERT(iom.recv(client, &v, sizeof(v), 0) == sizeof(v));
+                SYLAR_ASSERT(v == i);
+            }
+            iom.cancelAll(client);
+        });
+        iom.schedule([&iom, server, requests](){
+            for(int i = 0; i < requests; ++i) {
+                int v = -1;
+                SYLAR_ASSERT(iom.recv(server, &v, sizeof(v), 0) == sizeof(v));
+                SYLAR_ASSERT(iom.send(server, &v, sizeof(v), 0) == sizeof(v));
+            }
+            iom.cancelAll(server);
+        });
+    }
+    uint64_t calls = s_epoll_ctl - before;
+    uint64_t cost = sylar::GetCurrentMS() - begin;
+    close(fds[0]);
+    close(fds[1]);
+    SYLAR_LOG_INFO(g_logger) << "keep alive persistent=" << persistent << " requests=" << requests
+                << " epoll_ctl=" << calls << " cost=" << cost << "ms";
+    g_persistent->setValue(false);
+    return (double)calls / requests;
+}
+
+/**
+ * @brief 没有等待者时到达的就绪事件被记下，之后的等待者立即恢复，不调用epoll_ctl
+ */
+void test_cached_ready() {
+    sylar::IOManager& iom = *sylar::IOManager::GetThis();
+    SYLAR_ASSERT(iom.isPersistent());
+    int fds[2];
+    make_pair(fds);
+    std::atomic<int> fired{0};
+    iom.addEvent(fds[0], sylar::IOManager::READ, [&fired](){ ++fired; });
+    SYLAR_ASSERT(write(fds[1], "a", 1) == 1);
+    usleep(20 * 1000);
+    SYLAR_ASSERT(fired == 1);
+
+    //数据到达时没有等待者
+    SYLAR_ASSERT(write(fds[1], "b", 1) == 1);
+    usleep(20 * 1000);
+    uint64_t before = s_epoll_ctl;
+    iom.addEvent(fds[0], sylar::IOManager::READ, [&fired](){ ++fired; });
+    usleep(20 * 1000);
+    SYLAR_ASSERT(fired == 2);
+    SYLAR_ASSERT(s_epoll_ctl == before);
+
+    //就绪标记用掉之后重新等待下一次就绪
+    iom.addEvent(fds[0], sylar::IOManager::READ, [&fired](){ ++fired; });
+    usleep(20 * 1000);
+    SYLAR_ASSERT(fired == 2);
+    SYLAR_ASSERT(write(fds[1], "c", 1) == 1);
+    usleep(20 * 1000);
+    SYLAR_ASSERT(fired == 3);
+
+    //关闭前注销，fd号复用后重新注册
+    int old = fds[0];
+    iom.cancelAll(fds[0]);
+    iom.cancelAll(fds[1]);
+    close(fds[0]);
+    close(fds[1]);
+    make_pair(fds);
+    SYLAR_ASSERT(fds[0] == old || fds[1] == old);
+    iom.addEvent(old, sylar::IOManager::READ, [&fired](){ ++fired; });
+    SYLAR_ASSERT(write(old == fds[0] ? fds[1] : fds[0], "d", 1) == 1);
+    usleep(20 * 1000);
+    SYLAR_ASSERT(fired == 4);
+    iom.cancelAll(fds[0]);
+    iom.cancelAll(fds[1]);
+    close(fds[0]);
+    close(fds[1]);
+    SYLAR_LOG_INFO(g_logger) << "cached ready ok";
+}
+
+/**
+ * @brief 没有调用cancelAll就关闭fd，同一个fd号复用后仍然能等到事件
+ */
+void test_close_reuse() {
+    sylar::IOManager& iom = *sylar::IOManager::GetThis();
+    SYLAR_ASSERT(iom.isPersistent());
+    std::atomic<int> fired{0};
+    int fds[2];
+    make_pair(fds);
+    for(int round = 0; round < 2; ++round) {
+        iom.addEvent(fds[0], sylar::IOManager::READ, [&fired](){ ++fired; });
+        SYLAR_ASSERT(write(fds[1], "a", 1) == 1);
+        usleep(20 * 1000);
+        SYLAR_ASSERT(fired == round * 2 + 1);
+        //只剩持久注册，没有等待者
+        int old = fds[0];
+        if(round == 0) {
+            //hook的close：当前IOManager注销
+            close(fds[0]);
+        } else {
+            //在没有IOManager的线程里关闭：FdManager::del清除过时的注册状态
+            std::thread t([old](){
+                sylar::set_hook_enable(true);
+                close(old);
+            });
+            t.join();
+        }
+        close(fds[1]);
+        make_pair(fds);
+        SYLAR_ASSERT(fds[0] == old || fds[1] == old);
+        if(fds[0] != old) {
+            std::swap(fds[0], fds[1]);
+        }
+        iom.addEvent(fds[0], sylar::IOManager::READ, [&fired](){ ++fired; });
+        SYLAR_ASSERT(write(fds[1], "b", 1) == 1);
+        usleep(20 * 1000);
+        SYLAR_ASSERT(fired == round * 2 + 2);
+        char buf[4];
+        SYLAR_ASSERT(read(fds[0], buf, sizeof(buf)) == 1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    SYLAR_LOG_INFO(g_logger) << "close reuse ok";
+}
+
+/**
+ * @brief 在另一个IOManager里关闭有等待者的fd：等待者被唤醒，注册被注销，fd号复用后可以重新等待
+ */
+void test_close_other_iom() {
+    g_persistent->setValue(true);
+    sylar::IOManager waiter_iom(1, false, "waiter");
+    sylar::IOManager closer_iom(1, false, "closer");
+    SYLAR_ASSERT(waiter_iom.isPersistent());
+    int fds[2];
+    make_pair(fds);
+    int fd = fds[0];
+    std::atomic<bool> woke{false};
+    std::atomic<ssize_t> result{0};
+    waiter_iom.schedule([&waiter_iom, fd, &woke, &result](){
+        char c;
+        result = waiter_iom.recv(fd, &c, 1, 0);
+        woke = true;
+    });
+    usleep(50 * 1000);
+    SYLAR_ASSERT(!woke);
+    std::atomic<bool> closed{false};
+    closer_iom.schedule([fd, &closed](){
+        close(fd);
+        closed = true;
+    });
+    for(int i = 0; i < 100 && !woke; ++i) {
+        usleep(10 * 1000);
+    }
+    SYLAR_ASSERT(closed);
+    SYLAR_ASSERT(woke);
+    SYLAR_ASSERT(result == -1);
+
+    //同一个fd号复用后，原来的IOManager重新注册
+    close(fds[1]);
+    make_pair(fds);
+    SYLAR_ASSERT(fds[0] == fd || fds[1] == fd);
+    int peer = fds[0] == fd ? fds[1] : fds[0];
+    std::atomic<int> fired{0};
+    waiter_iom.schedule([&waiter_iom, fd, &fired](){
+        waiter_iom.addEvent(fd, sylar::IOManager::READ, [&fired](){ ++fired; });
+    });
+    usleep(20 * 1000);
+    SYLAR_ASSERT(write(peer, "a", 1) == 1);
+    for(int i = 0; i < 100 && !fired; ++i) {
+        usleep(10 * 1000);
+    }
+    SYLAR_ASSERT(fired == 1);
+    waiter_iom.schedule([fds](){
+        close(fds[0]);
+        close(fds[1]);
+    });
+    g_persistent->setValue(false);
+    SYLAR_LOG_INFO(g_logger) << "close on other iomanager ok";
+}
+
+int main(int argc, char** argv) {
+    sylar::LoggerMgr::GetInstance()->getLogger("system")->setLevel(sylar::LogLevel::WARN);
+    int requests = argc > 1 ? atoi(argv[1]) : 20000;
+    double per_request = keep_alive(false, requests);
+    double persistent = keep_alive(true, requests);
+    SYLAR_LOG_INFO(g_logger) << "epoll_ctl per request: default=" << per_request
+                << " persistent=" << persistent;
+    SYLAR_ASSERT(persistent * requests <= 4);
+    g_persistent->setValue(true);
+    {
+        sylar::IOManager iom(1, false, "cached");
+        //两个用例都依赖fd号复用，依次执行
+        iom.schedule([](){
+            test_cached_ready();
+            test_close_reuse();
+        });
+    }
+    g_persistent->setValue(false);
+    test_close_other_iom();
+    SYLAR_LOG_INFO(g_logger) << "epoll persistent test ok";
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include "../sylar/inc/sylar.h"
+#include "../sylar/inc/fd_manager.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief socket属性：创建时初始化，删除后不可见，fd号复用时重新初始化
+ */
+void test_lifecycle() {
+    sylar::FdManager* mgr = sylar::FdMgr::GetInstance();
+    int fds[2];
+    SYLAR_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    SYLAR_ASSERT(!mgr->get(fds[0]));
+    sylar::FdCtx* ctx = mgr->get(fds[0], true);
+    SYLAR_ASSERT(ctx && ctx->getFd() == fds[0]);
+    SYLAR_ASSERT(((uintptr_t)ctx & 63) == 0);
+    SYLAR_ASSERT(ctx->isInit() && ctx->isSocket() && ctx->getSysNonBlock() && !ctx->isClose());
+    SYLAR_ASSERT(fcntl(fds[0], F_GETFL) & O_NONBLOCK);
+    SYLAR_ASSERT(mgr->get(fds[0]) == ctx && mgr->get(fds[0], true) == ctx);
+    ctx->setTimeOut(SO_RCVTIMEO, 100);
+    SYLAR_ASSERT(ctx->getTimeOut(SO_RCVTIMEO) == 100);
+
+    mgr->del(fds[0]);
+    SYLAR_ASSERT(!mgr->get(fds[0]));
+    close(fds[0]);
+    //fd号复用：同一个对象，属性重新初始化
+    int fd = open("/dev/null", O_RDONLY);
+    SYLAR_ASSERT(fd == fds[0]);
+    SYLAR_ASSERT(mgr->get(fd, true) == ctx);
+    SYLAR_ASSERT(ctx->isInit() && !ctx->isSocket() && !ctx->getSysNonBlock());
+    SYLAR_ASSERT(ctx->getTimeOut(SO_RCVTIMEO) == (uint64_t)-1);
+    mgr->del(fd);
+    close(fd);
+    close(fds[1]);
+    SYLAR_LOG_INFO(g_logger) << "lifecycle ok";
+}
+
+/**
+ * @brief IOManager的事件等待状态和socket属性在同一个对象里
+ */
+void test_shared_record() {
+    sylar::FdManager* mgr = sylar::FdMgr::GetInstance();
+    int fds[2];
+    SYLAR_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    sylar::FdCtx* ctx = mgr->get(fds[0], true);
+    std::atomic<int> fired{0};
+    {
+        sylar::IOManager iom(1, false, "record");
+        sylar::IOManager other(1, false, "other");
+        iom.schedule([&iom, &other, &fired, ctx, fds](){
+            SYLAR_ASSERT(!iom.addEvent(ctx, sylar::IOManager::READ, [&fired](){ ++fired; }));
+            {
+                sylar::FdCtx::MutexType::Lock lock(ctx->mutex);
+                SYLAR_ASSERT(ctx->events == sylar::IOManager::READ && ctx->iom == &iom);
+            }
+            //另一个IOManager不能同时等待，也不能删除
+            SYLAR_ASSERT(other.addEvent(fds[0], sylar::IOManager::WRITE) == -1);
+            SYLAR_ASSERT(!other.cancelEvent(fds[0], sylar::IOManager::READ));
+            SYLAR_ASSERT(write(fds[1], "x", 1) == 1);
+        });
+        uint64_t begin = sylar::GetCurrentMS();
+        while(fired != 1) {
+            SYLAR_ASSERT(sylar::GetCurrentMS() - begin < 5000);
+            usleep(1000);
+        }
+        //等待结束后另一个IOManager可以接管
+        other.schedule([&other, &fired, fds](){
+            SYLAR_ASSERT(!other.addEvent(fds[0], sylar::IOManager::READ, [&fired](){ ++fired; }));
+            SYLAR_ASSERT(other.cancelEvent(fds[0], sylar::IOManager::READ));
+        });
+    }
+    SYLAR_ASSERT(fired == 2);
+    mgr->del(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+    SYLAR_LOG_INFO(g_logger) << "shared record ok";
+}
+
+/**
+ * @brief 多个线程同时查找，不加锁、不增减引用计数
+ */
+void bench_lookup(int threads, int lookups) {
+    sylar::FdManager* mgr = sylar::FdMgr::GetInstance();
+    std::vector<int> fds;
+    for(int i = 0; i < 64; ++i) {
+        int fd = open("/dev/null", O_RDONLY);
+        SYLAR_ASSERT(mgr->get(fd, true));
+        fds.push_back(fd);
+    }
+    uint64_t begin = sylar::GetCurrentMS();
+    std::vector<sylar::Thread::ptr> workers;
+    for(int t = 0; t < threads; ++t) {
+        workers.push_back(sylar::Thread::ptr(new sylar::Thread([mgr, &fds, lookups](){
+            for(int i = 0; i < lookups; ++i) {
+                int fd = fds[i & 63];
+                SYLAR_ASSERT(mgr->get(fd)->getFd() == fd);
+            }
+        }, "lookup_" + std::to_string(t))));
+    }
+    for(auto& i : workers) {
+        i->join();
+    }
+    uint64_t cost = sylar::GetCurrentMS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "lookup threads=" << threads << " lookups=" << (uint64_t)threads * lookups
+                << " cost=" << cost << "ms";
+    for(auto fd : fds) {
+        mgr->del(fd);
+        close(fd);
+    }
+}
+
+int main(int argc, char** argv) {
+    sylar::LoggerMgr::GetInstance()->getLogger("system")->setLevel(sylar::LogLevel::WARN);
+    test_lifecycle();
+    test_shared_record();
+    int lookups = argc > 1 ? atoi(argv[1]) : 10000000;
+    bench_lookup(4, lookups);
+    SYLAR_LOG_INFO(g_logger) << "fd manager test ok";
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include "../sylar/inc/sylar.h"
+#include "../sylar/inc/fd_table.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+struct Item {
+    Item(int f) :fd(f) {}
+    int fd;
+};
+
+/**
+ * @brief 多个线程同时分配同一批fd，每个fd只有一个元素
+ */
+void test_concurrent_create() {
+    sylar::FdTable<Item, 4, 64> table;
+    const int count = 64 * 16;
+    std::vector<std::vector<Item*> > seen(4, std::vector<Item*>(count));
+    std::vector<sylar::Thread::ptr> threads;
+    for(int t = 0; t < 4; ++t) {
+        threads.push_back(sylar::Thread::ptr(new sylar::Thread([&table, &seen, t, count](){
+            //不同线程按不同顺序分配
+            for(int i = 0; i < count; ++i) {
+                int fd = (i * (2 * t + 1)) % count;
+                seen[t][fd] = table.getOrCreate(fd);
+            }
+        }, "create_" + std::to_string(t))));
+    }
+    for(auto& i : threads) {
+        i->join();
+    }
+    for(int fd = 0; fd < count; ++fd) {
+        SYLAR_ASSERT(seen[0][fd] && seen[0][fd]->fd == fd);
+        for(int t = 1; t < 4; ++t) {
+            SYLAR_ASSERT(seen[t][fd] == seen[0][fd]);
+        }
+        SYLAR_ASSERT(table.get(fd) == seen[0][fd]);
+    }
+    int visited = 0;
+    table.foreach([&visited](Item* item){
+        SYLAR_ASSERT(item->fd == visited);
+        ++visited;
+    });
+    SYLAR_ASSERT(visited == count);
+    SYLAR_ASSERT(table.Capacity() == (size_t)count);
+    SYLAR_ASSERT(!table.get(-1) && !table.getOrCreate(-1) && !table.getOrCreate(count));
+    SYLAR_LOG_INFO(g_logger) << "concurrent create ok";
+}
+
+/**
+ * @brief 只分配用到的段：稀疏的大fd不会分配它前面的元素
+ */
+void test_sparse() {
+    sylar::FdTable<Item> table;
+    SYLAR_ASSERT(!table.get(100000));
+    Item* item = table.getOrCreate(100000);
+    SYLAR_ASSERT(item && item->fd == 100000 && table.get(100000) == item);
+    SYLAR_ASSERT(!table.get(99999) && !table.get(0));
+    int visited = 0;
+    table.foreach([&visited](Item*){ ++visited; });
+    SYLAR_ASSERT(visited == 1);
+    SYLAR_LOG_INFO(g_logger) << "sparse ok";
+}
+
+/**
+ * @brief 多个线程同时对不同fd注册、删除事件
+ */
+void bench_events(int threads, int fds_per_fiber, int rounds) {
+    std::vector<int> fds;
+    {
+        sylar::IOManager iom(threads, false, "events");
+        for(int t = 0; t < threads; ++t) {
+            std::vector<int> mine;
+            for(int i = 0; i < fds_per_fiber; ++i) {
+                int sv[2];
+                SYLAR_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+                mine.push_back(sv[0]);
+                fds.push_back(sv[0]);
+                fds.push_back(sv[1]);
+            }
+            iom.schedule([&iom, mine, rounds](){
+                for(int r = 0; r < rounds; ++r) {
+                    for(auto fd : mine) {
+                        SYLAR_ASSERT(!iom.addEvent(fd, sylar::IOManager::READ, [](){}));
+                    }
+                    for(auto fd : mine) {
+                        SYLAR_ASSERT(iom.delEvent(fd, sylar::IOManager::READ));
+                    }
+                }
+            });
+        }
+        //从未注册过的fd没有上下文
+        SYLAR_ASSERT(!iom.delEvent(fds.back() + 1000, sylar::IOManager::READ));
+        SYLAR_ASSERT(!iom.cancelAll(fds.back() + 1000));
+        uint64_t begin = sylar::GetCurrentMS();
+        iom.stop();
+        uint64_t cost = sylar::GetCurrentMS() - begin;
+        uint64_t ops = (uint64_t)threads * fds_per_fiber * rounds * 2;
+        SYLAR_LOG_INFO(g_logger) << "add/del events threads=" << threads << " ops=" << ops
+                    << " cost=" << cost << "ms";
+    }
+    for(auto fd : fds) {
+        close(fd);
+    }
+}
+
+int main(int argc, char** argv) {
+    sylar::LoggerMgr::GetInstance()->getLogger("system")->setLevel(sylar::LogLevel::WARN);
+    test_concurrent_create();
+    test_sparse();
+    int rounds = argc > 1 ? atoi(argv[1]) : 2000;
+    bench_events(4, 16, rounds);
+    SYLAR_LOG_INFO(g_logger) << "fd table test ok";
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include "../sylar/inc/sylar.h"
+#include <ucontext.h>
+#include <time.h>
+
+static const int s_count = 1000000;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static ucontext_t s_main_ctx;
+static ucontext_t s_fiber_ctx;
+
+static void ucontext_func() {
+    while(true) {
+        swapcontext(&s_fiber_ctx, &s_main_ctx);
+    }
+}
+
+/**
+ * @brief glibc swapcontext往返切换的耗时，作为对比基准
+ */
+void bench_ucontext() {
+    size_t size = 128 * 1024;
+    void* stack = malloc(size);
+    getcontext(&s_fiber_ctx);
+    s_fiber_ctx.uc_link = nullptr;
+    s_fiber_ctx.uc_stack.ss_sp = stack;
+    s_fiber_ctx.uc_stack.ss_size = size;
+    makecontext(&s_fiber_ctx, &ucontext_func, 0);
+
+    uint64_t begin = now_ns();
+    for(int i = 0; i < s_count; ++i) {
+        swapcontext(&s_main_ctx, &s_fiber_ctx);
+    }
+    uint64_t cost = now_ns() - begin;
+    std::cout << "ucontext swapcontext: " << (double)cost / s_count / 2
+              << " ns/switch" << std::endl;
+    free(stack);
+}
+
+/**
+ * @brief Fiber::call/back往返切换的耗时
+ */
+void bench_fiber() {
+    sylar::Fiber::GetThis();
+    sylar::Fiber* raw = nullptr;
+    sylar::Fiber::ptr fiber(new sylar::Fiber([&raw](){
+        for(int i = 0; i < s_count; ++i) {
+            raw->back();
+        }
+    }, 0, true));
+    raw = fiber.get();
+
+    uint64_t begin = now_ns();
+    for(int i = 0; i < s_count; ++i) {
+        fiber->call();
+    }
+    uint64_t cost = now_ns() - begin;
+    fiber->call();
+    std::cout << "fiber " << sylar::ContextBackend() << ": "
+              << (double)cost / s_count / 2 << " ns/switch" << std::endl;
+}
+
+/**
+ * @brief 取当前协程的耗时：Fiber::ptr(一次引用计数加减) 与 裸指针
+ */
+void bench_get_this() {
+    uint64_t begin = now_ns();
+    for(int i = 0; i < s_count; ++i) {
+        sylar::Fiber::ptr cur = sylar::Fiber::GetThis();
+        asm volatile("" : : "r"(cur.get()) : "memory");
+    }
+    uint64_t cost = now_ns() - begin;
+    std::cout << "Fiber::GetThis: " << (double)cost / s_count << " ns" << std::endl;
+
+    begin = now_ns();
+    for(int i = 0; i < s_count; ++i) {
+        sylar::Fiber* cur = sylar::Fiber::GetThisRaw();
+        asm volatile("" : : "r"(cur) : "memory");
+    }
+    cost = now_ns() - begin;
+    std::cout << "Fiber::GetThisRaw: " << (double)cost / s_count << " ns" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    sylar::LoggerMgr::GetInstance()->getLogger("system")->setLevel(sylar::LogLevel::INFO);
+    bench_ucontext();
+    bench_fiber();
+    bench_get_this();
+    return 0;
+}
@@ -0,0 +1,316 @@
+#include "../sylar/inc/sylar.h"
+#include <string.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+struct ShallowEntry {
+    void operator()() {
+        volatile char buf[512];
+        memset((char*)buf, 0, sizeof(buf));
+    }
+};
+
+struct DeepEntry {
+    void operator()() {
+        volatile char buf[32 * 1024];
+        memset((char*)buf, 0, sizeof(buf));
+    }
+};
+
+struct TraceContext {
+    ~TraceContext() {
+        --s_live;
+    }
+    TraceContext() {
+        ++s_live;
+    }
+    uint64_t trace_id = 0;
+    static std::atomic<int> s_live;
+};
+std::atomic<int> TraceContext::s_live{0};
+
+static sylar::FiberLocal<TraceContext> s_trace;
+
+void test_fiber_local() {
+    sylar::Scheduler sc(2, false, "fls");
+    sc.start();
+    std::atomic<int> mismatch{0};
+    for(int i = 0; i < 100; ++i) {
+        sc.schedule([i, &mismatch](){
+            s_trace->trace_id = i;
+            sylar::Scheduler::GetThis()->schedule(sylar::Fiber::GetThis());
+            sylar::Fiber::YieldToHold();
+            if(s_trace->trace_id != (uint64_t)i) {
+                ++mismatch;
+            }
+        });
+    }
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "fiber local mismatch=" << mismatch
+        << " live=" << TraceContext::s_live;
+    SYLAR_ASSERT(mismatch == 0);
+    SYLAR_ASSERT(TraceContext::s_live == 0);
+}
+
+void test_stack_profile() {
+    sylar::Config::Lookup<bool>("fiber.stack_profile")->setValue(true);
+
+    sylar::Scheduler sc(2, false, "test");
+    sc.start();
+    for(int i = 0; i < 10; ++i) {
+        sc.schedule(ShallowEntry());
+        sc.schedule(DeepEntry());
+    }
+    sc.stop();
+    std::string profile = sylar::Fiber::DumpStackProfile();
+    SYLAR_LOG_INFO(g_logger) << "stack profile:\n" << profile;
+
+    //把建议值作为栈大小配置加载回去
+    YAML::Node node = YAML::Load(profile);
+    YAML::Node root;
+    root["fiber"]["stack_classes"] = node["stack_classes"];
+    sylar::Config::LoadFromYaml(root);
+
+    sylar::Fiber::ptr shallow = sylar::Fiber::Create(ShallowEntry());
+    sylar::Fiber::ptr deep = sylar::Fiber::Create(DeepEntry());
+    SYLAR_LOG_INFO(g_logger) << sylar::Fiber::GetEntryName(shallow->getEntry())
+        << " stack_size=" << shallow->getStackSize();
+    SYLAR_LOG_INFO(g_logger) << sylar::Fiber::GetEntryName(deep->getEntry())
+        << " stack_size=" << deep->getStackSize();
+    SYLAR_ASSERT(shallow->getStackSize() < deep->getStackSize());
+}
+
+void test_shared_stack_objects() {
+    sylar::Scheduler sc(1, false, "shared");
+    sc.start();
+    std::atomic<int> checked{0};
+    sc.schedule(sylar::Fiber::ptr(new sylar::Fiber([&checked](){
+        int local = 0;
+        SYLAR_ASSERT(sylar::Fiber::OnSharedStack(&local));
+        //等待用的对象放在堆上，挂起期间其他协程访问的不是共享栈
+        std::unique_ptr<sylar::WaitGroup> wg(new sylar::WaitGroup);
+        SYLAR_ASSERT(!sylar::Fiber::OnSharedStack(wg.get()));
+        wg->add(1);
+        sylar::WaitGroup* p = wg.get();
+        sylar::Scheduler::GetThis()->schedule([p](){ p->done(); });
+        SYLAR_ASSERT(wg->wait());
+        ++checked;
+    }, 0, false, true)));
+    sc.schedule([&checked](){
+        int local = 0;
+        SYLAR_ASSERT(!sylar::Fiber::OnSharedStack(&local));
+        ++checked;
+    });
+    sc.stop();
+    SYLAR_ASSERT(checked == 2);
+    SYLAR_LOG_INFO(g_logger) << "shared stack objects ok";
+}
+
+/// 非默认大小的栈不进协程池，结束后直接还给栈分配器
+static const size_t s_probe_stack = 64 * 1024;
+static std::atomic<uintptr_t> s_probe_addr{0};
+
+static void stack_probe() {
+    int local = 0;
+    s_probe_addr = (uintptr_t)&local;
+}
+
+/**
+ * @brief 栈释放后放进线程本地空闲链表，同一线程再分配同样大小的栈时拿回同一块内存
+ */
+void test_stack_reuse() {
+    sylar::Scheduler sc(1, false, "stack");
+    sc.start();
+    std::vector<uintptr_t> addrs;
+    for(int i = 0; i < 3; ++i) {
+        s_probe_addr = 0;
+        //在工作线程里构造，分配和释放都在同一个线程
+        sc.schedule([](){
+            sylar::Scheduler::GetThis()->schedule(
+                sylar::Fiber::ptr(new sylar::Fiber(&stack_probe, s_probe_stack)));
+        });
+        while(!s_probe_addr) {
+            usleep(1000);
+        }
+        //等协程结束、调度器释放它
+        usleep(20 * 1000);
+        addrs.push_back(s_probe_addr);
+    }
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "stack reuse addrs=" << (void*)addrs[0] << " "
+        << (void*)addrs[1] << " " << (void*)addrs[2];
+    SYLAR_ASSERT(addrs[0] == addrs[1] && addrs[1] == addrs[2]);
+}
+
+static int overflow(int depth) {
+    volatile char buf[1024];
+    memset((char*)buf, depth, sizeof(buf));
+    return depth > 100000 ? buf[0] : overflow(depth + 1) + buf[1];
+}
+
+/**
+ * @brief 栈溢出碰到保护页时立即SIGSEGV，而不是写坏相邻的内存
+ * @details 在子进程里溢出，父进程检查子进程被SIGSEGV杀死
+ */
+void test_guard_page() {
+    pid_t pid = fork();
+    SYLAR_ASSERT(pid >= 0);
+    if(pid == 0) {
+        sylar::Scheduler sc(1, false, "guard");
+        sc.start();
+        sc.schedule(sylar::Fiber::ptr(new sylar::Fiber([](){
+            overflow(0);
+        }, s_probe_stack)));
+        sc.stop();
+        //没有被保护页拦住
+        _exit(0);
+    }
+    int status = 0;
+    SYLAR_ASSERT(waitpid(pid, &status, 0) == pid);
+    SYLAR_LOG_INFO(g_logger) << "guard page child signaled=" << WIFSIGNALED(status)
+        << " signal=" << (WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+    SYLAR_ASSERT(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+}
+
+/**
+ * @brief 多个共享栈协程在少数几个共享栈上交替运行，每次恢复后栈上的局部变量都要原样恢复
+ * @details 同时检查保存区只拷贝了实际用到的部分，远小于共享栈本身
+ */
+void test_shared_stack_interleave() {
+    const int fibers = 64;
+    const int rounds = 20;
+    uint32_t stack_size = sylar::Config::Lookup<uint32_t>("fiber.shared_stack_size")->getValue();
+    sylar::Scheduler sc(1, false, "interleave");
+    sc.start();
+    std::atomic<int> corrupt{0};
+    std::atomic<int> finished{0};
+    std::atomic<size_t> max_saved{0};
+    for(int i = 0; i < fibers; ++i) {
+        sc.schedule(sylar::Fiber::ptr(new sylar::Fiber([i, rounds, &corrupt, &finished, &max_saved](){
+            uint32_t locals[64];
+            for(int r = 0; r < rounds; ++r) {
+                for(int k = 0; k < 64; ++k) {
+                    locals[k] = i * 100000 + r * 100 + k;
+                }
+                //让出后由其他协程占用同一个共享栈，恢复时栈内容从保存区拷回
+                sylar::Fiber::YieldToReady();
+                for(int k = 0; k < 64; ++k) {
+                    if(locals[k] != (uint32_t)(i * 100000 + r * 100 + k)) {
+                        ++corrupt;
+                        break;
+                    }
+                }
+                size_t saved = sylar::Fiber::GetThisRaw()->getSavedStackSize();
+                size_t old = max_saved;
+                while(saved > old && !max_saved.compare_exchange_weak(old, saved));
+            }
+            ++finished;
+        }, 0, false, true)));
+    }
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "shared stack interleave fibers=" << fibers << " rounds=" << rounds
+        << " corrupt=" << corrupt << " max_saved=" << max_saved << " stack=" << stack_size;
+    SYLAR_ASSERT(finished == fibers);
+    SYLAR_ASSERT(corrupt == 0);
+    SYLAR_ASSERT(max_saved > 0);
+    SYLAR_ASSERT(max_saved < stack_size / 16);
+}
+
+/**
+ * @brief 调度n个回调，每个回调挂起(HOLD)一次，由测试线程统一重新调度，等全部结束后返回
+ * @return 所有回调都挂起之后、重新调度之前，被恢复执行过的回调个数
+ */
+static int hold_round(sylar::Scheduler& sc, int n) {
+    sylar::Mutex mutex;
+    std::vector<sylar::Fiber::ptr> held;
+    std::atomic<int> resumed{0};
+    std::atomic<int> finished{0};
+    for(int i = 0; i < n; ++i) {
+        sc.schedule([&mutex, &held, &resumed, &finished](){
+            {
+                sylar::Mutex::Lock lock(mutex);
+                held.push_back(sylar::Fiber::GetThis());
+            }
+            sylar::Fiber::YieldToHold();
+            ++resumed;
+            ++finished;
+        });
+    }
+    //等所有回调都挂起
+    while(true) {
+        {
+            sylar::Mutex::Lock lock(mutex);
+            if((int)held.size() == n) {
+                bool all_hold = true;
+                for(auto& i : held) {
+                    all_hold = all_hold && i->getState() == sylar::Fiber::HOLD;
+                }
+                if(all_hold) {
+                    break;
+                }
+            }
+        }
+        usleep(1000);
+    }
+    //持有者不调度，HOLD的协程不能被调度器自己恢复
+    usleep(50 * 1000);
+    int early = resumed;
+    {
+        sylar::Mutex::Lock lock(mutex);
+        for(auto& i : held) {
+            sc.schedule(&i);
+        }
+    }
+    while(finished < n) {
+        usleep(1000);
+    }
+    return early;
+}
+
+/**
+ * @brief HOLD的协程只有在持有者重新调度之后才会继续执行
+ */
+void test_hold_not_requeued() {
+    sylar::Scheduler sc(1, false, "hold");
+    sc.start();
+    int early = hold_round(sc, 8);
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "hold early_resumed=" << early;
+    SYLAR_ASSERT(early == 0);
+}
+
+/**
+ * @brief 预热之后反复执行回调，协程池应当命中，PoolMisses不再增长
+ */
+void test_fiber_pool() {
+    const int n = 32;
+    sylar::Scheduler sc(1, false, "pool");
+    sc.start();
+    //预热：挂起的回调各占一个协程，结束后回到工作线程的协程池
+    hold_round(sc, n);
+    uint64_t misses = sylar::Fiber::PoolMisses();
+    uint64_t hits = sylar::Fiber::PoolHits();
+    for(int r = 0; r < 10; ++r) {
+        hold_round(sc, n);
+    }
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "fiber pool misses " << misses << " -> " << sylar::Fiber::PoolMisses()
+        << " hits " << hits << " -> " << sylar::Fiber::PoolHits();
+    SYLAR_ASSERT(sylar::Fiber::PoolMisses() == misses);
+    SYLAR_ASSERT(sylar::Fiber::PoolHits() - hits >= 10u * n);
+}
+
+int main(int argc, char** argv) {
+    //fork放在创建任何线程之前
+    test_guard_page();
+    test_stack_reuse();
+    test_fiber_local();
+    test_shared_stack_objects();
+    test_shared_stack_interleave();
+    test_hold_not_requeued();
+    test_fiber_pool();
+    test_stack_profile();
+    return 0;
+}
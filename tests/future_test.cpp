@@ -0,0 +1,98 @@
+#include "../sylar/inc/sylar.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 模拟一个耗时ms毫秒的异步请求，由定时器设置结果
+ */
+sylar::Future<int> async_request(int value, uint64_t ms) {
+    auto promise = std::make_shared<sylar::Promise<int> >();
+    sylar::IOManager::GetThis()->addTimer(ms, [promise, value](){
+        promise->setValue(value);
+    });
+    return promise->getFuture();
+}
+
+void test_fan_out() {
+    uint64_t begin = sylar::GetCurrentMS();
+    std::vector<sylar::Future<int> > futures;
+    for(int i = 0; i < 10; ++i) {
+        futures.push_back(async_request(i, 100));
+    }
+    std::vector<int> values = sylar::whenAll(futures).get();
+    uint64_t cost = sylar::GetCurrentMS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "whenAll size=" << values.size() << " cost=" << cost << "ms";
+    SYLAR_ASSERT(values.size() == 10);
+    for(int i = 0; i < 10; ++i) {
+        SYLAR_ASSERT(values[i] == i);
+    }
+
+    std::vector<sylar::Future<int> > race;
+    race.push_back(async_request(0, 300));
+    race.push_back(async_request(1, 50));
+    size_t first = sylar::whenAny(race).get();
+    SYLAR_LOG_INFO(g_logger) << "whenAny first=" << first;
+    SYLAR_ASSERT(first == 1);
+}
+
+void test_timeout() {
+    sylar::Future<int> f = async_request(1, 500);
+    bool ok = f.wait(50);
+    SYLAR_LOG_INFO(g_logger) << "wait(50) ok=" << ok;
+    SYLAR_ASSERT(!ok);
+    SYLAR_ASSERT(f.get() == 1);
+}
+
+void test_exception() {
+    sylar::Promise<void> promise;
+    promise.setException(std::make_exception_ptr(std::runtime_error("failed")));
+    try {
+        promise.getFuture().get();
+        SYLAR_ASSERT(false);
+    } catch (std::runtime_error& e) {
+        SYLAR_LOG_INFO(g_logger) << "exception: " << e.what();
+    }
+}
+
+/**
+ * @brief whenAny的空输入立即失败；whenAll取下标最小的异常，而不是最先发生的
+ */
+void test_combinators() {
+    try {
+        sylar::whenAny(std::vector<sylar::Future<int> >()).get();
+        SYLAR_ASSERT(false);
+    } catch (std::invalid_argument& e) {
+        SYLAR_LOG_INFO(g_logger) << "whenAny empty: " << e.what();
+    }
+
+    std::vector<sylar::Future<void> > futures;
+    auto late = std::make_shared<sylar::Promise<void> >();
+    auto early = std::make_shared<sylar::Promise<void> >();
+    futures.push_back(late->getFuture());
+    futures.push_back(early->getFuture());
+    sylar::Future<void> all = sylar::whenAll(futures);
+    early->setException(std::make_exception_ptr(std::runtime_error("early")));
+    late->setException(std::make_exception_ptr(std::runtime_error("late")));
+    try {
+        all.get();
+        SYLAR_ASSERT(false);
+    } catch (std::runtime_error& e) {
+        SYLAR_ASSERT(std::string(e.what()) == "late");
+    }
+}
+
+int main(int argc, char** argv) {
+    sylar::IOManager iom(2, false, "future");
+    iom.schedule(&test_fan_out);
+    iom.schedule(&test_timeout);
+    iom.schedule(&test_combinators);
+    iom.schedule(&test_exception);
+
+    //普通线程等待协程里设置的结果
+    sylar::Promise<std::string> promise;
+    iom.schedule([&promise](){
+        promise.setValue("from fiber");
+    });
+    SYLAR_LOG_INFO(g_logger) << "thread got: " << promise.getFuture().get();
+    return 0;
+}
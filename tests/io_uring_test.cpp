@@ -0,0 +1,207 @@
+#include "../sylar/inc/sylar.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::ConfigVar<std::string>::ptr g_backend =
+    sylar::Config::Lookup<std::string>("iomanager.backend", "epoll");
+
+static void make_pair(int fds[2]) {
+    int rt = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    SYLAR_ASSERT(!rt);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+}
+
+/**
+ * @brief 多组协程通过socketpair来回传递计数，返回耗时(ms)
+ * @details 连接多时，io_uring后端一次io_uring_enter提交、等待一批请求
+ * @param[in] hooked 使用hook的read/write/recv/send，否则使用IOManager的读写
+ */
+uint64_t ping_pong(sylar::IOManager::Backend backend, int pairs, int rounds, bool hooked = false) {
+    std::vector<int> fds(pairs * 2);
+    for(int i = 0; i < pairs; ++i) {
+        make_pair(&fds[i * 2]);
+    }
+    if(hooked) {
+        for(auto fd : fds) {
+            SYLAR_ASSERT(sylar::FdMgr::GetInstance()->get(fd, true));
+        }
+    }
+    uint64_t begin = sylar::GetCurrentMS();
+    {
+        sylar::IOManager iom(4, false, "ping_pong", backend);
+        SYLAR_ASSERT(iom.getBackend() == backend);
+        for(int p = 0; p < pairs; ++p) {
+            int a = fds[p * 2];
+            int b = fds[p * 2 + 1];
+            iom.schedule([&iom, a, rounds, hooked](){
+                for(int i = 0; i < rounds; ++i) {
+                    SYLAR_ASSERT((hooked ? write(a, &i, sizeof(i)) : iom.write(a, &i, sizeof(i))) == sizeof(i));
+                    int v = -1;
+                    SYLAR_ASSERT((hooked ? read(a, &v, sizeof(v)) : iom.read(a, &v, sizeof(v))) == sizeof(v));
+                    SYLAR_ASSERT(v == i + 1);
+                }
+            });
+            iom.schedule([&iom, b, rounds, hooked](){
+                for(int i = 0; i < rounds; ++i) {
+                    int v = -1;
+                    SYLAR_ASSERT((hooked ? recv(b, &v, sizeof(v), 0) : iom.recv(b, &v, sizeof(v), 0)) == sizeof(v));
+                    SYLAR_ASSERT(v == i);
+                    ++v;
+                    SYLAR_ASSERT((hooked ? send(b, &v, sizeof(v), 0) : iom.send(b, &v, sizeof(v), 0)) == sizeof(v));
+                }
+            });
+        }
+    }
+    uint64_t cost = sylar::GetCurrentMS() - begin;
+    for(auto fd : fds) {
+        close(fd);
+    }
+    SYLAR_LOG_INFO(g_logger) << "ping pong backend=" << backend << " hooked=" << hooked << " pairs=" << pairs
+                << " rounds=" << rounds << " cost=" << cost << "ms";
+    return cost;
+}
+
+/**
+ * @brief 事件接口的语义和epoll后端一致
+ */
+void test_events(sylar::IOManager* iom) {
+    int fds[2];
+    make_pair(fds);
+    //可写立即触发，可读在写入数据后触发
+    std::atomic<int> fired{0};
+    iom->addEvent(fds[0], sylar::IOManager::WRITE, [&fired](){ fired |= 1; });
+    iom->addEvent(fds[0], sylar::IOManager::READ, [&fired](){ fired |= 2; });
+    usleep(20 * 1000);
+    SYLAR_ASSERT(fired == 1);
+    SYLAR_ASSERT(write(fds[1], "x", 1) == 1);
+    usleep(20 * 1000);
+    SYLAR_ASSERT(fired == 3);
+
+    //删除不触发，取消立即触发，删除后重新注册不会被之前的请求触发
+    char c;
+    SYLAR_ASSERT(read(fds[0], &c, 1) == 1);
+    fired = 0;
+    iom->addEvent(fds[0], sylar::IOManager::READ, [&fired](){ fired |= 4; });
+    SYLAR_ASSERT(iom->delEvent(fds[0], sylar::IOManager::READ));
+    iom->addEvent(fds[0], sylar::IOManager::READ, [&fired](){ fired |= 8; });
+    usleep(20 * 1000);
+    SYLAR_ASSERT(fired == 0);
+    SYLAR_ASSERT(iom->cancelEvent(fds[0], sylar::IOManager::READ));
+    usleep(20 * 1000);
+    SYLAR_ASSERT(fired == 8);
+
+    //协程等待可读
+    iom->addEvent(fds[0], sylar::IOManager::READ);
+    sylar::IOManager::GetThis()->addTimer(10, [fds](){
+        SYLAR_ASSERT(write(fds[1], "y", 1) == 1);
+    });
+    sylar::Fiber::YieldToHold();
+    SYLAR_ASSERT(read(fds[0], &c, 1) == 1 && c == 'y');
+    close(fds[0]);
+    close(fds[1]);
+    SYLAR_LOG_INFO(g_logger) << "events ok";
+}
+
+void test_timeout(sylar::IOManager* iom) {
+    int fds[2];
+    make_pair(fds);
+    char buf[16];
+    uint64_t begin = sylar::GetCurrentMS();
+    ssize_t n = iom->read(fds[0], buf, sizeof(buf), 30);
+    uint64_t cost = sylar::GetCurrentMS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "read timeout n=" << n << " errno=" << errno << " cost=" << cost << "ms";
+    SYLAR_ASSERT(n == -1 && errno == ETIMEDOUT);
+    SYLAR_ASSERT(cost >= 25 && cost < 500);
+    //超时不影响之后的读写
+    SYLAR_ASSERT(iom->write(fds[1], "z", 1) == 1);
+    SYLAR_ASSERT(iom->read(fds[0], buf, sizeof(buf), 1000) == 1 && buf[0] == 'z');
+    close(fds[0]);
+    close(fds[1]);
+}
+
+/**
+ * @brief hook的recv/send/read/write在io_uring后端由内核完成读写，超时取SO_RCVTIMEO，hook的close取消请求
+ */
+void test_hooked_io(sylar::IOManager* iom) {
+    int fds[2];
+    SYLAR_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    //和hook的socket一样初始化socket属性，之后的读写经过hook
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fds[0], true);
+    SYLAR_ASSERT(ctx && ctx->isSocket());
+    SYLAR_ASSERT(sylar::FdMgr::GetInstance()->get(fds[1], true));
+    char buf[16];
+
+    //接收方挂起期间，请求在内核里，没有注册poll事件
+    std::atomic<bool> in_ring{false};
+    iom->schedule([ctx, &fds, &in_ring](){
+        usleep(20 * 1000);
+        {
+            sylar::FdCtx::MutexType::Lock lock(ctx->mutex);
+            in_ring = ctx->ringOps == 1 && ctx->events == 0;
+        }
+        SYLAR_ASSERT(send(fds[1], "x", 1, 0) == 1);
+    });
+    ssize_t n = recv(fds[0], buf, sizeof(buf), 0);
+    SYLAR_LOG_INFO(g_logger) << "hooked recv n=" << n << " in_ring=" << in_ring;
+    SYLAR_ASSERT(n == 1 && buf[0] == 'x');
+    SYLAR_ASSERT(in_ring);
+
+    //超时取fd的SO_RCVTIMEO
+    ctx->setTimeOut(SO_RCVTIMEO, 30);
+    uint64_t begin = sylar::GetCurrentMS();
+    n = read(fds[0], buf, sizeof(buf));
+    uint64_t cost = sylar::GetCurrentMS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "hooked read timeout n=" << n << " errno=" << errno << " cost=" << cost << "ms";
+    SYLAR_ASSERT(n == -1 && errno == ETIMEDOUT);
+    SYLAR_ASSERT(cost >= 25 && cost < 500);
+    ctx->setTimeOut(SO_RCVTIMEO, -1);
+    SYLAR_ASSERT(write(fds[1], "y", 1) == 1);
+    SYLAR_ASSERT(read(fds[0], buf, sizeof(buf)) == 1 && buf[0] == 'y');
+
+    //hook的close取消内核里的请求，等待者以EBADF返回
+    iom->schedule([&fds](){
+        usleep(20 * 1000);
+        close(fds[0]);
+    });
+    n = recv(fds[0], buf, sizeof(buf), 0);
+    SYLAR_LOG_INFO(g_logger) << "hooked recv after close n=" << n << " errno=" << errno;
+    SYLAR_ASSERT(n == -1 && errno == EBADF);
+    close(fds[1]);
+}
+
+int main(int argc, char** argv) {
+    sylar::LoggerMgr::GetInstance()->getLogger("system")->setLevel(sylar::LogLevel::WARN);
+    {
+        //通过配置选择后端
+        g_backend->setValue("io_uring");
+        sylar::IOManager iom(2, false, "uring");
+        g_backend->setValue("epoll");
+        if(iom.getBackend() != sylar::IOManager::BACKEND_IO_URING) {
+            SYLAR_LOG_WARN(g_logger) << "io_uring not supported, skip";
+            return 0;
+        }
+        iom.schedule([&iom](){
+            test_events(&iom);
+            test_timeout(&iom);
+            test_hooked_io(&iom);
+            //定时器和睡眠
+            uint64_t begin = sylar::GetCurrentMS();
+            usleep(30 * 1000);
+            SYLAR_ASSERT(sylar::GetCurrentMS() - begin >= 25);
+        });
+    }
+    int pairs = argc > 1 ? atoi(argv[1]) : 64;
+    int rounds = argc > 2 ? atoi(argv[2]) : 1000;
+    uint64_t epoll_cost = ping_pong(sylar::IOManager::BACKEND_EPOLL, pairs, rounds);
+    uint64_t uring_cost = ping_pong(sylar::IOManager::BACKEND_IO_URING, pairs, rounds);
+    SYLAR_LOG_INFO(g_logger) << "epoll=" << epoll_cost << "ms io_uring=" << uring_cost << "ms";
+    //hook的读写：io_uring后端由内核完成读写，epoll后端等待就绪后重试
+    epoll_cost = ping_pong(sylar::IOManager::BACKEND_EPOLL, pairs, rounds, true);
+    uring_cost = ping_pong(sylar::IOManager::BACKEND_IO_URING, pairs, rounds, true);
+    SYLAR_LOG_INFO(g_logger) << "hooked epoll=" << epoll_cost << "ms io_uring=" << uring_cost << "ms";
+    SYLAR_LOG_INFO(g_logger) << "io_uring test ok";
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include "../sylar/inc/sylar.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::ConfigVar<bool>::ptr g_multi_reactor =
+    sylar::Config::Lookup<bool>("iomanager.multi_reactor", false);
+static sylar::ConfigVar<bool>::ptr g_persistent =
+    sylar::Config::Lookup<bool>("iomanager.epoll_persistent", false);
+
+static void make_pair(int fds[2]) {
+    int rt = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    SYLAR_ASSERT(!rt);
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+}
+
+static void wait_for(const std::atomic<int>& v, int expect) {
+    uint64_t begin = sylar::GetCurrentMS();
+    while(v != expect) {
+        SYLAR_ASSERT2(sylar::GetCurrentMS() - begin < 5000, "v=" << v << " expect=" << expect);
+        usleep(1000);
+    }
+}
+
+/**
+ * @brief 多组协程通过socketpair来回传递计数，返回耗时(ms)
+ * @details 同时统计等待可读的协程在发起等待的线程上恢复的比例
+ */
+uint64_t ping_pong(bool multi, int pairs, int rounds) {
+    g_multi_reactor->setValue(multi);
+    std::vector<int> fds(pairs * 2);
+    for(int i = 0; i < pairs; ++i) {
+        make_pair(&fds[i * 2]);
+    }
+    std::atomic<uint64_t> waits{0};
+    std::atomic<uint64_t> same{0};
+    uint64_t begin = sylar::GetCurrentMS();
+    {
+        sylar::IOManager iom(4, false, "ping_pong");
+        SYLAR_ASSERT(iom.isMultiReactor() == multi);
+        //recv返回时记录是否还在调用它的线程上
+        auto recv = [&iom, &waits, &same](int fd, int* v){
+            int before = sylar::GetThreadID();
+            SYLAR_ASSERT(iom.recv(fd, v, sizeof(*v), 0) == sizeof(*v));
+            ++waits;
+            if(sylar::GetThreadID() == before) {
+                ++same;
+            }
+        };
+        for(int p = 0; p < pairs; ++p) {
+            int a = fds[p * 2];
+            int b = fds[p * 2 + 1];
+            iom.schedule([&iom, recv, a, rounds](){
+                for(int i = 0; i < rounds; ++i) {
+                    SYLAR_ASSERT(iom.send(a, &i, sizeof(i), 0) == sizeof(i));
+                    int v = -1;
+                    recv(a, &v);
+                    SYLAR_ASSERT(v == i + 1);
+                }
+            });
+            iom.schedule([&iom, recv, b, rounds](){
+                for(int i = 0; i < rounds; ++i) {
+                    int v = -1;
+                    recv(b, &v);
+                    SYLAR_ASSERT(v == i);
+                    ++v;
+                    SYLAR_ASSERT(iom.send(b, &v, sizeof(v), 0) == sizeof(v));
+                }
+            });
+        }
+    }
+    uint64_t cost = sylar::GetCurrentMS() - begin;
+    for(auto fd : fds) {
+        close(fd);
+    }
+    SYLAR_LOG_INFO(g_logger) << "ping pong multi_reactor=" << multi << " pairs=" << pairs
+                << " rounds=" << rounds << " cost=" << cost << "ms same_thread="
+                << (waits ? same * 100 / waits : 0) << "%";
+    g_multi_reactor->setValue(false);
+    return cost;
+}
+
+/**
+ * @brief 线程退休时注册在它的epoll里的fd转到共享的epoll，等待者仍然会被唤醒
+ */
+void test_retire(bool persistent) {
+    g_multi_reactor->setValue(true);
+    g_persistent->setValue(persistent);
+    const int pairs = 32;
+    std::vector<int> fds(pairs * 2);
+    for(int i = 0; i < pairs; ++i) {
+        make_pair(&fds[i * 2]);
+    }
+    std::atomic<int> waiting{0};
+    std::atomic<int> done{0};
+    {
+        sylar::IOManager iom(4, false, "retire");
+        for(int p = 0; p < pairs; ++p) {
+            int a = fds[p * 2];
+            iom.schedule([&iom, &waiting, &done, a](){
+                ++waiting;
+                char c = 0;
+                SYLAR_ASSERT(iom.recv(a, &c, 1, 0) == 1 && c == 'r');
+                iom.cancelAll(a);
+                ++done;
+            });
+        }
+        wait_for(waiting, pairs);
+        usleep(20 * 1000);
+        iom.setThreadCount(1);
+        usleep(50 * 1000);
+        for(int p = 0; p < pairs; ++p) {
+            SYLAR_ASSERT(write(fds[p * 2 + 1], "r", 1) == 1);
+        }
+        wait_for(done, pairs);
+    }
+    for(auto fd : fds) {
+        close(fd);
+    }
+    g_multi_reactor->setValue(false);
+    g_persistent->setValue(false);
+    SYLAR_LOG_INFO(g_logger) << "retire persistent=" << persistent << " ok";
+}
+
+/**
+ * @brief 其他调度器的线程注册的fd放在共享的epoll里
+ */
+void test_foreign() {
+    g_multi_reactor->setValue(true);
+    int fds[2];
+    make_pair(fds);
+    std::atomic<int> fired{0};
+    {
+        sylar::IOManager iom(2, false, "foreign");
+        sylar::Scheduler sc(1, false, "other");
+        sc.start();
+        sc.schedule([&iom, &fired, fds](){
+            iom.addEvent(fds[0], sylar::IOManager::READ, [&fired](){
+                SYLAR_ASSERT(sylar::Scheduler::GetThis()->getName() == "other");
+                ++fired;
+            });
+            ++fired;
+        });
+        wait_for(fired, 1);
+        usleep(20 * 1000);
+        SYLAR_ASSERT(fired == 1);
+        SYLAR_ASSERT(write(fds[1], "f", 1) == 1);
+        wait_for(fired, 2);
+        sc.stop();
+    }
+    close(fds[0]);
+    close(fds[1]);
+    g_multi_reactor->setValue(false);
+    SYLAR_LOG_INFO(g_logger) << "foreign ok";
+}
+
+int main(int argc, char** argv) {
+    sylar::LoggerMgr::GetInstance()->getLogger("system")->setLevel(sylar::LogLevel::WARN);
+    test_retire(false);
+    test_retire(true);
+    test_foreign();
+    int pairs = argc > 1 ? atoi(argv[1]) : 64;
+    int rounds = argc > 2 ? atoi(argv[2]) : 1000;
+    uint64_t shared = ping_pong(false, pairs, rounds);
+    uint64_t multi = ping_pong(true, pairs, rounds);
+    //只输出对比，不断言更快：单核环境下两者持平
+    SYLAR_LOG_INFO(g_logger) << "shared=" << shared << "ms multi_reactor=" << multi << "ms";
+    SYLAR_LOG_INFO(g_logger) << "multi reactor test ok";
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "../sylar/inc/sylar.h"
+#include <numeric>
+#include <random>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+void test_parallel_for() {
+    std::vector<uint64_t> data(1000000);
+    uint64_t begin = sylar::GetCurrentMS();
+    sylar::parallel_for(size_t(0), data.size(), [&data](size_t i){
+        data[i] = i * i;
+    });
+    SYLAR_LOG_INFO(g_logger) << "parallel_for cost=" << sylar::GetCurrentMS() - begin << "ms";
+    for(size_t i = 0; i < data.size(); ++i) {
+        SYLAR_ASSERT(data[i] == i * i);
+    }
+}
+
+void test_parallel_reduce() {
+    uint64_t n = 1000000;
+    uint64_t sum = sylar::parallel_reduce(uint64_t(0), n, uint64_t(0)
+                    , [](uint64_t b, uint64_t e, uint64_t init){
+                        for(uint64_t i = b; i < e; ++i) {
+                            init += i;
+                        }
+                        return init;
+                    }, [](uint64_t a, uint64_t b){
+                        return a + b;
+                    });
+    SYLAR_LOG_INFO(g_logger) << "parallel_reduce sum=" << sum;
+    SYLAR_ASSERT(sum == n * (n - 1) / 2);
+
+    //不可交换的归约按分片顺序合并
+    std::string s = sylar::parallel_reduce(0, 26, std::string()
+                    , [](int b, int e, std::string init){
+                        for(int i = b; i < e; ++i) {
+                            init += (char)('a' + i);
+                        }
+                        return init;
+                    }, [](const std::string& a, const std::string& b){
+                        return a + b;
+                    }, 3);
+    SYLAR_ASSERT(s == "abcdefghijklmnopqrstuvwxyz");
+}
+
+void test_parallel_sort() {
+    std::vector<int> data(500000);
+    std::mt19937 rng(12345);
+    for(auto& i : data) {
+        i = rng();
+    }
+    std::vector<int> expect = data;
+    std::sort(expect.begin(), expect.end());
+    uint64_t begin = sylar::GetCurrentMS();
+    sylar::parallel_sort(data.begin(), data.end());
+    SYLAR_LOG_INFO(g_logger) << "parallel_sort cost=" << sylar::GetCurrentMS() - begin << "ms";
+    SYLAR_ASSERT(data == expect);
+}
+
+void test_nested_and_exception() {
+    //分片里再并行，等待时挂起协程不占线程
+    std::atomic<int> count{0};
+    sylar::parallel_for(0, 8, [&count](int i){
+        sylar::parallel_for(0, 100, [&count](int j){
+            ++count;
+        }, 10);
+    }, 1);
+    SYLAR_ASSERT(count == 800);
+
+    try {
+        sylar::parallel_for(0, 1000, [](int i){
+            if(i == 500) {
+                throw std::runtime_error("chunk failed");
+            }
+        });
+        SYLAR_ASSERT(false);
+    } catch (std::runtime_error& e) {
+        SYLAR_LOG_INFO(g_logger) << "exception: " << e.what();
+    }
+}
+
+int main(int argc, char** argv) {
+    sylar::LoggerMgr::GetInstance()->getLogger("system")->setLevel(sylar::LogLevel::WARN);
+    sylar::IOManager iom(4, false, "parallel");
+    iom.schedule(&test_parallel_for);
+    iom.schedule(&test_parallel_reduce);
+    iom.schedule(&test_parallel_sort);
+    iom.schedule(&test_nested_and_exception);
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "../sylar/inc/sylar.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::ConfigVar<uint32_t>::ptr g_low_interval =
+    sylar::Config::Lookup<uint32_t>("scheduler.low_priority_interval", 16);
+static sylar::ConfigVar<bool>::ptr g_stats_timing =
+    sylar::Config::Lookup<bool>("scheduler.stats_timing", false);
+
+static void busy_us(uint64_t us) {
+    uint64_t begin = sylar::GetMonotonicUS();
+    while(sylar::GetMonotonicUS() - begin < us);
+}
+
+/**
+ * @brief 单线程调度器：先用一个任务占住线程，放入一批任务后放开，返回执行顺序
+ */
+std::string run_order(int normal, int low, int high) {
+    sylar::Scheduler sc(1, false, "order");
+    sc.start();
+    std::atomic<bool> gate{false};
+    sc.schedule([&gate](){
+        while(!gate) {
+            busy_us(10);
+        }
+    });
+    busy_us(10 * 1000);
+    sylar::Mutex mutex;
+    std::string order;
+    auto record = [&mutex, &order](char c){
+        sylar::Mutex::Lock lock(mutex);
+        order += c;
+    };
+    for(int i = 0; i < low; ++i) {
+        sc.schedule([&record](){ record('l'); }, -1, sylar::Fiber::PRIORITY_LOW);
+    }
+    for(int i = 0; i < normal; ++i) {
+        sc.schedule([&record](){ record('n'); });
+    }
+    for(int i = 0; i < high; ++i) {
+        sc.schedule([&record](){ record('h'); }, -1, sylar::Fiber::PRIORITY_HIGH);
+    }
+    gate = true;
+    sc.stop();
+    return order;
+}
+
+void test_dispatch() {
+    std::string order = run_order(1, 1, 1);
+    SYLAR_LOG_INFO(g_logger) << "order=" << order;
+    SYLAR_ASSERT(order == "hnl");
+
+    //严格模式：低优先级只在没有其他任务时执行
+    g_low_interval->setValue(0);
+    order = run_order(20, 5, 2);
+    SYLAR_LOG_INFO(g_logger) << "strict order=" << order;
+    SYLAR_ASSERT(order == "hh" + std::string(20, 'n') + std::string(5, 'l'));
+
+    //加权：每4次取一个低优先级任务，后台任务不会被饿死
+    g_low_interval->setValue(4);
+    order = run_order(20, 5, 2);
+    SYLAR_LOG_INFO(g_logger) << "weighted order=" << order;
+    SYLAR_ASSERT(order.substr(0, 2) == "hh");
+    SYLAR_ASSERT(order.find('l') < order.rfind('n'));
+    g_low_interval->setValue(16);
+}
+
+/**
+ * @brief 后台任务占满线程时，前台协程被唤醒后的排队时间
+ * @return 前台优先级的排队时间p99(us)
+ */
+uint64_t foreground_p99(sylar::Fiber::Priority priority) {
+    sylar::IOManager iom(2, false, "isolation");
+    std::atomic<bool> stop{false};
+    //后台：持续提交每个占用200us的任务，保持队列里一直有积压
+    iom.schedule([&iom, &stop](){
+        while(!stop) {
+            for(int i = 0; i < 50; ++i) {
+                iom.schedule([](){
+                    busy_us(200);
+                }, -1, sylar::Fiber::PRIORITY_LOW);
+            }
+            usleep(5 * 1000);
+        }
+    });
+    //前台：周期性被定时器唤醒
+    std::atomic<bool> done{false};
+    iom.schedule([priority, &stop, &done](){
+        sylar::Fiber::GetThis()->setPriority(priority);
+        for(int i = 0; i < 100; ++i) {
+            usleep(2 * 1000);
+            SYLAR_ASSERT(sylar::Fiber::GetThis()->getPriority() == priority);
+        }
+        stop = true;
+        done = true;
+    });
+    while(!done) {
+        usleep(10 * 1000);
+    }
+    sylar::Scheduler::Stats stats = iom.getStats();
+    uint64_t p99 = stats.priorityQueueWait[priority].percentile(0.99);
+    SYLAR_LOG_INFO(g_logger) << "foreground priority=" << priority
+                << " p99=" << p99 << "us low_p99=" << stats.priorityQueueWait[sylar::Fiber::PRIORITY_LOW].percentile(0.99) << "us";
+    return p99;
+}
+
+void test_isolation() {
+    uint64_t low = foreground_p99(sylar::Fiber::PRIORITY_LOW);
+    uint64_t high = foreground_p99(sylar::Fiber::PRIORITY_HIGH);
+    SYLAR_ASSERT(high < low);
+}
+
+void test_timer() {
+    sylar::IOManager iom(2, false, "timer");
+    std::atomic<int> priority{-1};
+    iom.addTimer(5, [&priority](){
+        priority = sylar::Fiber::GetThis()->getPriority();
+    }, false, sylar::Fiber::PRIORITY_HIGH);
+    while(priority == -1) {
+        usleep(1000);
+    }
+    SYLAR_ASSERT(priority == sylar::Fiber::PRIORITY_HIGH);
+    sylar::Scheduler::Stats stats = iom.getStats();
+    SYLAR_ASSERT(stats.priorityQueueWait[sylar::Fiber::PRIORITY_HIGH].count == 1);
+}
+
+int main(int argc, char** argv) {
+    sylar::LoggerMgr::GetInstance()->getLogger("system")->setLevel(sylar::LogLevel::WARN);
+    //按优先级的排队耗时直方图
+    g_stats_timing->setValue(true);
+    test_dispatch();
+    test_timer();
+    test_isolation();
+    SYLAR_LOG_INFO(g_logger) << "priority test ok";
+    return 0;
+}
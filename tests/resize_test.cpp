@@ -0,0 +1,157 @@
+#include "../sylar/inc/sylar.h"
+#include <set>
+#include <thread>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::ConfigVar<uint32_t>::ptr g_io_thread_num =
+    sylar::Config::Lookup<uint32_t>("workers.io.thread_num", 2, "io worker thread num");
+
+static std::atomic<uint64_t> s_done{0};
+static sylar::Mutex s_mutex;
+static std::set<int> s_threads;
+
+/**
+ * @brief 一批很短的任务，记录执行过的线程
+ */
+void run_batch(sylar::Scheduler* sc, int count) {
+    {
+        sylar::Mutex::Lock lock(s_mutex);
+        s_threads.clear();
+    }
+    uint64_t target = s_done + count;
+    for(int i = 0; i < count; ++i) {
+        sc->schedule([](){
+            {
+                sylar::Mutex::Lock lock(s_mutex);
+                s_threads.insert(sylar::GetThreadID());
+            }
+            //占住线程一会，让其他线程也领到任务
+            usleep(200);
+            ++s_done;
+        });
+    }
+    while(s_done < target) {
+        usleep(1000);
+    }
+}
+
+size_t threads_used() {
+    sylar::Mutex::Lock lock(s_mutex);
+    return s_threads.size();
+}
+
+void test_config_resize() {
+    sylar::IOManager iom(2, false, "resize");
+    iom.bindThreadCount(g_io_thread_num);
+    run_batch(&iom, 2000);
+    SYLAR_LOG_INFO(g_logger) << "thread_num=2 used=" << threads_used();
+    SYLAR_ASSERT(iom.getThreadCount() == 2);
+
+    YAML::Node root = YAML::Load("workers:\n  io:\n    thread_num: 4");
+    sylar::Config::LoadFromYaml(root);
+    SYLAR_ASSERT(iom.getThreadCount() == 4);
+    run_batch(&iom, 4000);
+    SYLAR_LOG_INFO(g_logger) << "thread_num=4 used=" << threads_used();
+    SYLAR_ASSERT(threads_used() > 2);
+
+    g_io_thread_num->setValue(1);
+    SYLAR_ASSERT(iom.getThreadCount() == 1);
+    //等退休的线程排空退出
+    usleep(100 * 1000);
+    run_batch(&iom, 1000);
+    SYLAR_LOG_INFO(g_logger) << "thread_num=1 used=" << threads_used();
+    SYLAR_ASSERT(threads_used() == 1);
+
+    //扩容复用退出的线程上下文
+    g_io_thread_num->setValue(3);
+    run_batch(&iom, 3000);
+    SYLAR_LOG_INFO(g_logger) << "thread_num=3 used=" << threads_used();
+    SYLAR_ASSERT(iom.getThreadCount() == 3);
+}
+
+/**
+ * @brief 缩容时正在执行、还会继续让出的任务不能丢
+ */
+void test_shrink_drain() {
+    sylar::Scheduler sc(4, false, "drain");
+    sc.start();
+    uint64_t target = s_done + 400;
+    for(int i = 0; i < 400; ++i) {
+        sc.schedule([](){
+            //普通调度器里没有IOManager，不能用hook的usleep
+            for(int j = 0; j < 5; ++j) {
+                uint64_t begin = sylar::GetMonotonicUS();
+                while(sylar::GetMonotonicUS() - begin < 100);
+                sylar::Fiber::YieldToReady();
+            }
+            ++s_done;
+        });
+    }
+    sc.setThreadCount(1);
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "drain done=" << s_done - (target - 400);
+    SYLAR_ASSERT(s_done == target);
+}
+
+/**
+ * @brief 线程退休的同时不断有指定给它的任务，随后马上扩容复用它的上下文，不能死锁、不能丢任务
+ */
+void test_retire_pinned() {
+    sylar::Scheduler sc(4, false, "pinned");
+    sc.start();
+    //记下工作线程的id
+    std::set<int> ids;
+    sylar::Mutex mutex;
+    std::atomic<int> seen{0};
+    for(int i = 0; i < 400; ++i) {
+        sc.schedule([&ids, &mutex, &seen](){
+            uint64_t begin = sylar::GetMonotonicUS();
+            while(sylar::GetMonotonicUS() - begin < 200);
+            sylar::Mutex::Lock lock(mutex);
+            ids.insert(sylar::GetThreadID());
+            ++seen;
+        });
+    }
+    while(seen < 400) {
+        usleep(1000);
+    }
+    std::vector<int> threads(ids.begin(), ids.end());
+    SYLAR_LOG_INFO(g_logger) << "pinned targets=" << threads.size();
+
+    std::atomic<bool> producing{true};
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> done{0};
+    std::thread producer([&](){
+        while(producing) {
+            //限制在途任务数，只关心退休和扩容期间的投递
+            if(sent - done > 256) {
+                sched_yield();
+                continue;
+            }
+            for(int id : threads) {
+                sc.schedule([&done](){ ++done; }, id);
+                ++sent;
+            }
+        }
+    });
+    for(int i = 0; i < 200; ++i) {
+        sc.setThreadCount(1);
+        usleep(i % 5 * 100);
+        sc.setThreadCount(4);
+    }
+    producing = false;
+    producer.join();
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "pinned sent=" << sent << " done=" << done;
+    SYLAR_ASSERT(done == sent);
+}
+
+int main(int argc, char** argv) {
+    sylar::LoggerMgr::GetInstance()->getLogger("system")->setLevel(sylar::LogLevel::WARN);
+    test_config_resize();
+    test_shrink_drain();
+    test_retire_pinned();
+    SYLAR_LOG_INFO(g_logger) << "resize test ok";
+    return 0;
+}
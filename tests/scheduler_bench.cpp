@@ -0,0 +1,154 @@
+#include "../sylar/inc/sylar.h"
+#include <sys/resource.h>
+#include <unistd.h>
+
+static std::atomic<uint64_t> s_done{0};
+
+static const int s_roots = 64;
+static const int s_children = 2000;
+
+/**
+ * @brief 每个根任务在工作线程里再派生一批很短的任务，派生的任务进入本地队列，空闲线程窃取
+ */
+void root_task() {
+    sylar::Scheduler* sc = sylar::Scheduler::GetThis();
+    for(int i = 0; i < s_children; ++i) {
+        sc->schedule([](){
+            ++s_done;
+        });
+    }
+}
+
+/**
+ * @brief 捕获超过Task::INLINE_SIZE的回调放在堆上，和内联存放的回调对比
+ */
+void root_task_large() {
+    sylar::Scheduler* sc = sylar::Scheduler::GetThis();
+    char payload[sylar::Task::INLINE_SIZE + 16] = {1};
+    for(int i = 0; i < s_children; ++i) {
+        sc->schedule([payload](){
+            s_done += payload[0];
+        });
+    }
+}
+
+void bench(size_t threads, void (*root)() = &root_task) {
+    s_done = 0;
+    uint64_t begin = sylar::GetCurrentMS();
+    {
+        sylar::Scheduler sc(threads, false, "bench");
+        sc.start();
+        for(int i = 0; i < s_roots; ++i) {
+            sc.schedule(root);
+        }
+        sc.stop();
+        sylar::Scheduler::Stats stats = sc.getStats();
+        SYLAR_ASSERT(stats.executed >= (uint64_t)s_roots * (s_children + 1));
+        if(threads == 1 || root != &root_task) {
+            std::cout << stats.toString() << std::endl;
+        } else {
+            std::cout << "stolen=" << stats.stolen << " idle_wakeups=" << stats.idleWakeups
+                      << " queue_wait_p99=" << stats.queueWait.percentile(0.99) << "us"
+                      << " run_slice_p99=" << stats.runSlice.percentile(0.99) << "us" << std::endl;
+        }
+    }
+    uint64_t cost = sylar::GetCurrentMS() - begin;
+    SYLAR_ASSERT(s_done == (uint64_t)s_roots * s_children);
+    std::cout << (root == &root_task ? "" : "large_capture ")
+              << "threads=" << threads << " tasks=" << s_done
+              << " cost=" << cost << "ms"
+              << " throughput=" << (cost ? s_done / cost : 0) << "/ms" << std::endl;
+}
+
+static double cpu_seconds() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+        + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/**
+ * @brief 没有任务时工作线程应该睡眠，不占用CPU
+ */
+void bench_idle(size_t threads) {
+    sylar::Scheduler sc(threads, false, "idle");
+    sc.start();
+    usleep(100 * 1000);
+    double begin = cpu_seconds();
+    usleep(500 * 1000);
+    double cost = cpu_seconds() - begin;
+    sc.stop();
+    std::cout << "idle threads=" << threads << " cpu=" << cost * 1000 << "ms/500ms" << std::endl;
+    SYLAR_ASSERT(cost < 0.1);
+}
+
+/**
+ * @brief 不让出的任务，看门狗应该报告一次
+ */
+void slow_handler() {
+    uint64_t begin = sylar::GetCurrentMS();
+    while(sylar::GetCurrentMS() - begin < 100);
+}
+
+void test_watchdog() {
+    auto budget = sylar::Config::Lookup<uint32_t>("scheduler.watchdog_budget_ms");
+    budget->setValue(20);
+    sylar::Scheduler::Stats stats;
+    {
+        sylar::Scheduler sc(2, false, "watchdog");
+        sc.start();
+        sc.schedule(&slow_handler);
+        sc.stop();
+        stats = sc.getStats();
+    }
+    budget->setValue(0);
+    std::cout << "watchdog slow_slices=" << stats.slowSlices << std::endl;
+    SYLAR_ASSERT(stats.slowSlices == 1);
+}
+
+/**
+ * @brief 外部线程只提交不执行，节点在工作线程释放，应当经中转池回到提交线程，而不是每次都new
+ */
+void test_external_producer() {
+    const int n = 4096;
+    const int rounds = 10;
+    std::atomic<int> done{0};
+    sylar::Scheduler sc(2, false, "producer");
+    sc.start();
+    auto round = [&sc, &done, n](){
+        done = 0;
+        for(int i = 0; i < n; ++i) {
+            sc.schedule([&done](){ ++done; });
+        }
+        while(done < n) {
+            usleep(100);
+        }
+    };
+    //预热：填满工作线程的本地链表
+    for(int i = 0; i < 3; ++i) {
+        round();
+    }
+    uint64_t misses = sylar::Task::CacheMisses();
+    for(int i = 0; i < rounds; ++i) {
+        round();
+    }
+    uint64_t grown = sylar::Task::CacheMisses() - misses;
+    sc.stop();
+    std::cout << "external producer tasks=" << n * rounds << " new_nodes=" << grown << std::endl;
+    SYLAR_ASSERT(grown == 0);
+}
+
+int main(int argc, char** argv) {
+    sylar::LoggerMgr::GetInstance()->getLogger("system")->setLevel(sylar::LogLevel::WARN);
+    //输出排队耗时和单次运行耗时的分布
+    sylar::Config::Lookup<bool>("scheduler.stats_timing")->setValue(true);
+    size_t max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    for(size_t i = 1; i <= max_threads; i *= 2) {
+        bench(i);
+    }
+    bench(1, &root_task_large);
+    bench_idle(max_threads);
+    test_watchdog();
+    test_external_producer();
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include "../sylar/inc/sylar.h"
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+/**
+ * @brief 分发-汇总：子任务在IO上挂起，等待方也挂起，不占用线程
+ */
+void test_scatter_gather() {
+    std::atomic<int> sum{0};
+    uint64_t begin = sylar::GetCurrentMS();
+    {
+        sylar::TaskGroup group;
+        for(int i = 1; i <= 100; ++i) {
+            group.spawn([&sum, i](){
+                usleep(50 * 1000);
+                sum += i;
+            });
+        }
+        group.join();
+    }
+    uint64_t cost = sylar::GetCurrentMS() - begin;
+    SYLAR_LOG_INFO(g_logger) << "scatter gather sum=" << sum << " cost=" << cost << "ms";
+    SYLAR_ASSERT(sum == 5050);
+    SYLAR_ASSERT(cost < 1000);
+}
+
+void test_errors() {
+    sylar::TaskGroup group(nullptr, false);
+    std::atomic<int> ok{0};
+    for(int i = 0; i < 10; ++i) {
+        group.spawn([&ok, i](){
+            if(i % 4 == 0) {
+                throw std::runtime_error("child " + std::to_string(i) + " failed");
+            }
+            ++ok;
+        });
+    }
+    try {
+        group.join();
+        SYLAR_ASSERT(false);
+    } catch (sylar::TaskGroupError& e) {
+        SYLAR_LOG_INFO(g_logger) << "join: " << e.what();
+        SYLAR_ASSERT(e.errors().size() == 3);
+        for(auto& ex : e.errors()) {
+            try {
+                std::rethrow_exception(ex);
+            } catch (std::runtime_error& re) {
+                SYLAR_LOG_INFO(g_logger) << "  " << re.what();
+            }
+        }
+    }
+    //不取消时其他子任务照常执行
+    SYLAR_ASSERT(ok == 7);
+}
+
+/**
+ * @brief 取消传播到子组，取消后启动的子任务不再执行
+ */
+void test_cancel() {
+    std::atomic<int> stopped{0};
+    std::atomic<bool> late{false};
+    sylar::TaskGroup group;
+    group.spawn([&stopped](){
+        sylar::TaskGroup inner;
+        SYLAR_ASSERT(sylar::TaskGroup::Current() != &inner);
+        inner.spawn([&stopped, &inner](){
+            SYLAR_ASSERT(sylar::TaskGroup::Current() == &inner);
+            while(!sylar::TaskGroup::Cancelled()) {
+                usleep(1000);
+            }
+            ++stopped;
+        });
+        while(!sylar::TaskGroup::Cancelled()) {
+            usleep(1000);
+        }
+        ++stopped;
+    });
+    usleep(20 * 1000);
+    group.cancel();
+    group.spawn([&late](){
+        late = true;
+    });
+    group.join();
+    SYLAR_LOG_INFO(g_logger) << "cancel stopped=" << stopped;
+    SYLAR_ASSERT(stopped == 2);
+    SYLAR_ASSERT(!late);
+
+    //出错时自动取消
+    std::atomic<bool> ran{false};
+    sylar::TaskGroup failing;
+    failing.spawn([](){
+        throw std::logic_error("first");
+    });
+    failing.wait();
+    failing.spawn([&ran](){
+        ran = true;
+    });
+    SYLAR_ASSERT(failing.isCancelled());
+    SYLAR_ASSERT(failing.errors().size() == 1);
+    failing.wait();
+    SYLAR_ASSERT(!ran);
+}
+
+void test_wait_group() {
+    sylar::WaitGroup wg;
+    std::atomic<int> n{0};
+    for(int round = 0; round < 3; ++round) {
+        wg.add(4);
+        for(int i = 0; i < 4; ++i) {
+            sylar::IOManager::GetThis()->schedule([&wg, &n](){
+                usleep(5 * 1000);
+                ++n;
+                wg.done();
+            });
+        }
+        SYLAR_ASSERT(wg.wait());
+        SYLAR_ASSERT(wg.count() == 0);
+    }
+    SYLAR_ASSERT(n == 12);
+
+    wg.add();
+    uint64_t begin = sylar::GetCurrentMS();
+    SYLAR_ASSERT(!wg.wait(20));
+    SYLAR_LOG_INFO(g_logger) << "wait group timeout cost=" << sylar::GetCurrentMS() - begin << "ms";
+    wg.done();
+    SYLAR_ASSERT(wg.wait(20));
+}
+
+void run() {
+    test_scatter_gather();
+    test_errors();
+    test_cancel();
+    test_wait_group();
+    SYLAR_LOG_INFO(g_logger) << "task group test ok";
+}
+
+int main(int argc, char** argv) {
+    sylar::LoggerMgr::GetInstance()->getLogger("system")->setLevel(sylar::LogLevel::WARN);
+    sylar::IOManager iom(2, false, "task_group");
+    iom.schedule(&run);
+    return 0;
+}